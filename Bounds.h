@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glm.hpp>
+#include <cfloat>
+
+//Axis aligned bounding box
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+	AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+	void expand(const glm::vec3& point)
+	{
+		this->min = glm::min(this->min, point);
+		this->max = glm::max(this->max, point);
+	}
+
+	void expand(const AABB& box)
+	{
+		this->min = glm::min(this->min, box.min);
+		this->max = glm::max(this->max, box.max);
+	}
+
+	inline bool isEmpty() const { return this->min.x > this->max.x; }
+	inline glm::vec3 center() const { return (this->min + this->max) * 0.5f; }
+	inline glm::vec3 extents() const { return (this->max - this->min) * 0.5f; }
+
+	//Box around the eight transformed corners
+	AABB transformed(const glm::mat4& matrix) const
+	{
+		AABB result;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? this->max.x : this->min.x, (i & 2) ? this->max.y : this->min.y, (i & 4) ? this->max.z : this->min.z);
+			result.expand(glm::vec3(matrix * glm::vec4(corner, 1.f)));
+		}
+		return result;
+	}
+
+	//Distance from a point to the box, 0 when inside
+	float distanceTo(const glm::vec3& point) const
+	{
+		glm::vec3 d = glm::max(glm::max(this->min - point, point - this->max), glm::vec3(0.f));
+		return glm::length(d);
+	}
+};
+
+//Six inward facing planes (xyz normal, w distance), left right bottom top near far
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	//Planes of a projection * view matrix, in world space and normalised so plane distances are world units
+	explicit Frustum(const glm::mat4& viewProjection)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			glm::vec4 axis(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+			glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+			this->planes[i * 2] = w + axis;
+			this->planes[i * 2 + 1] = w - axis;
+		}
+		for (int i = 0; i < 6; i++)
+			this->planes[i] = this->planes[i] * (1.f / glm::length(glm::vec3(this->planes[i])));
+	}
+
+	//The same planes seen from a model's object space. Distances stay in world units, so a sphere
+	//test against them only needs the radius scaled by the model's largest scale.
+	Frustum toObjectSpace(const glm::mat4& model) const
+	{
+		Frustum result;
+		glm::mat4 transposed = glm::transpose(model);
+		for (int i = 0; i < 6; i++)
+			result.planes[i] = transposed * this->planes[i];
+		return result;
+	}
+
+	bool intersects(const glm::vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(this->planes[i]), center) + this->planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	//Conservative: boxes outside near a frustum corner can pass
+	bool intersects(const AABB& box) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 n(this->planes[i]);
+			glm::vec3 positive(n.x >= 0.f ? box.max.x : box.min.x, n.y >= 0.f ? box.max.y : box.min.y, n.z >= 0.f ? box.max.z : box.min.z);
+			if (glm::dot(n, positive) + this->planes[i].w < 0.f)
+				return false;
+		}
+		return true;
+	}
+};
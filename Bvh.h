@@ -0,0 +1,556 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <xmmintrin.h>
+
+#include <glm.hpp>
+
+#include "Bounds.h"
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Bounding volume hierarchy over world space boxes, built with the surface area heuristic ////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//32 bytes. Leaves hold count items from first; interior nodes have their children at first and first + 1
+//and BVH_INTERIOR set in count, with the number of items below them in the other bits.
+struct BvhNode
+{
+	glm::vec3 min;
+	uint32_t first;
+	glm::vec3 max;
+	uint32_t count;
+};
+
+const uint32_t BVH_INTERIOR = 0x80000000u;
+
+class Bvh
+{
+private:
+	//Frustum planes four at a time: two groups, the last two planes padded with ones that accept everything
+	struct Planes
+	{
+		__m128 nx[2], ny[2], nz[2], w[2];
+		__m128 ax[2], ay[2], az[2];
+	};
+
+	enum Classification { OUTSIDE, INTERSECTING, INSIDE };
+
+	static const int BINS = 16;
+	static const uint32_t LEAF_SIZE = 4;
+	static const uint32_t MAX_LEAF_SIZE = 16;
+	//Below this depth splits halve the item count, which keeps traversal stacks within STACK_SIZE
+	static const uint32_t SAH_DEPTH = 48;
+	static const int STACK_SIZE = 96;
+
+	std::vector<BvhNode> nodes;
+	//Item indices, arranged so every subtree's items are one contiguous range
+	std::vector<uint32_t> items;
+	std::vector<AABB> itemBounds;
+	//Boxes being built over, with the item id in first; moved around with the items so builds read them in order
+	std::vector<BvhNode> prims;
+	float buildCost;
+	float cost;
+	//Changes whenever node indices do, for anything keeping per node state
+	uint32_t buildCount;
+
+	struct Range
+	{
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t depth;
+	};
+
+	static float area(const AABB& box)
+	{
+		glm::vec3 d = box.max - box.min;
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	static void setBox(BvhNode& node, const AABB& box)
+	{
+		node.min = box.min;
+		node.max = box.max;
+	}
+
+	static AABB getBox(const BvhNode& node)
+	{
+		return AABB(node.min, node.max);
+	}
+
+	static inline float centroid(const BvhNode& prim, int axis)
+	{
+		return (prim.min[axis] + prim.max[axis]) * 0.5f;
+	}
+
+	//Picks the split of [begin, end) with the lowest binned SAH cost and partitions the build items by it.
+	//Returns end when a leaf is cheaper. With median, splits in half along the widest axis instead.
+	uint32_t split(const AABB& box, const AABB& centroids, uint32_t begin, uint32_t end, bool median)
+	{
+		uint32_t count = end - begin;
+		if (count <= LEAF_SIZE)
+			return end;
+
+		//All three axes are binned in one pass over the items
+		glm::vec3 lo = centroids.min;
+		glm::vec3 extent = centroids.max - centroids.min;
+		glm::vec3 toBin(extent.x > 0.f ? BINS / extent.x : 0.f, extent.y > 0.f ? BINS / extent.y : 0.f, extent.z > 0.f ? BINS / extent.z : 0.f);
+		AABB bins[3][BINS];
+		uint32_t counts[3][BINS] = {};
+		if (!median)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const BvhNode& prim = this->prims[i];
+				AABB primBox(prim.min, prim.max);
+				for (int axis = 0; axis < 3; axis++)
+				{
+					int bin = std::min(BINS - 1, (int)((centroid(prim, axis) - lo[axis]) * toBin[axis]));
+					bins[axis][bin].expand(primBox);
+					counts[axis][bin]++;
+				}
+			}
+		}
+
+		int bestAxis = -1;
+		int bestBin = 0;
+		float bestCost = FLT_MAX;
+		for (int axis = 0; axis < 3 && !median; axis++)
+		{
+			if (extent[axis] <= 0.f)
+				continue;
+			//Sweep from the right for the areas and counts right of every split, then from the left
+			float rightArea[BINS];
+			uint32_t rightCount[BINS];
+			AABB right;
+			uint32_t n = 0;
+			for (int b = BINS - 1; b > 0; b--)
+			{
+				right.expand(bins[axis][b]);
+				n += counts[axis][b];
+				rightArea[b] = right.isEmpty() ? 0.f : area(right);
+				rightCount[b] = n;
+			}
+			AABB left;
+			n = 0;
+			for (int b = 0; b < BINS - 1; b++)
+			{
+				left.expand(bins[axis][b]);
+				n += counts[axis][b];
+				if (n == 0 || rightCount[b + 1] == 0)
+					continue;
+				float splitCost = area(left) * n + rightArea[b + 1] * rightCount[b + 1];
+				if (splitCost < bestCost)
+				{
+					bestCost = splitCost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		//Costs are relative to the parent's area, with traversing a node costing as much as testing an item
+		float parentArea = std::max(area(box), FLT_MIN);
+		if (median || bestAxis < 0 || 1.f + bestCost / parentArea >= (float)count)
+		{
+			if (!median && count <= MAX_LEAF_SIZE)
+				return end;
+			//All centroids in one place, or a big leaf that would still be too slow: split by count
+			uint32_t middle = begin + count / 2;
+			int axis = 0;
+			if (extent.y > extent[axis]) axis = 1;
+			if (extent.z > extent[axis]) axis = 2;
+			std::nth_element(this->prims.begin() + begin, this->prims.begin() + middle, this->prims.begin() + end, [axis](const BvhNode& a, const BvhNode& b)
+			{
+				return centroid(a, axis) < centroid(b, axis);
+			});
+			return middle;
+		}
+
+		auto middle = std::partition(this->prims.begin() + begin, this->prims.begin() + end, [&](const BvhNode& prim)
+		{
+			return std::min(BINS - 1, (int)((centroid(prim, bestAxis) - lo[bestAxis]) * toBin[bestAxis])) <= bestBin;
+		});
+		return (uint32_t)(middle - this->prims.begin());
+	}
+
+	//Builds the subtree over [begin, end) into out with its root at out[rootIndex]. With a pending list, stops
+	//at subtrees of at most taskSize items and leaves them as placeholders to be built separately.
+	void buildRange(std::vector<BvhNode>& out, uint32_t rootIndex, uint32_t begin, uint32_t end, uint32_t depth, uint32_t taskSize, std::vector<Range>* pending)
+	{
+		std::vector<Range> stack;
+		stack.push_back({ rootIndex, begin, end, depth });
+		while (!stack.empty())
+		{
+			Range range = stack.back();
+			stack.pop_back();
+
+			AABB box;
+			AABB centroids;
+			for (uint32_t i = range.begin; i < range.end; i++)
+			{
+				const BvhNode& prim = this->prims[i];
+				box.expand(AABB(prim.min, prim.max));
+				centroids.expand((prim.min + prim.max) * 0.5f);
+			}
+			setBox(out[range.node], box);
+
+			uint32_t count = range.end - range.begin;
+			if (pending && count <= taskSize)
+			{
+				out[range.node].first = range.begin;
+				out[range.node].count = count;
+				pending->push_back(range);
+				continue;
+			}
+
+			uint32_t middle = this->split(box, centroids, range.begin, range.end, range.depth >= SAH_DEPTH);
+			if (middle == range.end)
+			{
+				out[range.node].first = range.begin;
+				out[range.node].count = count;
+				continue;
+			}
+			uint32_t child = (uint32_t)out.size();
+			out[range.node].first = child;
+			out[range.node].count = BVH_INTERIOR | count;
+			out.resize(out.size() + 2);
+			stack.push_back({ child + 1, middle, range.end, range.depth + 1 });
+			stack.push_back({ child, range.begin, middle, range.depth + 1 });
+		}
+	}
+
+	//SAH cost of the whole tree relative to the root's area, to tell when refitting has degraded it
+	float computeCost() const
+	{
+		if (this->nodes.empty())
+			return 0.f;
+		float sum = 0.f;
+		for (const BvhNode& node : this->nodes)
+		{
+			float a = area(getBox(node));
+			sum += (node.count & BVH_INTERIOR) ? a : a * node.count;
+		}
+		return sum / std::max(area(getBox(this->nodes[0])), FLT_MIN);
+	}
+
+	static Planes loadPlanes(const Frustum& frustum)
+	{
+		Planes p;
+		float v[4][8];
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec4 plane = i < 6 ? frustum.planes[i] : glm::vec4(0.f, 0.f, 0.f, 1.f);
+			for (int c = 0; c < 4; c++)
+				v[c][i] = plane[c];
+		}
+		__m128 signMask = _mm_set1_ps(-0.f);
+		for (int g = 0; g < 2; g++)
+		{
+			p.nx[g] = _mm_loadu_ps(v[0] + g * 4);
+			p.ny[g] = _mm_loadu_ps(v[1] + g * 4);
+			p.nz[g] = _mm_loadu_ps(v[2] + g * 4);
+			p.w[g] = _mm_loadu_ps(v[3] + g * 4);
+			p.ax[g] = _mm_andnot_ps(signMask, p.nx[g]);
+			p.ay[g] = _mm_andnot_ps(signMask, p.ny[g]);
+			p.az[g] = _mm_andnot_ps(signMask, p.nz[g]);
+		}
+		return p;
+	}
+
+	//Four planes per step: the box is outside if it is behind any plane, inside if it is in front of all
+	static Classification classify(const Planes& p, const BvhNode& node)
+	{
+		glm::vec3 center = (node.min + node.max) * 0.5f;
+		glm::vec3 extent = (node.max - node.min) * 0.5f;
+		__m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+		__m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+
+		int outside = 0;
+		int partial = 0;
+		for (int g = 0; g < 2; g++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.nx[g], cx), _mm_mul_ps(p.ny[g], cy)), _mm_add_ps(_mm_mul_ps(p.nz[g], cz), p.w[g]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p.ax[g], ex), _mm_mul_ps(p.ay[g], ey)), _mm_mul_ps(p.az[g], ez));
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			partial |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+		}
+		if (outside)
+			return OUTSIDE;
+		return partial ? INTERSECTING : INSIDE;
+	}
+
+	//Entry distance of the ray into the node, or FLT_MAX if it misses within maxDistance
+	static float intersectRay(const BvhNode& node, __m128 origin, __m128 inverse, float maxDistance)
+	{
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.min.x, node.min.y, node.min.z, 0.f), origin), inverse);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(node.max.x, node.max.y, node.max.z, 0.f), origin), inverse);
+		//The fourth lane is replaced so it never limits the interval
+		__m128 near = _mm_move_ss(_mm_shuffle_ps(_mm_min_ps(t1, t2), _mm_min_ps(t1, t2), _MM_SHUFFLE(2, 1, 0, 0)), _mm_set_ss(0.f));
+		__m128 far = _mm_move_ss(_mm_shuffle_ps(_mm_max_ps(t1, t2), _mm_max_ps(t1, t2), _MM_SHUFFLE(2, 1, 0, 0)), _mm_set_ss(maxDistance));
+		near = _mm_max_ps(near, _mm_shuffle_ps(near, near, _MM_SHUFFLE(1, 0, 3, 2)));
+		near = _mm_max_ss(near, _mm_shuffle_ps(near, near, _MM_SHUFFLE(2, 3, 0, 1)));
+		far = _mm_min_ps(far, _mm_shuffle_ps(far, far, _MM_SHUFFLE(1, 0, 3, 2)));
+		far = _mm_min_ss(far, _mm_shuffle_ps(far, far, _MM_SHUFFLE(2, 3, 0, 1)));
+		float enter = _mm_cvtss_f32(near);
+		float exit = _mm_cvtss_f32(far);
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	static inline bool overlaps(const BvhNode& node, const AABB& box)
+	{
+		return node.min.x <= box.max.x && node.max.x >= box.min.x && node.min.y <= box.max.y && node.max.y >= box.min.y &&
+			node.min.z <= box.max.z && node.max.z >= box.min.z;
+	}
+
+	//Every item below node, which is one range of items starting at its leftmost leaf
+	void appendSubtree(uint32_t node, std::vector<uint32_t>& out) const
+	{
+		uint32_t count = this->nodes[node].count & ~BVH_INTERIOR;
+		while (this->nodes[node].count & BVH_INTERIOR)
+			node = this->nodes[node].first;
+		uint32_t first = this->nodes[node].first;
+		out.insert(out.end(), this->items.begin() + first, this->items.begin() + first + count);
+	}
+
+public:
+	Bvh() : buildCost(0.f), cost(0.f), buildCount(0) {}
+
+	//Builds over count boxes, indexed 0 to count - 1 as item ids. Empty boxes are left out until the next build.
+	void build(const AABB* bounds, size_t count)
+	{
+		this->itemBounds.assign(bounds, bounds + count);
+		this->prims.clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!bounds[i].isEmpty())
+				this->prims.push_back({ bounds[i].min, (uint32_t)i, bounds[i].max, 0 });
+		}
+		this->items.clear();
+		this->nodes.clear();
+		this->buildCount++;
+		if (this->prims.empty())
+		{
+			this->buildCost = this->cost = 0.f;
+			return;
+		}
+
+		//The top of the tree is split on this thread down to one subtree per task, then the subtrees are built in parallel
+		//and appended, so children still always come after their parents
+		uint32_t itemCount = (uint32_t)this->prims.size();
+		size_t workers = Parallel::workerCount(itemCount, 16384);
+		uint32_t taskSize = workers > 1 ? std::max<uint32_t>(itemCount / (uint32_t)(workers * 4), 1) : itemCount;
+		std::vector<Range> tasks;
+		this->nodes.resize(1);
+		this->buildRange(this->nodes, 0, 0, itemCount, 0, taskSize, workers > 1 ? &tasks : nullptr);
+
+		if (!tasks.empty())
+		{
+			std::vector<std::vector<BvhNode>> subtrees(tasks.size());
+			Parallel::parallelFor(tasks.size(), 1, [&](size_t, size_t begin, size_t end)
+			{
+				for (size_t t = begin; t < end; t++)
+				{
+					subtrees[t].resize(1);
+					this->buildRange(subtrees[t], 0, tasks[t].begin, tasks[t].end, tasks[t].depth, 0, nullptr);
+				}
+			});
+			for (size_t t = 0; t < tasks.size(); t++)
+			{
+				//The subtree root replaces the placeholder, the rest is appended with its child links moved along
+				uint32_t base = (uint32_t)this->nodes.size() - 1;
+				for (size_t i = 0; i < subtrees[t].size(); i++)
+				{
+					BvhNode node = subtrees[t][i];
+					if (node.count & BVH_INTERIOR)
+						node.first += base;
+					if (i == 0)
+						this->nodes[tasks[t].node] = node;
+					else
+						this->nodes.push_back(node);
+				}
+			}
+		}
+
+		this->items.resize(itemCount);
+		for (uint32_t i = 0; i < itemCount; i++)
+			this->items[i] = this->prims[i].first;
+		this->prims.clear();
+		this->prims.shrink_to_fit();
+		this->buildCost = this->cost = this->computeCost();
+	}
+
+	//Updates the boxes of items that moved without changing the tree. bounds has the count build was given.
+	void refit(const AABB* bounds)
+	{
+		if (this->nodes.empty())
+			return;
+		std::copy(bounds, bounds + this->itemBounds.size(), this->itemBounds.begin());
+
+		Parallel::parallelFor(this->nodes.size(), 16384, [this](size_t, size_t begin, size_t end)
+		{
+			for (size_t n = begin; n < end; n++)
+			{
+				BvhNode& node = this->nodes[n];
+				if (node.count & BVH_INTERIOR)
+					continue;
+				AABB box;
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					box.expand(this->itemBounds[this->items[i]]);
+				setBox(node, box);
+			}
+		});
+		//Children always come after their parents
+		for (size_t n = this->nodes.size(); n-- > 0;)
+		{
+			BvhNode& node = this->nodes[n];
+			if (!(node.count & BVH_INTERIOR))
+				continue;
+			const BvhNode& left = this->nodes[node.first];
+			const BvhNode& right = this->nodes[node.first + 1];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+		this->cost = this->computeCost();
+	}
+
+	//Once refitting has made the tree this much slower to traverse than when it was built, rebuilding pays off
+	inline bool needsRebuild(float maxGrowth = 1.5f) const { return this->cost > this->buildCost * maxGrowth; }
+
+	//Items whose boxes are in the frustum. Nodes entirely inside it add their items without further tests.
+	void cull(const Frustum& frustum, std::vector<uint32_t>& out) const
+	{
+		if (this->nodes.empty())
+			return;
+		Planes planes = loadPlanes(frustum);
+		uint32_t stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			uint32_t index = stack[--top];
+			const BvhNode& node = this->nodes[index];
+			Classification result = classify(planes, node);
+			if (result == OUTSIDE)
+				continue;
+			if (result == INSIDE)
+				this->appendSubtree(index, out);
+			else if (node.count & BVH_INTERIOR)
+			{
+				stack[top++] = node.first + 1;
+				stack[top++] = node.first;
+			}
+			else
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (frustum.intersects(this->itemBounds[this->items[i]]))
+						out.push_back(this->items[i]);
+				}
+			}
+		}
+	}
+
+	//Items whose boxes overlap box
+	void queryOverlap(const AABB& box, std::vector<uint32_t>& out) const
+	{
+		if (this->nodes.empty())
+			return;
+		uint32_t stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = this->nodes[stack[--top]];
+			if (!overlaps(node, box))
+				continue;
+			if (node.count & BVH_INTERIOR)
+			{
+				stack[top++] = node.first + 1;
+				stack[top++] = node.first;
+				continue;
+			}
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const AABB& item = this->itemBounds[this->items[i]];
+				if (item.min.x <= box.max.x && item.max.x >= box.min.x && item.min.y <= box.max.y && item.max.y >= box.min.y &&
+					item.min.z <= box.max.z && item.max.z >= box.min.z)
+					out.push_back(this->items[i]);
+			}
+		}
+	}
+
+	//Closest hit along the ray. hit(item, enterDistance) tests the item itself and returns its hit distance, or FLT_MAX
+	//for a miss; nodes further than the closest hit so far are skipped. Returns the closest distance, FLT_MAX if none.
+	template <typename Fn>
+	float raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Fn hit) const
+	{
+		if (this->nodes.empty())
+			return FLT_MAX;
+		__m128 o = _mm_setr_ps(origin.x, origin.y, origin.z, 0.f);
+		__m128 inverse = _mm_setr_ps(1.f / direction.x, 1.f / direction.y, 1.f / direction.z, 0.f);
+		float closest = maxDistance;
+		float found = FLT_MAX;
+
+		uint32_t stack[STACK_SIZE];
+		int top = 0;
+		if (intersectRay(this->nodes[0], o, inverse, closest) != FLT_MAX)
+			stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = this->nodes[stack[--top]];
+			if (node.count & BVH_INTERIOR)
+			{
+				//Nearer child on top so it is visited first and shortens the ray for the other
+				float leftDistance = intersectRay(this->nodes[node.first], o, inverse, closest);
+				float rightDistance = intersectRay(this->nodes[node.first + 1], o, inverse, closest);
+				uint32_t nearChild = leftDistance <= rightDistance ? node.first : node.first + 1;
+				float farDistance = std::max(leftDistance, rightDistance);
+				if (farDistance != FLT_MAX)
+					stack[top++] = nearChild == node.first ? node.first + 1 : node.first;
+				if (std::min(leftDistance, rightDistance) != FLT_MAX)
+					stack[top++] = nearChild;
+				continue;
+			}
+			if (intersectRay(node, o, inverse, closest) == FLT_MAX)
+				continue;
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const AABB& item = this->itemBounds[this->items[i]];
+				BvhNode itemNode = { item.min, 0, item.max, 0 };
+				float enter = intersectRay(itemNode, o, inverse, closest);
+				if (enter == FLT_MAX)
+					continue;
+				float distance = hit(this->items[i], enter);
+				if (distance <= closest)
+				{
+					closest = distance;
+					found = distance;
+				}
+			}
+		}
+		return found;
+	}
+
+	//Items whose boxes the ray crosses within maxDistance, in no particular order
+	void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, std::vector<uint32_t>& out) const
+	{
+		this->raycast(origin, direction, maxDistance, [&out](uint32_t item, float)
+		{
+			out.push_back(item);
+			return FLT_MAX;
+		});
+	}
+
+	inline bool isEmpty() const { return this->nodes.empty(); }
+	inline size_t getNodeCount() const { return this->nodes.size(); }
+	inline size_t getItemCount() const { return this->items.size(); }
+	inline const std::vector<BvhNode>& getNodes() const { return this->nodes; }
+	//Item ids in leaf order: a leaf's items are getItems()[first] to getItems()[first + count - 1]
+	inline const std::vector<uint32_t>& getItems() const { return this->items; }
+	inline uint32_t getBuildCount() const { return this->buildCount; }
+};
@@ -178,6 +178,14 @@ public:
             Zoom = 1.0f;
         if (Zoom > 45.0f)
             Zoom = 45.0f;
+        // the projection follows the zoom, so draws and getPixelsPerUnit see the same field of view
+        Projection = glm::perspective(glm::radians(Zoom), (float)width / (float)height, 0.1f, 100.0f);
+    }
+
+    // pixels one world unit covers at distance 1, from the vertical scale of the projection
+    float getPixelsPerUnit()
+    {
+        return Projection[1][1] * height * 0.5f;
     }
 
     unsigned int getWidth()
@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+//Computed exactly as in shader.vs, so the GL_EQUAL pass after this one matches every depth
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 4) in uint aInstance;
+
+struct Instance
+{
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+
+uniform mat4 view;
+uniform mat4 projection;
+
+//Computed exactly as in shaderIndirect.vs, so the GL_EQUAL pass after this one matches every depth
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = instances[aInstance].model;
+    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <xmmintrin.h>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Shader.h"
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Small moving meshes transformed on the CPU into one streaming buffer, one draw per material //////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//For meshes so small that a draw call costs more than moving their vertices: each frame they are transformed
+//into world space on worker threads and drawn with an identity model matrix. Anything above maxMeshVertices is
+//better off drawn on its own. Material uniforms still change per draw, so it is one draw per material.
+//Batched meshes draw the LOD they are added with, without meshlet culling.
+class DynamicBatcher
+{
+private:
+	struct Item
+	{
+		const Mesh* mesh;
+		const std::vector<GLuint>* indices;
+		glm::mat4 model;
+		Material* material;
+		size_t firstVertex;
+		size_t firstIndex;
+	};
+
+	//Consecutive items of one material, drawn with one call
+	struct Run
+	{
+		Material* material;
+		size_t firstIndex;
+		size_t indexCount;
+	};
+
+	unsigned maxMeshVertices;
+	std::vector<Item> items;
+	std::vector<Run> runs;
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	//Index lists of each LOD, copied out of a mesh the first time it is batched and again whenever
+	//its index revision changes (generateLods, buildMeshlets, or a new mesh at the same address)
+	struct CachedIndices
+	{
+		uint64_t revision;
+		std::vector<std::vector<GLuint>> levels;
+	};
+	std::unordered_map<const Mesh*, CachedIndices> lodIndices;
+	size_t vertexCount;
+
+	GLuint VAO;
+	GLuint VBO;
+	GLuint EBO;
+
+	static const size_t ITEMS_PER_WORKER = 64;
+
+	//Four vertices at a time: loads at the position and at the normal each pick up three floats of the attribute and one
+	//of the next, and transposing gives x, y, z across the four vertices
+	static void transform(const Vertex* in, Vertex* out, size_t count, const glm::mat4& model)
+	{
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+		__m128 m[4][3], n[3][3];
+		for (int c = 0; c < 4; c++)
+			for (int r = 0; r < 3; r++)
+				m[c][r] = _mm_set1_ps(model[c][r]);
+		for (int c = 0; c < 3; c++)
+			for (int r = 0; r < 3; r++)
+				n[c][r] = _mm_set1_ps(normalMatrix[c][r]);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 p0 = _mm_loadu_ps(&in[i].position.x), p1 = _mm_loadu_ps(&in[i + 1].position.x);
+			__m128 p2 = _mm_loadu_ps(&in[i + 2].position.x), p3 = _mm_loadu_ps(&in[i + 3].position.x);
+			_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+			__m128 n0 = _mm_loadu_ps(&in[i].normal.x), n1 = _mm_loadu_ps(&in[i + 1].normal.x);
+			__m128 n2 = _mm_loadu_ps(&in[i + 2].normal.x), n3 = _mm_loadu_ps(&in[i + 3].normal.x);
+			_MM_TRANSPOSE4_PS(n0, n1, n2, n3);
+
+			__m128 position[4], normal[4];
+			for (int r = 0; r < 3; r++)
+			{
+				position[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][r], p0), _mm_mul_ps(m[1][r], p1)), _mm_add_ps(_mm_mul_ps(m[2][r], p2), m[3][r]));
+				normal[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0][r], n0), _mm_mul_ps(n[1][r], n1)), _mm_mul_ps(n[2][r], n2));
+			}
+			position[3] = normal[3] = _mm_setzero_ps();
+			_MM_TRANSPOSE4_PS(position[0], position[1], position[2], position[3]);
+			_MM_TRANSPOSE4_PS(normal[0], normal[1], normal[2], normal[3]);
+
+			//Each store spills one float into the next attribute, which the following store or copy overwrites
+			for (int k = 0; k < 4; k++)
+			{
+				_mm_storeu_ps(&out[i + k].position.x, position[k]);
+				_mm_storeu_ps(&out[i + k].normal.x, normal[k]);
+				out[i + k].texcoord = in[i + k].texcoord;
+			}
+		}
+		for (; i < count; i++)
+		{
+			out[i].position = glm::vec3(model * glm::vec4(in[i].position, 1.f));
+			out[i].normal = normalMatrix * in[i].normal;
+			out[i].texcoord = in[i].texcoord;
+		}
+	}
+
+	const std::vector<GLuint>* cachedIndices(const Mesh& mesh, int lod)
+	{
+		CachedIndices& cached = this->lodIndices[&mesh];
+		if (cached.levels.empty() || cached.revision != mesh.getIndexRevision())
+		{
+			cached.revision = mesh.getIndexRevision();
+			cached.levels.resize(mesh.getLodCount());
+			for (int level = 0; level < mesh.getLodCount(); level++)
+				cached.levels[level] = mesh.getLodIndices(level);
+		}
+		return &cached.levels[std::min(std::max(lod, 0), (int)cached.levels.size() - 1)];
+	}
+
+	void initVAO()
+	{
+		glGenVertexArrays(1, &this->VAO);
+		glBindVertexArray(this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glGenBuffers(1, &this->EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		//Same layout as Mesh, so the same shaders draw it
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texcoord));
+		glEnableVertexAttribArray(2);
+		glBindVertexArray(0);
+	}
+
+public:
+	//300 vertices is about where transforming a mesh starts to cost more than the draw call it saves
+	explicit DynamicBatcher(unsigned maxMeshVertices = 300) : maxMeshVertices(maxMeshVertices), vertexCount(0), VAO(0), VBO(0), EBO(0) {}
+
+	~DynamicBatcher()
+	{
+		if (this->VAO != 0)
+		{
+			glDeleteVertexArrays(1, &this->VAO);
+			glDeleteBuffers(1, &this->VBO);
+			glDeleteBuffers(1, &this->EBO);
+		}
+	}
+
+	DynamicBatcher(const DynamicBatcher&) = delete;
+	DynamicBatcher& operator=(const DynamicBatcher&) = delete;
+
+	//Whether mesh should be batched rather than drawn on its own: small, indexed, and with its vertices on the CPU
+	inline bool accepts(const Mesh& mesh) const
+	{
+		return mesh.getVertices() && mesh.getIndexCount() > 0 && mesh.getVertexCount() <= this->maxMeshVertices;
+	}
+
+	inline void setMaxMeshVertices(unsigned maxMeshVertices) { this->maxMeshVertices = maxMeshVertices; }
+
+	//Starts a new frame's batch
+	void begin()
+	{
+		this->items.clear();
+		this->runs.clear();
+	}
+
+	void add(const Mesh& mesh, int lod, const glm::mat4& model, Material* material)
+	{
+		this->items.push_back({ &mesh, this->cachedIndices(mesh, lod), model, material, 0, 0 });
+	}
+
+	//Transforms everything added since begin on worker threads and streams it to the GPU
+	void upload()
+	{
+		std::sort(this->items.begin(), this->items.end(), [](const Item& a, const Item& b)
+		{
+			return a.material != b.material ? a.material < b.material : a.mesh < b.mesh;
+		});
+		size_t vertexCount = 0, indexCount = 0;
+		for (Item& item : this->items)
+		{
+			item.firstVertex = vertexCount;
+			item.firstIndex = indexCount;
+			if (this->runs.empty() || this->runs.back().material != item.material)
+				this->runs.push_back({ item.material, indexCount, 0 });
+			this->runs.back().indexCount += item.indices->size();
+			vertexCount += item.mesh->getVertexCount();
+			indexCount += item.indices->size();
+		}
+		this->vertexCount = vertexCount;
+		if (this->items.empty())
+			return;
+
+		this->vertices.resize(vertexCount);
+		this->indices.resize(indexCount);
+		Parallel::parallelFor(this->items.size(), ITEMS_PER_WORKER, [this](size_t, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const Item& item = this->items[i];
+				transform(item.mesh->getVertices(), &this->vertices[item.firstVertex], item.mesh->getVertexCount(), item.model);
+				GLuint base = (GLuint)item.firstVertex;
+				GLuint* out = &this->indices[item.firstIndex];
+				for (size_t k = 0; k < item.indices->size(); k++)
+					out[k] = base + (*item.indices)[k];
+			}
+		});
+
+		if (this->VAO == 0)
+			this->initVAO();
+		//Orphaned each frame, so the driver never waits on last frame's draws
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), this->vertices.data(), GL_STREAM_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), this->indices.data(), GL_STREAM_DRAW);
+		glBindVertexArray(0);
+	}
+
+	//One draw per material; the shader's model matrix is left at identity
+	void draw(Shader* shader)
+	{
+		if (this->runs.empty())
+			return;
+		shader->use();
+		shader->setMat4("model", glm::mat4(1.f));
+		glBindVertexArray(this->VAO);
+		for (const Run& run : this->runs)
+		{
+			run.material->sendToShader(*shader);
+			glDrawElements(GL_TRIANGLES, (GLsizei)run.indexCount, GL_UNSIGNED_INT, (GLvoid*)(run.firstIndex * sizeof(GLuint)));
+		}
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
+	//Everything in a single draw, for a depth only shader (Depth.vs)
+	void drawDepth(Shader* shader)
+	{
+		if (this->indices.empty() || this->runs.empty())
+			return;
+		shader->use();
+		shader->setMat4("model", glm::mat4(1.f));
+		glBindVertexArray(this->VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, (GLvoid*)0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
+	//Drops the cached indices of a mesh that is being destroyed, to give back their memory
+	void forget(const Mesh* mesh) { this->lodIndices.erase(mesh); }
+
+	inline size_t getItemCount() const { return this->items.size(); }
+	inline size_t getVertexCount() const { return this->vertexCount; }
+	//Draw calls the batch took this frame
+	inline size_t getDrawCount() const { return this->runs.size(); }
+};
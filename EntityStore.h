@@ -0,0 +1,848 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+
+#include <glm.hpp>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Shader.h"
+#include "Camera.h"
+#include "Bounds.h"
+#include "SceneGraph.h"
+#include "TextureStreamer.h"
+#include "Parallel.h"
+#include "Bvh.h"
+#include "SpatialHash.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQueries.h"
+#include "HiZCuller.h"
+#include "OverdrawCounter.h"
+#include "StaticBatcher.h"
+#include "DynamicBatcher.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Entities stored by archetype: one densely packed array per component, systems run over them in chunks ///
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef uint32_t ComponentMask;
+
+enum ComponentType
+{
+	COMPONENT_TRANSFORM = 1 << 0,
+	COMPONENT_MESH = 1 << 1,
+	COMPONENT_MATERIAL = 1 << 2,
+	COMPONENT_BOUNDS = 1 << 3,
+	COMPONENT_VISIBILITY = 1 << 4,
+	//Tag without data: the entity moves most frames, so it is culled through the spatial hash instead of the BVH
+	COMPONENT_DYNAMIC = 1 << 5,
+	//Tag: the entity's mesh is drawn into the occlusion culler's depth buffer. Best for large, simple meshes.
+	COMPONENT_OCCLUDER = 1 << 6,
+	//What the culling, LOD and render systems need
+	COMPONENT_RENDERABLE = COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_MATERIAL | COMPONENT_BOUNDS | COMPONENT_VISIBILITY
+};
+
+//World transform, taken from a scene graph node when the entity has one
+struct TransformComponent
+{
+	enum { MASK = COMPONENT_TRANSFORM };
+	SceneNode node = SCENE_ROOT;
+	glm::mat4 model = glm::mat4(1.f);
+};
+
+//Meshes and materials are shared resources; many entities can point at the same one
+struct MeshRefComponent
+{
+	enum { MASK = COMPONENT_MESH };
+	Mesh* mesh = nullptr;
+	int lod = 0;
+};
+
+struct MaterialRefComponent
+{
+	enum { MASK = COMPONENT_MATERIAL };
+	Material* material = nullptr;
+};
+
+struct BoundsComponent
+{
+	enum { MASK = COMPONENT_BOUNDS };
+	AABB world;
+};
+
+struct VisibilityComponent
+{
+	enum { MASK = COMPONENT_VISIBILITY };
+	bool visible = true;
+	//From the camera to the world bounds, 0 when inside them
+	float distance = 0.f;
+};
+
+//Handle to an entity; stale once the entity is destroyed, even if its index is reused
+struct Entity
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+//Every entity with exactly the same components. Row i of each present column belongs to entities[i].
+struct EntityArchetype
+{
+	ComponentMask mask;
+	std::vector<uint32_t> entities;
+	std::vector<TransformComponent> transforms;
+	std::vector<MeshRefComponent> meshes;
+	std::vector<MaterialRefComponent> materials;
+	std::vector<BoundsComponent> bounds;
+	std::vector<VisibilityComponent> visibility;
+
+	inline size_t size() const { return this->entities.size(); }
+
+	template <typename T>
+	std::vector<T>& column();
+
+	//Calls fn on every column this archetype has
+	template <typename Fn>
+	void eachColumn(Fn fn)
+	{
+		if (this->mask & COMPONENT_TRANSFORM) fn(this->transforms);
+		if (this->mask & COMPONENT_MESH) fn(this->meshes);
+		if (this->mask & COMPONENT_MATERIAL) fn(this->materials);
+		if (this->mask & COMPONENT_BOUNDS) fn(this->bounds);
+		if (this->mask & COMPONENT_VISIBILITY) fn(this->visibility);
+	}
+};
+
+template <> inline std::vector<TransformComponent>& EntityArchetype::column<TransformComponent>() { return this->transforms; }
+template <> inline std::vector<MeshRefComponent>& EntityArchetype::column<MeshRefComponent>() { return this->meshes; }
+template <> inline std::vector<MaterialRefComponent>& EntityArchetype::column<MaterialRefComponent>() { return this->materials; }
+template <> inline std::vector<BoundsComponent>& EntityArchetype::column<BoundsComponent>() { return this->bounds; }
+template <> inline std::vector<VisibilityComponent>& EntityArchetype::column<VisibilityComponent>() { return this->visibility; }
+
+class EntityStore
+{
+private:
+	//Where each entity index lives; archetype is -1 while the index is free
+	struct Record
+	{
+		int archetype;
+		uint32_t row;
+		uint32_t generation;
+	};
+
+	//One draw gathered by render, sorted so material and mesh changes are as rare as possible,
+	//or by distance band first when there is no depth pre-pass
+	struct DrawItem
+	{
+		Material* material;
+		Mesh* mesh;
+		int lod;
+		const glm::mat4* model;
+		const AABB* bounds;
+		float distance;
+		int band;
+		bool dynamic;
+	};
+
+	//Consecutive instances of one material, mesh and LOD, drawn with a single indirect multi draw
+	struct IndirectRun
+	{
+		Material* material;
+		Mesh* mesh;
+		size_t first;
+		size_t count;
+	};
+
+	std::vector<EntityArchetype> archetypes;
+	std::vector<Record> records;
+	std::vector<uint32_t> freeIndices;
+	size_t liveCount;
+	std::vector<std::vector<DrawItem>> workerDraws;
+	std::vector<DrawItem> draws;
+	std::vector<HiZInstance> indirectInstances;
+	std::vector<DrawElementsIndirectCommand> indirectCommands;
+	std::vector<IndirectRun> indirectRuns;
+	OverdrawCounter overdraw;
+	DynamicBatcher* dynamicBatcher;
+
+	//World bounds by entity index, kept in a BVH once there are enough entities for culling them one by one to cost.
+	//Dynamic entities go in the spatial hash instead, where moving is cheap; their BVH entries stay empty.
+	Bvh hierarchy;
+	SpatialHash dynamicGrid;
+	std::vector<AABB> hierarchyBounds;
+	bool hierarchyActive;
+	//Set when entities are created, destroyed or change archetype, which needs a rebuild rather than a refit
+	bool structureChanged;
+	//Entities cull marked visible last time, so only they need clearing when nothing moved between archetypes
+	std::vector<uint32_t> visibleIds;
+	bool visibilityStale;
+
+	//Rows per worker below which a system isn't worth splitting further
+	static const size_t CHUNK = 1024;
+	static const size_t HIERARCHY_MIN_ENTITIES = 4096;
+
+	int findArchetype(ComponentMask mask)
+	{
+		for (size_t i = 0; i < this->archetypes.size(); i++)
+		{
+			if (this->archetypes[i].mask == mask)
+				return (int)i;
+		}
+		this->archetypes.emplace_back();
+		this->archetypes.back().mask = mask;
+		return (int)this->archetypes.size() - 1;
+	}
+
+	//Swaps the last row into row and fixes the record of the entity that moved
+	void removeRow(int archetype, uint32_t row)
+	{
+		EntityArchetype& arch = this->archetypes[archetype];
+		uint32_t last = (uint32_t)arch.size() - 1;
+		if (row != last)
+		{
+			arch.entities[row] = arch.entities[last];
+			this->records[arch.entities[row]].row = row;
+		}
+		arch.entities.pop_back();
+		arch.eachColumn([row, last](auto& column)
+		{
+			if (row != last)
+				column[row] = column[last];
+			column.pop_back();
+		});
+	}
+
+	//Moves an entity into the archetype for mask, keeping the components both have
+	void moveTo(Entity entity, ComponentMask mask)
+	{
+		Record& record = this->records[entity.index];
+		int target = this->findArchetype(mask);
+		if (target == record.archetype)
+			return;
+
+		EntityArchetype& to = this->archetypes[target];
+		EntityArchetype& from = this->archetypes[record.archetype];
+		uint32_t row = (uint32_t)to.size();
+		to.entities.push_back(entity.index);
+		to.eachColumn([](auto& column) { column.emplace_back(); });
+		copyShared<TransformComponent>(from, record.row, to, row);
+		copyShared<MeshRefComponent>(from, record.row, to, row);
+		copyShared<MaterialRefComponent>(from, record.row, to, row);
+		copyShared<BoundsComponent>(from, record.row, to, row);
+		copyShared<VisibilityComponent>(from, record.row, to, row);
+
+		this->removeRow(record.archetype, record.row);
+		record.archetype = target;
+		record.row = row;
+		this->structureChanged = true;
+	}
+
+	template <typename T>
+	static void copyShared(EntityArchetype& from, uint32_t fromRow, EntityArchetype& to, uint32_t toRow)
+	{
+		if ((from.mask & T::MASK) && (to.mask & T::MASK))
+			to.column<T>()[toRow] = from.column<T>()[fromRow];
+	}
+
+	//Collects the visible renderable entities into draws on worker threads, with dynamicOnly just the ones outside the BVH,
+	//and sorts them by material then mesh
+	//Bands a quarter octave of distance wide: near to far overall, with state sorting inside each
+	static int distanceBand(float distance)
+	{
+		return distance > 0.f ? (int)(std::log2(1.f + distance) * 4.f) : 0;
+	}
+
+	void gatherDraws(bool dynamicOnly, bool visibleOnly, bool frontToBack)
+	{
+		this->draws.clear();
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & COMPONENT_RENDERABLE) != COMPONENT_RENDERABLE || arch.size() == 0 || (dynamicOnly && !(arch.mask & COMPONENT_DYNAMIC)))
+				continue;
+			size_t workers = Parallel::workerCount(arch.size(), CHUNK);
+			if (this->workerDraws.size() < workers)
+				this->workerDraws.resize(workers);
+			bool dynamic = (arch.mask & COMPONENT_DYNAMIC) != 0;
+			Parallel::parallelFor(arch.size(), CHUNK, [this, &arch, visibleOnly, dynamic](size_t worker, size_t begin, size_t end)
+			{
+				std::vector<DrawItem>& out = this->workerDraws[worker];
+				out.clear();
+				for (size_t i = begin; i < end; i++)
+				{
+					if ((arch.visibility[i].visible || !visibleOnly) && arch.meshes[i].mesh && arch.materials[i].material)
+					{
+						float distance = arch.visibility[i].distance;
+						out.push_back({ arch.materials[i].material, arch.meshes[i].mesh, arch.meshes[i].lod, &arch.transforms[i].model, &arch.bounds[i].world, distance, distanceBand(distance), dynamic });
+					}
+				}
+			});
+			for (size_t w = 0; w < workers; w++)
+				this->draws.insert(this->draws.end(), this->workerDraws[w].begin(), this->workerDraws[w].end());
+		}
+
+		std::sort(this->draws.begin(), this->draws.end(), [frontToBack](const DrawItem& a, const DrawItem& b)
+		{
+			if (frontToBack && a.band != b.band)
+				return a.band < b.band;
+			if (a.material != b.material)
+				return a.material < b.material;
+			if (a.mesh != b.mesh)
+				return a.mesh < b.mesh;
+			return a.lod != b.lod ? a.lod < b.lod : a.distance < b.distance;
+		});
+	}
+
+	//With a depth shader the gathered draws lay down depth first and are then shaded with GL_EQUAL,
+	//so every pixel runs the full fragment shader once. Small dynamic meshes go to the dynamic batcher, if
+	//there is one, and are drawn after the rest.
+	void drawGathered(Shader* shader, Camera* camera, Shader* depthShader)
+	{
+		DynamicBatcher* batcher = this->dynamicBatcher;
+		if (batcher)
+		{
+			batcher->begin();
+			size_t kept = 0;
+			for (const DrawItem& item : this->draws)
+			{
+				if (item.dynamic && batcher->accepts(*item.mesh))
+					batcher->add(*item.mesh, item.lod, *item.model, item.material);
+				else
+					this->draws[kept++] = item;
+			}
+			this->draws.resize(kept);
+			batcher->upload();
+		}
+
+		if (depthShader)
+		{
+			this->overdraw.begin(OVERDRAW_DEPTH);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			for (const DrawItem& item : this->draws)
+				item.mesh->drawDepth(depthShader, *item.model, item.lod, camera);
+			if (batcher)
+				batcher->drawDepth(depthShader);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			this->overdraw.end();
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+
+		this->overdraw.begin(OVERDRAW_SHADE);
+		const Material* bound = nullptr;
+		for (const DrawItem& item : this->draws)
+		{
+			if (item.material != bound)
+			{
+				item.material->sendToShader(*shader);
+				bound = item.material;
+			}
+			item.mesh->draw(shader, *item.model, item.lod, camera);
+		}
+		if (batcher)
+			batcher->draw(shader);
+		this->overdraw.end();
+
+		if (depthShader)
+		{
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+	}
+
+	static float maxScale(const glm::mat4& model)
+	{
+		float scale = std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])), glm::dot(glm::vec3(model[1]), glm::vec3(model[1])));
+		return std::sqrt(std::max(scale, glm::dot(glm::vec3(model[2]), glm::vec3(model[2]))));
+	}
+
+public:
+	EntityStore() : liveCount(0), dynamicBatcher(nullptr), hierarchyActive(false), structureChanged(true), visibilityStale(true) {}
+
+	EntityStore(const EntityStore&) = delete;
+	EntityStore& operator=(const EntityStore&) = delete;
+
+	//New entity with default constructed components for every bit in mask
+	Entity create(ComponentMask mask)
+	{
+		uint32_t index;
+		if (!this->freeIndices.empty())
+		{
+			index = this->freeIndices.back();
+			this->freeIndices.pop_back();
+		}
+		else
+		{
+			index = (uint32_t)this->records.size();
+			this->records.push_back({ -1, 0, 0 });
+		}
+
+		int archetype = this->findArchetype(mask);
+		EntityArchetype& arch = this->archetypes[archetype];
+		Record& record = this->records[index];
+		record.archetype = archetype;
+		record.row = (uint32_t)arch.size();
+		arch.entities.push_back(index);
+		arch.eachColumn([](auto& column) { column.emplace_back(); });
+		this->liveCount++;
+		this->structureChanged = true;
+		return { index, record.generation };
+	}
+
+	void destroy(Entity entity)
+	{
+		if (!this->isAlive(entity))
+			return;
+		Record& record = this->records[entity.index];
+		this->removeRow(record.archetype, record.row);
+		record.archetype = -1;
+		record.generation++;
+		this->freeIndices.push_back(entity.index);
+		this->liveCount--;
+		this->structureChanged = true;
+	}
+
+	inline bool isAlive(Entity entity) const
+	{
+		return entity.index < this->records.size() && this->records[entity.index].archetype >= 0 && this->records[entity.index].generation == entity.generation;
+	}
+
+	ComponentMask getMask(Entity entity) const
+	{
+		return this->isAlive(entity) ? this->archetypes[this->records[entity.index].archetype].mask : 0;
+	}
+
+	//Adding or removing components moves the entity to another archetype, which invalidates pointers from get
+	void addComponents(Entity entity, ComponentMask mask)
+	{
+		if (this->isAlive(entity))
+			this->moveTo(entity, this->getMask(entity) | mask);
+	}
+
+	void removeComponents(Entity entity, ComponentMask mask)
+	{
+		if (this->isAlive(entity))
+			this->moveTo(entity, this->getMask(entity) & ~mask);
+	}
+
+	//Component of an entity, or nullptr if it is dead or doesn't have one
+	template <typename T>
+	T* get(Entity entity)
+	{
+		if (!this->isAlive(entity))
+			return nullptr;
+		const Record& record = this->records[entity.index];
+		EntityArchetype& arch = this->archetypes[record.archetype];
+		return (arch.mask & T::MASK) ? &arch.column<T>()[record.row] : nullptr;
+	}
+
+	//Calls fn(archetype, begin, end) over the rows of every archetype with all the components in mask,
+	//split into chunks run on worker threads. fn may only write the rows it is given.
+	template <typename Fn>
+	void forEach(ComponentMask mask, Fn fn, size_t minPerWorker = CHUNK)
+	{
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & mask) != mask || arch.size() == 0)
+				continue;
+			Parallel::parallelFor(arch.size(), minPerWorker, [&](size_t, size_t begin, size_t end)
+			{
+				fn(arch, begin, end);
+			});
+		}
+	}
+
+	inline size_t size() const { return this->liveCount; }
+	inline size_t getArchetypeCount() const { return this->archetypes.size(); }
+
+	//Merges the static renderable entities batcher accepts into its chunk meshes (see StaticBatcher.h) and creates a
+	//static entity for each batch; the merged entities keep only their transform. Call once after loading, with
+	//transforms synced: geometry is frozen where it was, and rebuilding the batcher would free meshes still in use.
+	//Returns how many entities were merged.
+	size_t batchStatic(StaticBatcher& batcher)
+	{
+		std::vector<StaticSource> sources;
+		std::vector<Entity> merged;
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & COMPONENT_RENDERABLE) != COMPONENT_RENDERABLE || (arch.mask & COMPONENT_DYNAMIC))
+				continue;
+			for (size_t i = 0; i < arch.size(); i++)
+			{
+				Mesh* mesh = arch.meshes[i].mesh;
+				Material* material = arch.materials[i].material;
+				if (!mesh || !material || !batcher.accepts(*mesh))
+					continue;
+				const glm::mat4& model = arch.transforms[i].model;
+				sources.push_back({ mesh, material, model, mesh->getLocalBounds().transformed(model), (arch.mask & COMPONENT_OCCLUDER) != 0 });
+				merged.push_back({ arch.entities[i], this->records[arch.entities[i]].generation });
+			}
+		}
+		if (sources.empty())
+			return 0;
+
+		for (const StaticBatch& batch : batcher.build(sources))
+		{
+			Entity entity = this->create(COMPONENT_RENDERABLE | (batch.occluder ? COMPONENT_OCCLUDER : 0));
+			this->get<MeshRefComponent>(entity)->mesh = batch.mesh;
+			this->get<MaterialRefComponent>(entity)->material = batch.material;
+		}
+		for (Entity entity : merged)
+			this->moveTo(entity, COMPONENT_TRANSFORM);
+		return merged.size();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//Systems, in the order a frame runs them
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	//Copies world matrices of entities attached to scene nodes; call after SceneGraph::update
+	void syncTransforms(const SceneGraph& graph)
+	{
+		this->forEach(COMPONENT_TRANSFORM, [&graph](EntityArchetype& arch, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				TransformComponent& transform = arch.transforms[i];
+				if (transform.node != SCENE_ROOT)
+					transform.model = graph.getWorldMatrix(transform.node);
+			}
+		});
+	}
+
+	void updateBounds()
+	{
+		this->forEach(COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_BOUNDS, [](EntityArchetype& arch, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const Mesh* mesh = arch.meshes[i].mesh;
+				arch.bounds[i].world = mesh ? mesh->getLocalBounds().transformed(arch.transforms[i].model) : AABB();
+			}
+		});
+
+		this->hierarchyActive = this->liveCount >= HIERARCHY_MIN_ENTITIES;
+		if (this->hierarchyActive)
+			this->updateHierarchy();
+	}
+
+	//Refits the BVH to the bounds from updateBounds, or rebuilds it when entities changed or refitting has degraded it.
+	//Dynamic entities are only relinked in the grid when they cross into another cell.
+	void updateHierarchy()
+	{
+		bool rebuild = this->structureChanged || this->hierarchy.isEmpty();
+		if (rebuild)
+		{
+			this->hierarchyBounds.assign(this->records.size(), AABB());
+			this->dynamicGrid.clear();
+		}
+		std::vector<AABB>& bounds = this->hierarchyBounds;
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & (COMPONENT_BOUNDS | COMPONENT_VISIBILITY)) != (COMPONENT_BOUNDS | COMPONENT_VISIBILITY))
+				continue;
+			if (arch.mask & COMPONENT_DYNAMIC)
+			{
+				for (size_t i = 0; i < arch.size(); i++)
+				{
+					if (!arch.bounds[i].world.isEmpty())
+						this->dynamicGrid.move(arch.entities[i], arch.bounds[i].world);
+					else
+						this->dynamicGrid.remove(arch.entities[i]);
+				}
+				continue;
+			}
+			Parallel::parallelFor(arch.size(), CHUNK, [&bounds, &arch](size_t, size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					bounds[arch.entities[i]] = arch.bounds[i].world;
+			});
+		}
+
+		if (!rebuild)
+		{
+			this->hierarchy.refit(bounds.data());
+			rebuild = this->hierarchy.needsRebuild();
+		}
+		if (rebuild)
+		{
+			this->hierarchy.build(bounds.data(), bounds.size());
+			this->structureChanged = false;
+			this->visibilityStale = true;
+		}
+	}
+
+	void cull(Camera& camera)
+	{
+		Frustum frustum(camera.Projection * camera.GetViewMatrix());
+		glm::vec3 eye = camera.Position;
+		if (this->hierarchyActive && !this->structureChanged)
+		{
+			this->cullHierarchy(frustum, eye);
+			return;
+		}
+		this->visibilityStale = true;
+		this->forEach(COMPONENT_BOUNDS | COMPONENT_VISIBILITY, [&frustum, eye](EntityArchetype& arch, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const AABB& world = arch.bounds[i].world;
+				VisibilityComponent& visibility = arch.visibility[i];
+				visibility.visible = !world.isEmpty() && frustum.intersects(world);
+				visibility.distance = world.isEmpty() ? 0.f : world.distanceTo(eye);
+			}
+		});
+	}
+
+	//Only touches the entities the BVH finds in the frustum and the ones that were visible last time
+	void cullHierarchy(const Frustum& frustum, const glm::vec3& eye)
+	{
+		if (this->visibilityStale)
+		{
+			this->forEach(COMPONENT_VISIBILITY, [](EntityArchetype& arch, size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					arch.visibility[i].visible = false;
+			});
+			this->visibilityStale = false;
+		}
+		else
+		{
+			//No entity has changed archetype since, so the records still point at their rows
+			for (uint32_t id : this->visibleIds)
+				this->archetypes[this->records[id].archetype].visibility[this->records[id].row].visible = false;
+		}
+
+		this->visibleIds.clear();
+		this->hierarchy.cull(frustum, this->visibleIds);
+		this->dynamicGrid.cull(frustum, this->visibleIds);
+		Parallel::parallelFor(this->visibleIds.size(), CHUNK, [this, eye](size_t, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const Record& record = this->records[this->visibleIds[i]];
+				EntityArchetype& arch = this->archetypes[record.archetype];
+				arch.visibility[record.row].visible = true;
+				arch.visibility[record.row].distance = arch.bounds[record.row].world.distanceTo(eye);
+			}
+		});
+	}
+
+	//Hides the visible entities that the visible occluders cover; run after cull. Returns how many were hidden.
+	size_t cullOccluded(Camera& camera, OcclusionCuller& culler)
+	{
+		culler.begin(camera.Projection * camera.GetViewMatrix());
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & (COMPONENT_OCCLUDER | COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_VISIBILITY)) != (COMPONENT_OCCLUDER | COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_VISIBILITY))
+				continue;
+			for (size_t i = 0; i < arch.size(); i++)
+			{
+				if (arch.visibility[i].visible && arch.meshes[i].mesh)
+					culler.addOccluder(*arch.meshes[i].mesh, arch.transforms[i].model);
+			}
+		}
+		if (culler.getOccluderCount() == 0)
+			return 0;
+		culler.render();
+
+		std::atomic<size_t> hidden(0);
+		this->forEach(COMPONENT_BOUNDS | COMPONENT_VISIBILITY, [&culler, &hidden](EntityArchetype& arch, size_t begin, size_t end)
+		{
+			size_t count = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				VisibilityComponent& visibility = arch.visibility[i];
+				if (visibility.visible && culler.isOccluded(arch.bounds[i].world))
+				{
+					visibility.visible = false;
+					count++;
+				}
+			}
+			hidden += count;
+		});
+		return hidden;
+	}
+
+	//Same rule as Mesh::updateLod, for the visible entities; uses the distances from cull
+	void selectLods(Camera& camera, float pixelError = 1.f)
+	{
+		float pixelsPerUnit = camera.getPixelsPerUnit();
+		this->forEach(COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_VISIBILITY, [pixelsPerUnit, pixelError](EntityArchetype& arch, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				MeshRefComponent& ref = arch.meshes[i];
+				const VisibilityComponent& visibility = arch.visibility[i];
+				if (!ref.mesh || !visibility.visible)
+					continue;
+				float scaled = visibility.distance > 0.f ? pixelsPerUnit * maxScale(arch.transforms[i].model) / visibility.distance : FLT_MAX;
+				ref.lod = ref.mesh->pickLod(ref.lod, scaled, pixelError);
+			}
+		});
+	}
+
+	//Asks for the texture levels every visible entity needs. Stays on this thread since the manager isn't thread safe.
+	void requestTextures(Camera& camera, TextureStreamer& streamer)
+	{
+		for (EntityArchetype& arch : this->archetypes)
+		{
+			if ((arch.mask & COMPONENT_RENDERABLE) != COMPONENT_RENDERABLE)
+				continue;
+			for (size_t i = 0; i < arch.size(); i++)
+			{
+				Mesh* mesh = arch.meshes[i].mesh;
+				Material* material = arch.materials[i].material;
+				if (!mesh || !material || !arch.visibility[i].visible)
+					continue;
+				//Shared meshes keep an identity transform, so their density is per object space unit
+				float scale = maxScale(arch.transforms[i].model);
+				float uvDensity = scale > 0.f ? mesh->getUVDensity() / scale : 0.f;
+				streamer.request(camera, arch.bounds[i].world, uvDensity, *material);
+			}
+		}
+	}
+
+	//Gathers the visible entities on worker threads, sorts them and draws them here. With a camera, meshes at full
+	//detail are meshlet culled per entity. With a depth shader (Depth.vs and Depth.fs) there is a depth pre-pass from
+	//position only streams and the entities are sorted by material then mesh; without one they go front to back.
+	void render(Shader* shader, Camera* camera = nullptr, Shader* depthShader = nullptr)
+	{
+		this->gatherDraws(false, true, depthShader == nullptr);
+		this->drawGathered(shader, camera, depthShader);
+		this->overdraw.endFrame();
+	}
+
+	//Like render, but entities in the BVH are drawn front to back through hardware occlusion queries on its nodes.
+	//Dynamic entities are drawn as render would without a pre-pass. Below the BVH threshold this is just render.
+	//Occlusion queries can't run inside the overdraw counter's, so only the dynamic entities are counted.
+	void renderQueried(Shader* shader, Shader* boxShader, Camera* camera, OcclusionQueries& queries)
+	{
+		if (!this->hierarchyActive || this->structureChanged || !camera)
+		{
+			this->render(shader, camera);
+			return;
+		}
+		this->gatherDraws(true, true, true);
+		this->drawGathered(shader, camera, nullptr);
+
+		const Material* bound = nullptr;
+		queries.render(this->hierarchy, boxShader, *camera, [&](const uint32_t* ids, size_t count)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				const Record& record = this->records[ids[i]];
+				EntityArchetype& arch = this->archetypes[record.archetype];
+				if ((arch.mask & COMPONENT_RENDERABLE) != COMPONENT_RENDERABLE || !arch.visibility[record.row].visible)
+					continue;
+				Mesh* mesh = arch.meshes[record.row].mesh;
+				Material* material = arch.materials[record.row].material;
+				if (!mesh || !material)
+					continue;
+				if (material != bound)
+				{
+					material->sendToShader(*shader);
+					bound = material;
+				}
+				mesh->draw(shader, arch.transforms[record.row].model, arch.meshes[record.row].lod, camera);
+			}
+		});
+		this->overdraw.endFrame();
+	}
+
+	//Draws every renderable entity through the GPU culler, ignoring the visibility from cull: the CPU only uploads
+	//transforms, bounds and each mesh's index range, and the Hi-Z passes decide what is drawn. Instances are sorted
+	//by material, mesh and LOD, and each run is one indirect multi draw. indirectShader reads the model matrix from the
+	//instance buffer (shaderIndirect.vs). With indirectDepthShader (DepthIndirect.vs) each phase gets a depth pre-pass;
+	//without one, instances of a run go front to back. Meshes without indices and meshes still streaming in are
+	//frustum culled and drawn with shader as render would.
+	void renderGpuCulled(Shader* shader, Shader* indirectShader, Camera& camera, HiZCuller& culler, Shader* indirectDepthShader = nullptr)
+	{
+		glm::mat4 viewProjection = camera.Projection * camera.GetViewMatrix();
+		Frustum frustum(viewProjection);
+		this->gatherDraws(false, false, false);
+		this->indirectInstances.clear();
+		this->indirectCommands.clear();
+		this->indirectRuns.clear();
+		std::vector<DrawItem> direct;
+		for (const DrawItem& item : this->draws)
+		{
+			if (item.mesh->getIndexCount() == 0 || !item.mesh->isUploaded())
+			{
+				if (!item.bounds->isEmpty() && frustum.intersects(*item.bounds))
+					direct.push_back(item);
+				continue;
+			}
+			const MeshLod& range = item.mesh->getLodRange(item.lod);
+			if (this->indirectRuns.empty() || this->indirectRuns.back().material != item.material || this->indirectRuns.back().mesh != item.mesh ||
+				this->indirectCommands.back().firstIndex != range.indexOffset)
+				this->indirectRuns.push_back({ item.material, item.mesh, this->indirectCommands.size(), 0 });
+			this->indirectRuns.back().count++;
+			this->indirectInstances.push_back({ *item.model, glm::vec4(item.bounds->min, 1.f), glm::vec4(item.bounds->max, 1.f) });
+			this->indirectCommands.push_back({ range.indexCount, 0, range.indexOffset, 0, 0 });
+		}
+
+		culler.upload(this->indirectInstances, this->indirectCommands);
+		for (const IndirectRun& run : this->indirectRuns)
+			run.mesh->setInstanceIds(culler.getInstanceIdBuffer());
+		culler.render(viewProjection, [&](size_t firstCommand)
+		{
+			if (indirectDepthShader)
+			{
+				this->overdraw.begin(OVERDRAW_DEPTH);
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				indirectDepthShader->use();
+				for (const IndirectRun& run : this->indirectRuns)
+				{
+					run.mesh->bindDepthVAO();
+					glMultiDrawElementsIndirect(GL_TRIANGLES, run.mesh->getIndexType(), (const void*)((firstCommand + run.first) * sizeof(DrawElementsIndirectCommand)), (GLsizei)run.count, 0);
+				}
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->overdraw.end();
+				glDepthFunc(GL_EQUAL);
+				glDepthMask(GL_FALSE);
+			}
+
+			this->overdraw.begin(OVERDRAW_SHADE);
+			indirectShader->use();
+			const Material* bound = nullptr;
+			for (const IndirectRun& run : this->indirectRuns)
+			{
+				if (run.material != bound)
+				{
+					run.material->sendToShader(*indirectShader);
+					bound = run.material;
+				}
+				run.mesh->bindVAO();
+				glMultiDrawElementsIndirect(GL_TRIANGLES, run.mesh->getIndexType(), (const void*)((firstCommand + run.first) * sizeof(DrawElementsIndirectCommand)), (GLsizei)run.count, 0);
+			}
+			this->overdraw.end();
+			glBindVertexArray(0);
+			glUseProgram(0);
+
+			if (indirectDepthShader)
+			{
+				glDepthFunc(GL_LESS);
+				glDepthMask(GL_TRUE);
+			}
+		});
+
+		this->draws.swap(direct);
+		this->drawGathered(shader, &camera, nullptr);
+		this->overdraw.endFrame();
+	}
+
+	//Small dynamic meshes that render and renderQueried draw through batcher instead of one by one (see
+	//DynamicBatcher.h), nullptr to stop. renderGpuCulled keeps drawing them as indirect instances.
+	inline void setDynamicBatcher(DynamicBatcher* batcher) { this->dynamicBatcher = batcher; }
+
+	//Fragment counts and GPU times of the depth and shading passes, from a frame or two ago
+	inline const OverdrawCounter& getOverdraw() const { return this->overdraw; }
+
+	//Draws gathered by the last render, less the ones the dynamic batcher took
+	inline size_t getDrawCount() const { return this->draws.size(); }
+};
@@ -0,0 +1,673 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Json.h"
+#include "MappedFile.h"
+#include "Bounds.h"
+#include "Shader.h"
+#include "Material.h"
+#include "TextureCache.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// glTF 2.0 / GLB loader: buffer views go to GL buffers as they are and accessors become VAO formats /////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct GltfPrimitive
+{
+	GLuint VAO;
+	GLenum mode;
+	GLsizei count;
+	//0 for non indexed primitives
+	GLenum indexType;
+	size_t indexOffset;
+	//Into GltfScene's materials, -1 to draw with the fallback material
+	int material;
+	//Attributes the file leaves out are drawn from a constant value set before each draw
+	bool hasNormals;
+	bool hasTexcoords;
+	AABB bounds;
+};
+
+struct GltfInstance
+{
+	int mesh;
+	glm::mat4 transform;
+};
+
+//Everything a glTF file draws. Owns its GL buffers and VAOs; textures are shared through the TextureCache.
+class GltfScene
+{
+private:
+	std::vector<GLuint> buffers;
+	std::vector<std::vector<GltfPrimitive>> meshes;
+	std::vector<GltfInstance> instances;
+	std::vector<Material> materials;
+	std::vector<std::shared_ptr<Texture>> textures;
+	glm::mat4 transform;
+
+	friend class GltfLoader;
+
+	void release()
+	{
+		for (auto& mesh : this->meshes)
+		{
+			for (GltfPrimitive& primitive : mesh)
+				glDeleteVertexArrays(1, &primitive.VAO);
+		}
+		if (!this->buffers.empty())
+			glDeleteBuffers((GLsizei)this->buffers.size(), this->buffers.data());
+		this->buffers.clear();
+		this->meshes.clear();
+		this->instances.clear();
+		this->materials.clear();
+		this->textures.clear();
+	}
+
+public:
+	GltfScene() : transform(1.f) {}
+	~GltfScene()
+	{
+		this->release();
+	}
+	GltfScene(const GltfScene&) = delete;
+	GltfScene& operator=(const GltfScene&) = delete;
+
+	//Placed under this transform as a whole
+	void setTransform(const glm::mat4& transform) { this->transform = transform; }
+
+	inline size_t getInstanceCount() const { return this->instances.size(); }
+	inline size_t getMaterialCount() const { return this->materials.size(); }
+
+	AABB getWorldBounds() const
+	{
+		AABB result;
+		for (const GltfInstance& instance : this->instances)
+		{
+			for (const GltfPrimitive& primitive : this->meshes[instance.mesh])
+				result.expand(primitive.bounds.transformed(this->transform * instance.transform));
+		}
+		return result;
+	}
+
+	//Draws every node; primitives without a textured material use fallback (skipped if it is null)
+	void render(Shader* shader, Material* fallback = nullptr)
+	{
+		shader->use();
+		//glTF texcoords start at the top left of the image, ours at the bottom left
+		shader->setBool("flipTexcoordY", true);
+		int boundMaterial = -2;
+		for (const GltfInstance& instance : this->instances)
+		{
+			shader->setMat4("model", this->transform * instance.transform);
+			for (const GltfPrimitive& primitive : this->meshes[instance.mesh])
+			{
+				Material* material = primitive.material >= 0 ? &this->materials[primitive.material] : fallback;
+				if (!material)
+					continue;
+				if (primitive.material != boundMaterial)
+				{
+					//Same convention as the rest of the program: each texture sits on the unit matching its id
+					for (int i = 0; i < Material::TEXTURE_COUNT; i++)
+					{
+						Texture* tex = material->getTexture(i);
+						if (tex)
+							tex->bind(tex->getID());
+					}
+					material->sendToShader(*shader);
+					boundMaterial = primitive.material;
+				}
+
+				//Constant attribute values are context state rather than VAO state, so other draws can change them
+				if (!primitive.hasNormals)
+					glVertexAttrib3f(1, 0.f, 0.f, 1.f);
+				if (!primitive.hasTexcoords)
+					glVertexAttrib2f(2, 0.f, 0.f);
+				glBindVertexArray(primitive.VAO);
+				if (primitive.indexType)
+					glDrawElements(primitive.mode, primitive.count, primitive.indexType, (GLvoid*)primitive.indexOffset);
+				else
+					glDrawArrays(primitive.mode, 0, primitive.count);
+			}
+		}
+		glBindVertexArray(0);
+		shader->setBool("flipTexcoordY", false);
+	}
+};
+
+class GltfLoader
+{
+private:
+	static const uint32_t GLB_MAGIC = 0x46546C67;
+	static const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+	static const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+	struct BufferData
+	{
+		const char* data;
+		size_t size;
+	};
+
+	//Accessor resolved to a bufferView and the byte offset into it
+	struct AccessorView
+	{
+		int view;
+		size_t offset;
+		GLint components;
+		GLenum componentType;
+		GLboolean normalized;
+		GLsizei stride;
+		size_t count;
+	};
+
+	//Everything that has to stay alive while GL buffers are created
+	struct Source
+	{
+		std::string fileName;
+		std::string directory;
+		JsonValue json;
+		std::vector<BufferData> buffers;
+		std::vector<std::unique_ptr<MappedFile>> files;
+		std::vector<std::vector<char>> decoded;
+		std::vector<GLuint> viewBuffers;
+	};
+
+	static int componentCount(const std::string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		if (type == "MAT2") return 4;
+		if (type == "MAT3") return 9;
+		if (type == "MAT4") return 16;
+		return 0;
+	}
+
+	static size_t componentSize(GLenum componentType)
+	{
+		switch (componentType)
+		{
+		case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+		case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+		case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+		}
+		return 0;
+	}
+
+	static std::string decodeUri(const std::string& uri)
+	{
+		std::string out;
+		for (size_t i = 0; i < uri.size(); i++)
+		{
+			if (uri[i] == '%' && i + 2 < uri.size())
+			{
+				out += (char)std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16);
+				i += 2;
+			}
+			else
+				out += uri[i];
+		}
+		return out;
+	}
+
+	static bool decodeBase64(const std::string& text, size_t start, std::vector<char>& out)
+	{
+		static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		out.clear();
+		out.reserve((text.size() - start) * 3 / 4);
+		uint32_t bits = 0;
+		int count = 0;
+		for (size_t i = start; i < text.size() && text[i] != '='; i++)
+		{
+			size_t value = alphabet.find(text[i]);
+			if (value == std::string::npos)
+				return false;
+			bits = (bits << 6) | (uint32_t)value;
+			count += 6;
+			if (count >= 8)
+			{
+				count -= 8;
+				out.push_back((char)((bits >> count) & 0xFF));
+			}
+		}
+		return true;
+	}
+
+	//Contents of a data: uri, or false if uri is a path
+	static bool dataUri(const std::string& uri, std::vector<char>& out)
+	{
+		if (uri.compare(0, 5, "data:") != 0)
+			return false;
+		size_t comma = uri.find(',');
+		return comma != std::string::npos && decodeBase64(uri, comma + 1, out);
+	}
+
+	static bool loadBuffers(Source& src, BufferData bin)
+	{
+		const JsonValue& buffers = src.json["buffers"];
+		src.buffers.resize(buffers.size(), { nullptr, 0 });
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			const JsonValue& buffer = buffers[i];
+			size_t length = buffer["byteLength"].asSize();
+			if (!buffer.has("uri"))
+			{
+				//Only the first buffer of a GLB may live in its BIN chunk
+				if (i != 0 || !bin.data)
+					return false;
+				src.buffers[i] = bin;
+			}
+			else
+			{
+				const std::string& uri = buffer["uri"].asString();
+				src.decoded.emplace_back();
+				if (dataUri(uri, src.decoded.back()))
+				{
+					src.buffers[i] = { src.decoded.back().data(), src.decoded.back().size() };
+				}
+				else
+				{
+					src.decoded.pop_back();
+					std::string path = src.directory + decodeUri(uri);
+					src.files.emplace_back(new MappedFile(path.c_str()));
+					if (!src.files.back()->isOpen())
+					{
+						std::cout << "glTF buffer failed to load at path: " << path << std::endl;
+						return false;
+					}
+					src.buffers[i] = { src.files.back()->getData(), src.files.back()->getSize() };
+				}
+			}
+			if (src.buffers[i].size < length)
+				return false;
+		}
+		return true;
+	}
+
+	//GL buffer holding a bufferView's bytes, created on first use straight from the file mapping
+	static GLuint viewBuffer(Source& src, GltfScene& scene, int view)
+	{
+		if (src.viewBuffers[view])
+			return src.viewBuffers[view];
+
+		const JsonValue& bufferView = src.json["bufferViews"][view];
+		size_t buffer = bufferView["buffer"].asSize(SIZE_MAX);
+		size_t offset = bufferView["byteOffset"].asSize();
+		size_t length = bufferView["byteLength"].asSize();
+		if (buffer >= src.buffers.size() || offset + length > src.buffers[buffer].size || length == 0)
+			return 0;
+
+		GLuint id;
+		glGenBuffers(1, &id);
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		glBufferStorage(GL_ARRAY_BUFFER, length, src.buffers[buffer].data + offset, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		src.viewBuffers[view] = id;
+		scene.buffers.push_back(id);
+		return id;
+	}
+
+	static bool resolveAccessor(const Source& src, int index, AccessorView& out)
+	{
+		const JsonValue& accessor = src.json["accessors"][index];
+		if (!accessor.isObject() || !accessor.has("bufferView") || accessor.has("sparse"))
+			return false;
+
+		out.view = accessor["bufferView"].asInt(-1);
+		const JsonValue& bufferView = src.json["bufferViews"][out.view];
+		if (!bufferView.isObject())
+			return false;
+		out.offset = accessor["byteOffset"].asSize();
+		out.components = componentCount(accessor["type"].asString());
+		out.componentType = (GLenum)accessor["componentType"].asInt();
+		out.normalized = accessor["normalized"].asBool() ? GL_TRUE : GL_FALSE;
+		out.stride = (GLsizei)bufferView["byteStride"].asInt(0);
+		out.count = accessor["count"].asSize();
+
+		size_t element = (size_t)out.components * componentSize(out.componentType);
+		size_t stride = out.stride ? (size_t)out.stride : element;
+		size_t length = bufferView["byteLength"].asSize();
+		return element > 0 && (out.count == 0 || out.offset + stride * (out.count - 1) + element <= length);
+	}
+
+	static glm::mat4 nodeMatrix(const JsonValue& node)
+	{
+		const JsonValue& matrix = node["matrix"];
+		if (matrix.size() == 16)
+		{
+			glm::mat4 m;
+			for (int c = 0; c < 4; c++)
+			{
+				for (int r = 0; r < 4; r++)
+					m[c][r] = matrix[c * 4 + r].asFloat();
+			}
+			return m;
+		}
+
+		const JsonValue& t = node["translation"];
+		const JsonValue& q = node["rotation"];
+		const JsonValue& s = node["scale"];
+		glm::vec3 translation = t.size() == 3 ? glm::vec3(t[0].asFloat(), t[1].asFloat(), t[2].asFloat()) : glm::vec3(0.f);
+		glm::vec3 scale = s.size() == 3 ? glm::vec3(s[0].asFloat(), s[1].asFloat(), s[2].asFloat()) : glm::vec3(1.f);
+		float x = 0.f, y = 0.f, z = 0.f, w = 1.f;
+		if (q.size() == 4)
+		{
+			x = q[0].asFloat(); y = q[1].asFloat(); z = q[2].asFloat(); w = q[3].asFloat();
+		}
+
+		//T * R * S with the rotation from a unit quaternion
+		glm::mat4 m(1.f);
+		m[0] = glm::vec4(1.f - 2.f * (y * y + z * z), 2.f * (x * y + z * w), 2.f * (x * z - y * w), 0.f) * scale.x;
+		m[1] = glm::vec4(2.f * (x * y - z * w), 1.f - 2.f * (x * x + z * z), 2.f * (y * z + x * w), 0.f) * scale.y;
+		m[2] = glm::vec4(2.f * (x * z + y * w), 2.f * (y * z - x * w), 1.f - 2.f * (x * x + y * y), 0.f) * scale.z;
+		m[3] = glm::vec4(translation, 1.f);
+		return m;
+	}
+
+	static void addNode(const Source& src, GltfScene& scene, int index, const glm::mat4& parent, int depth)
+	{
+		const JsonValue& node = src.json["nodes"][index];
+		if (!node.isObject() || depth > 64)
+			return;
+		glm::mat4 world = parent * nodeMatrix(node);
+		int mesh = node["mesh"].asInt(-1);
+		if (mesh >= 0 && mesh < (int)scene.meshes.size() && !scene.meshes[mesh].empty())
+			scene.instances.push_back({ mesh, world });
+		const JsonValue& children = node["children"];
+		for (size_t i = 0; i < children.size(); i++)
+			addNode(src, scene, children[i].asInt(-1), world, depth + 1);
+	}
+
+	//Image file for a glTF image. Embedded images are written next to the model once, so they
+	//go through the same cooking and streaming as every other texture.
+	static std::string imagePath(const Source& src, int index)
+	{
+		const JsonValue& image = src.json["images"][index];
+		std::vector<char> bytes;
+		if (image.has("uri"))
+		{
+			const std::string& uri = image["uri"].asString();
+			if (!dataUri(uri, bytes))
+				return src.directory + decodeUri(uri);
+		}
+		else if (image.has("bufferView"))
+		{
+			const JsonValue& view = src.json["bufferViews"][image["bufferView"].asInt()];
+			size_t buffer = view["buffer"].asSize(SIZE_MAX);
+			size_t offset = view["byteOffset"].asSize();
+			size_t length = view["byteLength"].asSize();
+			if (buffer >= src.buffers.size() || offset + length > src.buffers[buffer].size)
+				return std::string();
+			bytes.assign(src.buffers[buffer].data + offset, src.buffers[buffer].data + offset + length);
+		}
+		if (bytes.empty())
+			return std::string();
+
+		bool jpeg = image["mimeType"].asString() == "image/jpeg";
+		std::string path = src.fileName + ".image" + std::to_string(index) + (jpeg ? ".jpg" : ".png");
+		//Rewritten whenever its contents differ, so an edited model doesn't keep its old image
+		std::ifstream existing(path, std::ios::binary | std::ios::ate);
+		bool same = existing && (size_t)existing.tellg() == bytes.size();
+		if (same)
+		{
+			std::vector<char> current(bytes.size());
+			existing.seekg(0);
+			same = existing.read(current.data(), current.size()) && current == bytes;
+		}
+		if (!same)
+		{
+			existing.close();
+			std::ofstream out(path, std::ios::binary);
+			out.write(bytes.data(), bytes.size());
+		}
+		return path;
+	}
+
+	static std::shared_ptr<Texture> loadTexture(const Source& src, int index, TextureCache* cache, int maxInitialSize)
+	{
+		int image = src.json["textures"][index]["source"].asInt(-1);
+		if (image < 0)
+			return nullptr;
+		std::string path = imagePath(src, image);
+		if (path.empty())
+			return nullptr;
+		if (cache)
+			return cache->load(path.c_str(), GL_TEXTURE_2D, maxInitialSize);
+		return std::make_shared<Texture>(path.c_str(), GL_TEXTURE_2D, maxInitialSize);
+	}
+
+	static void loadMaterials(const Source& src, GltfScene& scene, std::vector<int>& materialIndex, TextureCache* cache, int maxInitialSize)
+	{
+		const JsonValue& materials = src.json["materials"];
+		std::vector<std::shared_ptr<Texture>> loaded(src.json["textures"].size());
+		materialIndex.assign(materials.size(), -1);
+		for (size_t i = 0; i < materials.size(); i++)
+		{
+			const JsonValue& pbr = materials[i]["pbrMetallicRoughness"];
+			int texture = pbr["baseColorTexture"]["index"].asInt(-1);
+			if (texture < 0 || texture >= (int)loaded.size())
+				continue;
+			if (!loaded[texture])
+			{
+				loaded[texture] = loadTexture(src, texture, cache, maxInitialSize);
+				if (!loaded[texture])
+					continue;
+				scene.textures.push_back(loaded[texture]);
+			}
+
+			//Phong exponent with roughly the same highlight width as the roughness
+			float roughness = pbr["roughnessFactor"].asFloat(1.f);
+			float alpha = std::max(roughness * roughness, 0.01f);
+			float shininess = std::min(std::max(2.f / (alpha * alpha) - 2.f, 1.f), 256.f);
+
+			Texture* tex = loaded[texture].get();
+			Material material(tex->getID(), tex->getID(), tex->getID(), shininess);
+			material.setTextures(tex, tex, tex);
+			materialIndex[i] = (int)scene.materials.size();
+			scene.materials.push_back(material);
+		}
+	}
+
+	static void loadMeshes(Source& src, GltfScene& scene, const std::vector<int>& materialIndex)
+	{
+		const JsonValue& meshes = src.json["meshes"];
+		scene.meshes.resize(meshes.size());
+		//Attribute locations shared by shader.vs and Mesh
+		const char* attributes[] = { "POSITION", "NORMAL", "TEXCOORD_0" };
+
+		for (size_t m = 0; m < meshes.size(); m++)
+		{
+			const JsonValue& primitives = meshes[m]["primitives"];
+			for (size_t p = 0; p < primitives.size(); p++)
+			{
+				const JsonValue& primitive = primitives[p];
+				if (primitive["extensions"].has("KHR_draco_mesh_compression"))
+				{
+					std::cout << "glTF " << src.fileName << ": skipping compressed primitive in mesh " << m << std::endl;
+					continue;
+				}
+
+				AccessorView views[3];
+				bool present[3];
+				for (int a = 0; a < 3; a++)
+				{
+					const JsonValue& accessor = primitive["attributes"][attributes[a]];
+					present[a] = !accessor.isNull() && resolveAccessor(src, accessor.asInt(-1), views[a]) && viewBuffer(src, scene, views[a].view);
+				}
+				if (!present[0])
+				{
+					std::cout << "glTF " << src.fileName << ": skipping primitive without usable positions in mesh " << m << std::endl;
+					continue;
+				}
+
+				GltfPrimitive out = {};
+				out.mode = (GLenum)primitive["mode"].asInt(4);
+				out.count = (GLsizei)views[0].count;
+				int material = primitive["material"].asInt(-1);
+				out.material = material >= 0 && material < (int)materialIndex.size() ? materialIndex[material] : -1;
+				out.hasNormals = present[1];
+				out.hasTexcoords = present[2];
+
+				const JsonValue& position = src.json["accessors"][primitive["attributes"]["POSITION"].asInt()];
+				const JsonValue& min = position["min"];
+				const JsonValue& max = position["max"];
+				if (min.size() == 3 && max.size() == 3)
+					out.bounds = AABB(glm::vec3(min[0].asFloat(), min[1].asFloat(), min[2].asFloat()), glm::vec3(max[0].asFloat(), max[1].asFloat(), max[2].asFloat()));
+
+				AccessorView indices;
+				bool indexed = primitive.has("indices");
+				if (indexed)
+				{
+					if (!resolveAccessor(src, primitive["indices"].asInt(-1), indices) || !viewBuffer(src, scene, indices.view) || indices.components != 1 ||
+						(indices.componentType != GL_UNSIGNED_BYTE && indices.componentType != GL_UNSIGNED_SHORT && indices.componentType != GL_UNSIGNED_INT))
+					{
+						std::cout << "glTF " << src.fileName << ": skipping primitive with unusable indices in mesh " << m << std::endl;
+						continue;
+					}
+					out.indexType = indices.componentType;
+					out.indexOffset = indices.offset;
+					out.count = (GLsizei)indices.count;
+				}
+
+				glGenVertexArrays(1, &out.VAO);
+				glBindVertexArray(out.VAO);
+				for (GLuint a = 0; a < 3; a++)
+				{
+					if (!present[a])
+					{
+						//Constant attribute, set by render: normals face +z, texcoords sit at the origin
+						glDisableVertexAttribArray(a);
+						continue;
+					}
+					//The accessor's own layout, normalised integer texcoords included
+					glBindBuffer(GL_ARRAY_BUFFER, src.viewBuffers[views[a].view]);
+					glVertexAttribPointer(a, views[a].components, views[a].componentType, views[a].normalized, views[a].stride, (GLvoid*)views[a].offset);
+					glEnableVertexAttribArray(a);
+				}
+				if (indexed)
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, src.viewBuffers[indices.view]);
+				glBindVertexArray(0);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+				scene.meshes[m].push_back(out);
+			}
+		}
+	}
+
+public:
+	//Loads a .gltf (with external or embedded buffers) or a .glb. Base colour textures go through the
+	//cache when one is given; maxInitialSize is passed on so they can stream like other textures.
+	static bool load(const char* fileName, GltfScene& scene, TextureCache* cache = nullptr, int maxInitialSize = 0)
+	{
+		scene.release();
+		MappedFile file(fileName);
+		if (!file.isOpen())
+		{
+			std::cout << "glTF failed to load at path: " << fileName << std::endl;
+			return false;
+		}
+
+		Source src;
+		src.fileName = fileName;
+		size_t slash = src.fileName.find_last_of("/\\");
+		src.directory = slash == std::string::npos ? std::string() : src.fileName.substr(0, slash + 1);
+
+		const char* data = file.getData();
+		size_t size = file.getSize();
+		const char* jsonBegin = data;
+		const char* jsonEnd = data + size;
+		BufferData bin = { nullptr, 0 };
+
+		uint32_t header[3];
+		if (size >= 12 && (std::memcpy(header, data, 12), header[0] == GLB_MAGIC))
+		{
+			//12 byte header, then chunks of { length, type, data } with JSON first
+			if (header[1] != 2 || header[2] > size)
+			{
+				std::cout << "Unsupported GLB: " << fileName << std::endl;
+				return false;
+			}
+			jsonEnd = nullptr;
+			size_t offset = 12;
+			while (offset + 8 <= header[2])
+			{
+				uint32_t chunk[2];
+				std::memcpy(chunk, data + offset, 8);
+				if (offset + 8 + chunk[0] > header[2])
+					break;
+				if (chunk[1] == GLB_CHUNK_JSON && !jsonEnd)
+				{
+					jsonBegin = data + offset + 8;
+					jsonEnd = jsonBegin + chunk[0];
+				}
+				else if (chunk[1] == GLB_CHUNK_BIN && !bin.data)
+				{
+					bin = { data + offset + 8, chunk[0] };
+				}
+				offset += 8 + ((chunk[0] + 3) & ~3u);
+			}
+			if (!jsonEnd)
+			{
+				std::cout << "GLB without JSON chunk: " << fileName << std::endl;
+				return false;
+			}
+		}
+
+		if (!JsonValue::parse(jsonBegin, jsonEnd, src.json) || src.json["asset"]["version"].asString().compare(0, 1, "2") != 0)
+		{
+			std::cout << "Invalid glTF 2.0 document: " << fileName << std::endl;
+			return false;
+		}
+		if (!loadBuffers(src, bin))
+		{
+			std::cout << "glTF buffers missing or truncated: " << fileName << std::endl;
+			return false;
+		}
+		src.viewBuffers.assign(src.json["bufferViews"].size(), 0);
+
+		std::vector<int> materialIndex;
+		loadMaterials(src, scene, materialIndex, cache, maxInitialSize);
+		loadMeshes(src, scene, materialIndex);
+
+		//Default scene, or every root node when the file has no scenes
+		const JsonValue& scenes = src.json["scenes"];
+		const JsonValue& nodes = src.json["nodes"];
+		if (scenes.size() > 0)
+		{
+			const JsonValue& roots = scenes[src.json["scene"].asSize()]["nodes"];
+			for (size_t i = 0; i < roots.size(); i++)
+				addNode(src, scene, roots[i].asInt(-1), glm::mat4(1.f), 0);
+		}
+		else
+		{
+			std::vector<bool> child(nodes.size(), false);
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				const JsonValue& children = nodes[i]["children"];
+				for (size_t c = 0; c < children.size(); c++)
+				{
+					size_t index = children[c].asSize(SIZE_MAX);
+					if (index < child.size())
+						child[index] = true;
+				}
+			}
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				if (!child[i])
+					addNode(src, scene, (int)i, glm::mat4(1.f), 0);
+			}
+		}
+
+		return !scene.instances.empty();
+	}
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "glad/glad.h"
+
+#include "Shader.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Two phase occlusion culling on the GPU against a hierarchical depth pyramid ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Per instance data, read by the cull shader and by shaderIndirect.vs (std430 layout, binding 0)
+struct HiZInstance
+{
+	glm::mat4 model;
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+};
+
+//Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+//Each frame the cull shader writes every instance's instanceCount, so the CPU never decides what is drawn:
+//phase one draws what the previous frame's pyramid doesn't hide, the pyramid is rebuilt from that depth,
+//and phase two draws what phase one rejected but the new pyramid shows. Only needs GL 4.3, so llvmpipe runs it.
+class HiZCuller
+{
+private:
+	Shader pyramidShader;
+	Shader cullShader;
+
+	//Farthest depth pyramid (R32F, level 0 at viewport size) and the depth copy it is built from
+	GLuint pyramid;
+	GLuint depthCopy;
+	int width;
+	int height;
+	int levels;
+	glm::mat4 pyramidViewProjection;
+	bool pyramidValid;
+
+	GLuint instanceBuffer;
+	GLuint commandBuffer;
+	GLuint counterBuffer;
+	//0, 1, 2... fed to the instanced attribute 4, so a command's base instance becomes the instance index
+	GLuint instanceIdBuffer;
+	size_t instanceCount;
+	size_t instanceIdCount;
+
+	static const GLuint GROUP_SIZE = 64;
+	static const GLuint PYRAMID_GROUP_SIZE = 8;
+	//Texture unit of its own, so the units materials sample from keep their textures
+	static const GLint TEXTURE_UNIT = 15;
+
+	void resize(int width, int height)
+	{
+		if (this->pyramid)
+			glDeleteTextures(1, &this->pyramid);
+		if (this->depthCopy)
+			glDeleteTextures(1, &this->depthCopy);
+		this->width = width;
+		this->height = height;
+		this->levels = 1;
+		while ((std::max(width, height) >> this->levels) > 0)
+			this->levels++;
+
+		glGenTextures(1, &this->pyramid);
+		glBindTexture(GL_TEXTURE_2D, this->pyramid);
+		glTexStorage2D(GL_TEXTURE_2D, this->levels, GL_R32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		//Same format as the default framebuffer's depth so the copy is a plain one
+		glGenTextures(1, &this->depthCopy);
+		glBindTexture(GL_TEXTURE_2D, this->depthCopy);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->pyramidValid = false;
+	}
+
+	//Reduces the bound read framebuffer's depth into the pyramid
+	void buildPyramid(const glm::mat4& viewProjection)
+	{
+		glBindTexture(GL_TEXTURE_2D, this->depthCopy);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, this->width, this->height);
+
+		this->pyramidShader.use();
+		this->pyramidShader.setInt("depth", TEXTURE_UNIT);
+		for (int level = 0; level < this->levels; level++)
+		{
+			int w = std::max(1, this->width >> level);
+			int h = std::max(1, this->height >> level);
+			this->pyramidShader.setBool("fromDepth", level == 0);
+			if (level > 0)
+				glBindImageTexture(0, this->pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, this->pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((w + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (h + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->pyramidViewProjection = viewProjection;
+		this->pyramidValid = true;
+	}
+
+	void cull(int phase, const glm::mat4& viewProjection)
+	{
+		this->cullShader.use();
+		this->cullShader.setUint("instanceCount", (unsigned)this->instanceCount);
+		this->cullShader.setInt("phase", phase);
+		this->cullShader.setMat4("viewProjection", viewProjection);
+		this->cullShader.setMat4("pyramidViewProjection", this->pyramidViewProjection);
+		this->cullShader.setInt("pyramidLevels", this->levels);
+		this->cullShader.setBool("pyramidValid", this->pyramidValid);
+		this->cullShader.setInt("pyramid", TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, this->pyramid);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->counterBuffer);
+		glDispatchCompute((GLuint)((this->instanceCount + GROUP_SIZE - 1) / GROUP_SIZE), 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glUseProgram(0);
+	}
+
+public:
+	struct Stats
+	{
+		GLuint frustumCulled;
+		GLuint occluded;
+		GLuint drawnFirst;
+		GLuint drawnSecond;
+	};
+
+	HiZCuller(const char* pyramidPath = "HiZ.comp", const char* cullPath = "HiZCull.comp") : pyramidShader(pyramidPath), cullShader(cullPath),
+		pyramid(0), depthCopy(0), width(0), height(0), levels(0), pyramidViewProjection(1.f), pyramidValid(false), instanceCount(0), instanceIdCount(0)
+	{
+		glGenBuffers(1, &this->instanceBuffer);
+		glGenBuffers(1, &this->commandBuffer);
+		glGenBuffers(1, &this->counterBuffer);
+		glGenBuffers(1, &this->instanceIdBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->counterBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Stats), nullptr, GL_DYNAMIC_READ);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	~HiZCuller()
+	{
+		glDeleteBuffers(1, &this->instanceBuffer);
+		glDeleteBuffers(1, &this->commandBuffer);
+		glDeleteBuffers(1, &this->counterBuffer);
+		glDeleteBuffers(1, &this->instanceIdBuffer);
+		if (this->pyramid)
+			glDeleteTextures(1, &this->pyramid);
+		if (this->depthCopy)
+			glDeleteTextures(1, &this->depthCopy);
+		glDeleteProgram(this->pyramidShader.ID);
+		glDeleteProgram(this->cullShader.ID);
+	}
+
+	HiZCuller(const HiZCuller&) = delete;
+	HiZCuller& operator=(const HiZCuller&) = delete;
+
+	//This frame's instances and one command per instance. Each command's instanceCount and baseInstance are filled in
+	//here; the rest (count, firstIndex, baseVertex) says which mesh range the instance draws.
+	void upload(const std::vector<HiZInstance>& instances, std::vector<DrawElementsIndirectCommand>& commands)
+	{
+		this->instanceCount = instances.size();
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			commands[i].instanceCount = 0;
+			commands[i].baseInstance = (GLuint)i;
+		}
+
+		//Orphaned every frame, so the driver never waits on last frame's draws
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->instanceBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(HiZInstance), instances.data(), GL_STREAM_DRAW);
+		//Phase one's commands then phase two's, both starting from the same template
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		if (this->instanceIdCount < instances.size())
+		{
+			this->instanceIdCount = std::max(instances.size(), this->instanceIdCount * 2);
+			std::vector<GLuint> ids(this->instanceIdCount);
+			for (size_t i = 0; i < ids.size(); i++)
+				ids[i] = (GLuint)i;
+			glBindBuffer(GL_ARRAY_BUFFER, this->instanceIdBuffer);
+			glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+	}
+
+	//Culls and draws the uploaded instances in two phases into the bound framebuffer, which must cover the viewport.
+	//drawPhase(firstCommand) issues the indirect draws, with command i of the phase at firstCommand + i; the draw
+	//indirect buffer and the instance buffer (binding 0, for shaderIndirect.vs) are bound while it runs.
+	template <typename Fn>
+	void render(const glm::mat4& viewProjection, Fn drawPhase)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		if (viewport[2] <= 0 || viewport[3] <= 0)
+			return;
+		if (this->instanceCount == 0)
+			return;
+		GLint activeTexture;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		if (viewport[2] != this->width || viewport[3] != this->height)
+			this->resize(viewport[2], viewport[3]);
+
+		const Stats zero = { 0, 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->counterBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Stats), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		this->cull(1, viewProjection);
+		glActiveTexture(activeTexture);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->instanceBuffer);
+		drawPhase((size_t)0);
+
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		this->buildPyramid(viewProjection);
+		this->cull(2, viewProjection);
+		glActiveTexture(activeTexture);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->instanceBuffer);
+		drawPhase(this->instanceCount);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	//Counts from the last render. Reading them back waits for the GPU, so this is for debugging and tests.
+	Stats readStats() const
+	{
+		Stats stats = { 0, 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->counterBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Stats), &stats);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return stats;
+	}
+
+	//Feed this to Mesh::setInstanceIds for every mesh drawn through the culler
+	inline GLuint getInstanceIdBuffer() const { return this->instanceIdBuffer; }
+	inline size_t getInstanceCount() const { return this->instanceCount; }
+	inline int getPyramidLevels() const { return this->levels; }
+};
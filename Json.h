@@ -0,0 +1,319 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <system_error>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Small read only JSON document, enough for asset manifests such as glTF ///////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class JsonValue
+{
+public:
+	enum Type
+	{
+		JSON_NULL,
+		JSON_BOOL,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT
+	};
+
+private:
+	Type type;
+	bool boolean;
+	double number;
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	static const JsonValue& null()
+	{
+		static const JsonValue value;
+		return value;
+	}
+
+	struct Parser
+	{
+		const char* p;
+		const char* end;
+		int depth;
+
+		void skipSpace()
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+				p++;
+		}
+
+		bool literal(const char* word)
+		{
+			size_t length = std::strlen(word);
+			if ((size_t)(end - p) < length || std::strncmp(p, word, length) != 0)
+				return false;
+			p += length;
+			return true;
+		}
+
+		static void appendUtf8(std::string& out, unsigned code)
+		{
+			if (code < 0x80)
+				out += (char)code;
+			else if (code < 0x800)
+			{
+				out += (char)(0xC0 | (code >> 6));
+				out += (char)(0x80 | (code & 0x3F));
+			}
+			else if (code < 0x10000)
+			{
+				out += (char)(0xE0 | (code >> 12));
+				out += (char)(0x80 | ((code >> 6) & 0x3F));
+				out += (char)(0x80 | (code & 0x3F));
+			}
+			else
+			{
+				out += (char)(0xF0 | (code >> 18));
+				out += (char)(0x80 | ((code >> 12) & 0x3F));
+				out += (char)(0x80 | ((code >> 6) & 0x3F));
+				out += (char)(0x80 | (code & 0x3F));
+			}
+		}
+
+		bool hex4(unsigned& code)
+		{
+			if (end - p < 4)
+				return false;
+			code = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				char c = *p++;
+				code <<= 4;
+				if (c >= '0' && c <= '9') code |= c - '0';
+				else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+				else return false;
+			}
+			return true;
+		}
+
+		bool parseString(std::string& out)
+		{
+			if (p >= end || *p != '"')
+				return false;
+			p++;
+			while (p < end && *p != '"')
+			{
+				if (*p != '\\')
+				{
+					out += *p++;
+					continue;
+				}
+				if (++p >= end)
+					return false;
+				char c = *p++;
+				switch (c)
+				{
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u':
+				{
+					unsigned code;
+					if (!hex4(code))
+						return false;
+					//Surrogate pair
+					if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+					{
+						p += 2;
+						unsigned low;
+						if (!hex4(low))
+							return false;
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+					appendUtf8(out, code);
+					break;
+				}
+				default: out += c; break;
+				}
+			}
+			if (p >= end)
+				return false;
+			p++;
+			return true;
+		}
+
+		bool parseValue(JsonValue& value)
+		{
+			skipSpace();
+			if (p >= end || depth > 256)
+				return false;
+
+			char c = *p;
+			if (c == '{')
+			{
+				p++;
+				depth++;
+				value.type = JSON_OBJECT;
+				skipSpace();
+				if (p < end && *p == '}')
+				{
+					p++;
+					depth--;
+					return true;
+				}
+				while (true)
+				{
+					skipSpace();
+					std::string key;
+					if (!parseString(key))
+						return false;
+					skipSpace();
+					if (p >= end || *p++ != ':')
+						return false;
+					value.object.emplace_back(std::move(key), JsonValue());
+					if (!parseValue(value.object.back().second))
+						return false;
+					skipSpace();
+					if (p < end && *p == ',')
+					{
+						p++;
+						continue;
+					}
+					if (p < end && *p == '}')
+					{
+						p++;
+						depth--;
+						return true;
+					}
+					return false;
+				}
+			}
+			if (c == '[')
+			{
+				p++;
+				depth++;
+				value.type = JSON_ARRAY;
+				skipSpace();
+				if (p < end && *p == ']')
+				{
+					p++;
+					depth--;
+					return true;
+				}
+				while (true)
+				{
+					value.array.emplace_back();
+					if (!parseValue(value.array.back()))
+						return false;
+					skipSpace();
+					if (p < end && *p == ',')
+					{
+						p++;
+						continue;
+					}
+					if (p < end && *p == ']')
+					{
+						p++;
+						depth--;
+						return true;
+					}
+					return false;
+				}
+			}
+			if (c == '"')
+			{
+				value.type = JSON_STRING;
+				return parseString(value.string);
+			}
+			if (literal("true"))
+			{
+				value.type = JSON_BOOL;
+				value.boolean = true;
+				return true;
+			}
+			if (literal("false"))
+			{
+				value.type = JSON_BOOL;
+				value.boolean = false;
+				return true;
+			}
+			if (literal("null"))
+			{
+				value.type = JSON_NULL;
+				return true;
+			}
+
+			//from_chars always reads '.' as the decimal point, strtod follows the C locale of the process
+			const char* start = p;
+			while (p < end && (std::strchr("+-.eE", *p) || (*p >= '0' && *p <= '9')))
+				p++;
+			if (p == start)
+				return false;
+			value.type = JSON_NUMBER;
+			std::from_chars_result result = std::from_chars(start, p, value.number);
+			return result.ec == std::errc() && result.ptr == p;
+		}
+	};
+
+public:
+	JsonValue() : type(JSON_NULL), boolean(false), number(0.0) {}
+
+	//Parses a whole document, false on malformed input
+	static bool parse(const char* begin, const char* end, JsonValue& out)
+	{
+		out = JsonValue();
+		Parser parser = { begin, end, 0 };
+		if (!parser.parseValue(out))
+			return false;
+		parser.skipSpace();
+		return parser.p == end || *parser.p == '\0';
+	}
+
+	inline Type getType() const { return this->type; }
+	inline bool isNull() const { return this->type == JSON_NULL; }
+	inline bool isObject() const { return this->type == JSON_OBJECT; }
+	inline bool isArray() const { return this->type == JSON_ARRAY; }
+
+	//Array or object member count
+	inline size_t size() const { return this->type == JSON_ARRAY ? this->array.size() : this->type == JSON_OBJECT ? this->object.size() : 0; }
+
+	//Missing members and out of range elements read as null, so lookups can be chained
+	const JsonValue& operator[](const char* key) const
+	{
+		for (const auto& member : this->object)
+		{
+			if (member.first == key)
+				return member.second;
+		}
+		return null();
+	}
+
+	const JsonValue& operator[](size_t index) const
+	{
+		return index < this->array.size() ? this->array[index] : null();
+	}
+
+	//Negative indices (used for "not set" in glTF style documents) read as null too
+	const JsonValue& operator[](int index) const
+	{
+		return index >= 0 ? (*this)[(size_t)index] : null();
+	}
+
+	inline bool has(const char* key) const { return !(*this)[key].isNull(); }
+
+	inline const std::string& memberName(size_t index) const { return this->object[index].first; }
+	inline const JsonValue& memberValue(size_t index) const { return this->object[index].second; }
+
+	inline double asNumber(double fallback = 0.0) const { return this->type == JSON_NUMBER ? this->number : fallback; }
+	inline float asFloat(float fallback = 0.f) const { return this->type == JSON_NUMBER ? (float)this->number : fallback; }
+	inline int asInt(int fallback = 0) const { return this->type == JSON_NUMBER ? (int)this->number : fallback; }
+	inline size_t asSize(size_t fallback = 0) const { return this->type == JSON_NUMBER && this->number >= 0.0 ? (size_t)this->number : fallback; }
+	inline bool asBool(bool fallback = false) const { return this->type == JSON_BOOL ? this->boolean : fallback; }
+	inline const std::string& asString() const { return this->string; }
+};
@@ -20,6 +20,11 @@
 #include "Camera.h"
 #include "Mesh.h"
 #include "Vertex.h"
+#include "TextureManager.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+#include "SceneGraph.h"
+#include "EntityStore.h"
 
 void windowSizeCallback(GLFWwindow* window, int width, int height);
 void windowCloseCallback(GLFWwindow* window);
@@ -198,32 +203,52 @@ int main()
 
     Shader ourShader("shader.vs", "shader.fs");
     Shader lightShader("Light.vs", "Light.fs");
+    //Same shading, with model matrices from the GPU culler's instance buffer
+    Shader indirectShader("shaderIndirect.vs", "shader.fs");
+    //Position only shaders for the depth pre-pass
+    Shader depthShader("Depth.vs", "Depth.fs");
+    Shader indirectDepthShader("DepthIndirect.vs", "Depth.fs");
     ourShader.use();
     //////////////////////////////////////////////////////////////////////////////////////////////////////
     ////////////////////////////////// Textures & Materials   ////////////////////////////////////////////////////////
     //////////////////////////////////////////////////////////////////////////////////////////////////////
     loadVertexArray(boxVertices, boxVerts);
     loadVertexArray(planeVertices, planeVerts);
-    Mesh Mesh1(boxVerts, 36, NULL, 0);
-    Mesh Mesh2(planeVerts, 4, planeIndices, 6);
-    Mesh Mesh3(boxVerts,36, NULL, 0);
+    //Fills mesh buffers in slices over the next frames instead of all at once; pumped once per frame in the render loop.
+    //Declared before the meshes so it outlives them.
+    MeshUploader meshUploader;
+    Mesh Mesh1(boxVerts, 36, NULL, 0, glm::vec3(0.f), glm::vec3(0.f), glm::vec3(0.f), glm::vec3(1.f), false, &meshUploader);
+    //The floor is merged by the static batcher before the first frame, so its buffers are filled right away
+    Mesh Mesh2(std::move(planeVerts), 4, planeIndices, 6);
+    Mesh Mesh3(std::move(boxVerts),36, NULL, 0, glm::vec3(0.f), glm::vec3(0.f), glm::vec3(0.f), glm::vec3(1.f), false, &meshUploader);
+
+    //Keeps texture memory under budget by dropping the top mips of textures that aren't being drawn
+    TextureManager textureManager(256 * 1024 * 1024);
+    //Shares one texture between every material that references the same image
+    TextureCache textureCache(&textureManager);
 
         // load and create a teture 
     // -------------------------
-    Texture texture1("Resources/Textures/crate.jpg", GL_IMAGE_2D);
-    Texture texture2("Resources/Textures/checkered.png", GL_IMAGE_2D);
-    Texture texture3("Resources/Textures/Floor.jpg", GL_IMAGE_2D);
+    // textures start at their 64px levels, the streamer brings in the levels the view needs
+    std::shared_ptr<Texture> texture1 = textureCache.load("Resources/Textures/crate.jpg", GL_IMAGE_2D, 64);
+    std::shared_ptr<Texture> texture2 = textureCache.load("Resources/Textures/checkered.png", GL_IMAGE_2D, 64);
+    std::shared_ptr<Texture> texture3 = textureCache.load("Resources/Textures/Floor.jpg", GL_IMAGE_2D, 64);
+    textureCache.printStats();
 
 
-    Material mat1(texture1.getID(), texture1.getID(), texture1.getID(), 100);
-    Material mat2(texture3.getID(), texture3.getID(), texture3.getID(), 100);
+    Material mat1(texture1->getID(), texture1->getID(), texture1->getID(), 100);
+    Material mat2(texture3->getID(), texture3->getID(), texture3->getID(), 100);
+    mat1.setTextures(texture1.get(), texture1.get(), texture1.get());
+    mat2.setTextures(texture3.get(), texture3.get(), texture3.get());
 
     mat1.sendToShader(ourShader);
 
 
-    texture1.bind(texture1.getID());
-    texture2.bind(texture2.getID());
-    texture3.bind(texture3.getID());
+    texture1->bind(texture1->getID());
+    texture2->bind(texture2->getID());
+    texture3->bind(texture3->getID());
+
+    TextureStreamer textureStreamer(&textureManager);
 
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -241,9 +266,48 @@ int main()
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //Set initial Mesh transforms
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-    Mesh1.setPosition(cubePosition);
-    Mesh2.setScale(glm::vec3(100.f, 1.f, 100.f));
     Mesh3.setScale(glm::vec3(0.5f, 0.5f, 0.5f));
+    //The light's cube hangs off the light node, so it follows wherever the light is moved
+    SceneGraph scene;
+    SceneNode lightNode = scene.create();
+    scene.setLocalPosition(lightNode, lightPos);
+    Mesh3.attach(&scene, lightNode);
+
+    //The cube and the floor are entities: Mesh1 and Mesh2 are shared resources, their transforms live on scene nodes
+    EntityStore entities;
+    OcclusionCuller occlusionCuller;
+    //Hardware occlusion queries on the entity BVH, used once the scene is big enough to have one
+    OcclusionQueries occlusionQueries;
+    //Two phase Hi-Z culling in compute; when on, the GPU alone decides what is drawn
+    HiZCuller hiZCuller;
+    bool gpuCulling = true;
+    //Lay down depth first and shade with GL_EQUAL, instead of drawing front to back; entities.getOverdraw() says which wins
+    bool depthPrepass = false;
+    //Small moving meshes are transformed into one buffer and drawn a material at a time when the CPU culled paths draw
+    DynamicBatcher dynamicBatcher;
+    entities.setDynamicBatcher(&dynamicBatcher);
+    SceneNode cubeNode = scene.create();
+    scene.setLocalPosition(cubeNode, cubePosition);
+    SceneNode planeNode = scene.create();
+    scene.setLocalScale(planeNode, glm::vec3(100.f, 1.f, 100.f));
+
+    Entity cube = entities.create(COMPONENT_RENDERABLE | COMPONENT_DYNAMIC);
+    entities.get<TransformComponent>(cube)->node = cubeNode;
+    entities.get<MeshRefComponent>(cube)->mesh = &Mesh1;
+    entities.get<MaterialRefComponent>(cube)->material = &mat1;
+    //The floor hides whatever is below it
+    Entity plane = entities.create(COMPONENT_RENDERABLE | COMPONENT_OCCLUDER);
+    entities.get<TransformComponent>(plane)->node = planeNode;
+    entities.get<MeshRefComponent>(plane)->mesh = &Mesh2;
+    entities.get<MaterialRefComponent>(plane)->material = &mat2;
+    Mesh1.generateLods();
+    Mesh1.buildMeshlets();
+    //Static entities are merged into world space chunks once their transforms are known, so the floor and any
+    //other static props cost a draw per material and chunk instead of one each
+    StaticBatcher staticBatcher;
+    scene.update();
+    entities.syncTransforms(scene);
+    entities.batchStatic(staticBatcher);
     // Start Render Loop here
     do
     {
@@ -252,11 +316,17 @@ int main()
         ourShader.use();
         ourShader.setVec3("viewPos", camera.Position);
         ourShader.setVec3("light.position", lightPos);
+        indirectShader.use();
+        indirectShader.setVec3("viewPos", camera.Position);
+        indirectShader.setVec3("light.position", lightPos);
 
         //set Mesh transforms
 
-        Mesh1.setRotation(glm::vec3(0.f, angle, 0.f));
-        Mesh3.setPosition(lightPos);
+        scene.setLocalRotation(cubeNode, glm::vec3(0.f, angle, 0.f));
+        scene.setLocalPosition(lightNode, lightPos);
+        scene.update();
+        entities.syncTransforms(scene);
+        entities.updateBounds();
 
         //calculate delta time
 
@@ -281,17 +351,33 @@ int main()
         glm::mat4 view = camera.GetViewMatrix();
 
         //Set our Shader's variables
-
+        ourShader.use();
         ourShader.setMat4("projection", projection);
         ourShader.setMat4("view", view);
+        indirectShader.use();
+        indirectShader.setMat4("projection", projection);
+        indirectShader.setMat4("view", view);
+        depthShader.use();
+        depthShader.setMat4("projection", projection);
+        depthShader.setMat4("view", view);
+        indirectDepthShader.use();
+        indirectDepthShader.setMat4("projection", projection);
+        indirectDepthShader.setMat4("view", view);
 
         //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         //Render our Meshes
         //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        mat1.sendToShader(ourShader);
-        Mesh1.render(&ourShader);
-        mat2.sendToShader(ourShader);
-        Mesh2.render(&ourShader);
+        entities.cull(camera);
+        if (!gpuCulling)
+            entities.cullOccluded(camera, occlusionCuller);
+        entities.selectLods(camera);
+        entities.requestTextures(camera, textureStreamer);
+        if (gpuCulling)
+            entities.renderGpuCulled(&ourShader, &indirectShader, camera, hiZCuller, depthPrepass ? &indirectDepthShader : nullptr);
+        else if (depthPrepass)
+            entities.render(&ourShader, &camera, &depthShader);
+        else
+            entities.renderQueried(&ourShader, &lightShader, &camera, occlusionQueries);
 
         //Render our lightsource
         mat1.sendToShader(lightShader);
@@ -301,6 +387,10 @@ int main()
         lightShader.setVec3("light.position", lightPos);
         Mesh3.render(&lightShader);
 
+        //Evict and stream texture levels for what was drawn this frame
+        textureManager.update();
+        //Upload the next slices of any mesh buffers still streaming in
+        meshUploader.update();
 
 
 
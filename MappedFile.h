@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Read only memory mapping of a whole file, pages come in from the OS as they are touched ///////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+private:
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+
+public:
+	MappedFile(const char* fileName)
+	{
+		this->data = nullptr;
+		this->size = 0;
+#ifdef _WIN32
+		this->mapping = NULL;
+		this->file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (this->file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0)
+			return;
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (this->mapping == NULL)
+			return;
+		this->data = (const char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (this->data)
+			this->size = (size_t)fileSize.QuadPart;
+#else
+		this->file = open(fileName, O_RDONLY);
+		if (this->file < 0)
+			return;
+		struct stat info;
+		if (fstat(this->file, &info) != 0 || info.st_size == 0)
+			return;
+		void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, this->file, 0);
+		if (mapped == MAP_FAILED)
+			return;
+		madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+		this->data = (const char*)mapped;
+		this->size = (size_t)info.st_size;
+#endif
+	}
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (this->data)
+			UnmapViewOfFile(this->data);
+		if (this->mapping)
+			CloseHandle(this->mapping);
+		if (this->file != INVALID_HANDLE_VALUE)
+			CloseHandle(this->file);
+#else
+		if (this->data)
+			munmap((void*)this->data, this->size);
+		if (this->file >= 0)
+			close(this->file);
+#endif
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline bool isOpen() const { return this->data != nullptr; }
+	inline const char* getData() const { return this->data; }
+	inline size_t getSize() const { return this->size; }
+};
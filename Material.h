@@ -7,6 +7,7 @@
 #include<glm.hpp>
 
 #include "Shader.h"
+#include "Texture.h"
 
 class Material
 {
@@ -15,7 +16,14 @@ private:
 	GLint diffuseTex2;
 	GLint specularTex;
 	float shininess;
+	Texture* textures[3];
+	//Set when the units hold texture arrays (see TexturePacker), used by shaderArray.fs
+	bool packed;
+	glm::vec3 layers;
+	glm::vec4 rects[3];
 public:
+	static const int TEXTURE_COUNT = 3;
+
 	Material(
 		GLint diffuseTex1,
 		GLint diffuseTex2,
@@ -27,9 +35,34 @@ public:
 		this->diffuseTex2 = diffuseTex2;
 		this->specularTex = specularTex;
 		this->shininess = shininess;
+		this->textures[0] = nullptr;
+		this->textures[1] = nullptr;
+		this->textures[2] = nullptr;
+		this->packed = false;
+		this->layers = glm::vec3(0.f);
+		this->rects[0] = this->rects[1] = this->rects[2] = glm::vec4(1.f, 1.f, 0.f, 0.f);
 	}
 	~Material() {}
 
+	//Textures behind the diffuse1, diffuse2 and specular units, so residency can follow what is drawn
+	void setTextures(Texture* diffuse1, Texture* diffuse2, Texture* specular)
+	{
+		this->textures[0] = diffuse1;
+		this->textures[1] = diffuse2;
+		this->textures[2] = specular;
+	}
+
+	inline Texture* getTexture(int index) const { return this->textures[index]; }
+
+	//Points a slot (0 diffuse1, 1 diffuse2, 2 specular) at a layer of the texture array bound to
+	//that slot's unit, with rect giving xy scale and zw offset of the texture inside the layer
+	void setLayer(int slot, int layer, glm::vec4 rect = glm::vec4(1.f, 1.f, 0.f, 0.f))
+	{
+		this->packed = true;
+		this->layers[slot] = (float)layer;
+		this->rects[slot] = rect;
+	}
+
 	//Function to load our Uniforms into GLSL shader
 	void sendToShader(Shader& program)
 	{
@@ -38,6 +71,13 @@ public:
 		program.setInt("material.diffuse2", this->diffuseTex2);
 		program.setInt("material.specular", this->specularTex);
 		program.setFloat("material.shininess", this->shininess);
+		if (this->packed)
+		{
+			program.setVec3("material.layer", this->layers);
+			program.setVec4("material.rect[0]", this->rects[0]);
+			program.setVec4("material.rect[1]", this->rects[1]);
+			program.setVec4("material.rect[2]", this->rects[2]);
+		}
 		//program.unuse();    //Unbinding the program seems to cause all the textures to not load, even when the program is binded again before use
 	
 	}
@@ -2,16 +2,35 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <cfloat>
 
 #include "Shader.h"
 #include "Vertex.h"
 #include "Texture.h"
 #include "Material.h"
+#include "Bounds.h"
+#include "MeshIndexer.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshNormals.h"
+#include "Meshlet.h"
+#include "MeshFile.h"
+#include "MeshCodec.h"
+#include "MappedFile.h"
+#include "MeshUploader.h"
+#include "SceneGraph.h"
+#include "Camera.h"
 
 #include <vector>
 #include <gtc/matrix_transform.hpp>
 
 
+//A coarser LOD is only picked once its error is this fraction of the allowed pixel error,
+//so instances near a switching distance don't flicker between two levels
+const float LOD_HYSTERESIS = 0.7f;
+
 class Mesh
 {
 private: 
@@ -19,9 +38,21 @@ private:
 	unsigned nrOfVertices;
 	GLuint* indexArray;
 	unsigned nrOfIndices;
+	//Storage behind vertexArray and indexArray unless they point into a cooked file. Vectors handed to the
+	//mesh are moved in here, so the mesh never holds a second copy of them.
+	std::vector<Vertex> ownedVertices;
+	std::vector<GLuint> ownedIndices;
+	GLenum indexType;
 	GLuint VAO;
 	GLuint VBO;
 	GLuint EBO;
+	//Attribute 3, only created by generateTangents
+	GLuint tangentVBO;
+	//Packed positions sharing the EBO, for depth only passes; made by the first one
+	GLuint positionVAO;
+	GLuint positionVBO;
+	//Instance index stream from setInstanceIds, also attached to the position VAO
+	GLuint instanceIdBuffer;
 
 	Material* mat;
 
@@ -32,6 +63,41 @@ private:
 
 	glm::mat4 ModelMatrix;
 
+	//With a scene graph node attached, the mesh's own transform is relative to that node
+	const SceneGraph* sceneGraph;
+	SceneNode sceneNode;
+
+	std::vector<MeshLod> lods;
+	int currentLod;
+	//Changes whenever the index buffer does. Drawn from one counter shared by every mesh, so a cache keyed
+	//on a mesh's address can't mistake a new mesh at a reused address for the old one.
+	uint64_t indexRevision;
+
+	static uint64_t nextIndexRevision()
+	{
+		static std::atomic<uint64_t> counter(0);
+		return ++counter;
+	}
+
+	//Clusters of the full detail LOD and the ranges that survived this frame's culling
+	std::shared_ptr<MeshletSet> meshlets;
+	std::vector<GLsizei> drawCounts;
+	std::vector<const void*> drawOffsets;
+	bool drawCulled;
+
+	AABB bounds;
+	float uvDensity;
+	glm::vec3 uvDensityScale;
+
+	//Set for meshes loaded from a cooked file: vertexArray points into the mapping and so does
+	//cookedIndices (in indexType) until the indices are rebuilt into indexArray
+	std::shared_ptr<MappedFile> cookedFile;
+	const void* cookedIndices;
+
+	//Set for meshes streamed in over several frames; they are not drawn until uploadTicket completes
+	MeshUploader* uploader;
+	uint64_t uploadTicket;
+
 	void initVAO()
 	{
 		//Create VAO
@@ -41,14 +107,19 @@ private:
 		//GEN VBO AND BIND AND SEND DATA
 		glGenBuffers(1, &this->VBO);
 		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->nrOfVertices * sizeof(Vertex), this->vertexArray, GL_STATIC_DRAW);
+		if (this->uploader && this->nrOfVertices > 0)
+		{
+			glBufferStorage(GL_ARRAY_BUFFER, this->nrOfVertices * sizeof(Vertex), NULL, 0);
+			this->uploadTicket = this->uploader->upload(this->VBO, this->vertexArray, this->nrOfVertices * sizeof(Vertex));
+		}
+		else
+			glBufferData(GL_ARRAY_BUFFER, this->nrOfVertices * sizeof(Vertex), this->vertexArray, GL_STATIC_DRAW);
 
 		//GEN EBO AND BIND AND SEND DATA
 		if (this->nrOfIndices > 0)
 		{
 			glGenBuffers(1, &this->EBO);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->nrOfIndices * sizeof(GLuint), this->indexArray, GL_STATIC_DRAW);
+			this->uploadIndices();
 		}
 
 		//SET VERTEXATTRIBPOINTERS AND ENABLE (INPUT ASSEMBLY)
@@ -67,6 +138,163 @@ private:
 		//glBindVertexArray(0);
 	}
 
+	//Sends indexArray to the EBO of the bound VAO, as 16 bit indices whenever every vertex can be addressed with them
+	void uploadIndices()
+	{
+		if (this->uploader)
+		{
+			this->streamIndices();
+			return;
+		}
+		if (this->cookedIndices)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->nrOfIndices * MeshIndexer::indexSize(this->indexType), this->cookedIndices, GL_STATIC_DRAW);
+			return;
+		}
+		this->indexType = MeshIndexer::indexType(this->nrOfVertices);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		if (this->indexType == GL_UNSIGNED_SHORT)
+		{
+			std::vector<GLushort> shortIndices(this->indexArray, this->indexArray + this->nrOfIndices);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->nrOfIndices * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+		}
+		else
+		{
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->nrOfIndices * sizeof(GLuint), this->indexArray, GL_STATIC_DRAW);
+		}
+	}
+
+	//Immutable storage filled by the uploader over the next frames
+	void streamIndices()
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		if (this->nrOfIndices == 0)
+			return;
+
+		if (!this->cookedIndices)
+			this->indexType = MeshIndexer::indexType(this->nrOfVertices);
+		size_t bytes = this->nrOfIndices * MeshIndexer::indexSize(this->indexType);
+		glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, bytes, NULL, 0);
+		if (this->cookedIndices)
+			this->uploadTicket = this->uploader->upload(this->EBO, this->cookedIndices, bytes);
+		else if (this->indexType == GL_UNSIGNED_SHORT)
+		{
+			auto shortIndices = std::make_shared<std::vector<GLushort>>(this->indexArray, this->indexArray + this->nrOfIndices);
+			this->uploadTicket = this->uploader->upload(this->EBO, shortIndices->data(), bytes, shortIndices);
+		}
+		else
+			this->uploadTicket = this->uploader->upload(this->EBO, this->indexArray, bytes);
+	}
+
+	void computeBounds()
+	{
+		this->bounds = AABB();
+		for (size_t i = 0; i < this->nrOfVertices; i++)
+		{
+			this->bounds.expand(this->vertexArray[i].position);
+		}
+		this->uvDensity = -1.f;
+	}
+
+	inline GLuint indexAt(size_t i) const
+	{
+		if (!this->cookedIndices)
+			return this->indexArray[i];
+		return this->indexType == GL_UNSIGNED_SHORT ? ((const GLushort*)this->cookedIndices)[i] : ((const GLuint*)this->cookedIndices)[i];
+	}
+
+	std::vector<GLuint> copyIndices(size_t begin, size_t end) const
+	{
+		std::vector<GLuint> indices(end - begin);
+		for (size_t i = begin; i < end; i++)
+			indices[i - begin] = this->indexAt(i);
+		return indices;
+	}
+
+	//Replaces the index buffer, leaving the cooked indices (if any) for an owned copy
+	void setIndices(std::vector<GLuint> indices)
+	{
+		this->cookedIndices = nullptr;
+		this->nrOfIndices = (unsigned)indices.size();
+		this->ownedIndices = std::move(indices);
+		this->indexArray = this->ownedIndices.data();
+		this->indexRevision = nextIndexRevision();
+
+		glBindVertexArray(this->VAO);
+		//Immutable storage can't be respecified, so a streamed mesh gets a new EBO
+		if (this->uploader && this->EBO != 0)
+		{
+			this->uploader->cancel(this->EBO);
+			glDeleteBuffers(1, &this->EBO);
+			this->EBO = 0;
+		}
+		if (this->EBO == 0)
+			glGenBuffers(1, &this->EBO);
+		this->uploadIndices();
+		if (this->positionVAO != 0)
+		{
+			glBindVertexArray(this->positionVAO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		}
+		glBindVertexArray(0);
+	}
+
+	//Positions only, 12 bytes a vertex instead of sizeof(Vertex), so depth only passes fetch less
+	void initPositionStream()
+	{
+		std::vector<glm::vec3> positions(this->nrOfVertices);
+		for (size_t i = 0; i < positions.size(); i++)
+			positions[i] = this->vertexArray[i].position;
+
+		glGenVertexArrays(1, &this->positionVAO);
+		glBindVertexArray(this->positionVAO);
+		glGenBuffers(1, &this->positionVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+		if (this->EBO != 0)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+		if (this->instanceIdBuffer != 0)
+			this->attachInstanceIds();
+		glBindVertexArray(0);
+	}
+
+	//Attribute 4 of the bound VAO from instanceIdBuffer
+	void attachInstanceIds()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceIdBuffer);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+		glVertexAttribDivisor(4, 1);
+		glEnableVertexAttribArray(4);
+	}
+
+	//Draw calls for a LOD into the bound VAO; with a camera the full detail LOD is meshlet culled for model
+	void drawLod(const glm::mat4& model, int lod, Camera* camera)
+	{
+		lod = std::min(std::max(lod, 0), (int)this->lods.size() - 1);
+		if (this->nrOfIndices == 0)
+			glDrawArrays(GL_TRIANGLES, 0, this->nrOfVertices);
+		else if (camera && this->meshlets && lod == 0)
+		{
+			Frustum frustum(camera->Projection * camera->GetViewMatrix());
+			this->meshlets->cull(frustum, model, camera->Position, MeshIndexer::indexSize(this->indexType), this->drawCounts, this->drawOffsets);
+			if (!this->drawCounts.empty())
+				glMultiDrawElements(GL_TRIANGLES, this->drawCounts.data(), this->indexType, this->drawOffsets.data(), (GLsizei)this->drawCounts.size());
+		}
+		else
+		{
+			const MeshLod& range = this->lods[lod];
+			glDrawElements(GL_TRIANGLES, range.indexCount, this->indexType, (GLvoid*)(range.indexOffset * MeshIndexer::indexSize(this->indexType)));
+		}
+	}
+
+	inline GLuint triangleIndex(size_t i) const
+	{
+		return this->lods[0].indexCount > 0 ? this->indexAt(i) : (GLuint)i;
+	}
+
 	void updateUniforms(Shader* shader)
 	{
 		shader->setMat4("model", this->ModelMatrix);
@@ -81,12 +309,16 @@ private:
 		this->ModelMatrix = glm::rotate(this->ModelMatrix, glm::radians(this->rotation.z), glm::vec3(0.f, 0.f, 1.f));
 		this->ModelMatrix = glm::translate(this->ModelMatrix, this->position - this->origin);
 		this->ModelMatrix = glm::scale(this->ModelMatrix, this->scale);
+		if (this->sceneGraph)
+			this->ModelMatrix = this->sceneGraph->getWorldMatrix(this->sceneNode) * this->ModelMatrix;
 	}
 
 
 public:
 
 
+	//With an uploader the buffers are streamed in as the uploader's update() is called each frame;
+	//isUploaded() is false, and render skips the mesh, until then.
 	Mesh(
 		std::vector<Vertex> vertexArray,
 		const unsigned& nrOfVertices,
@@ -95,7 +327,9 @@ public:
 		glm::vec3 position = glm::vec3(0.f),
 		glm::vec3 origin = glm::vec3(0.f),
 		glm::vec3 rotation = glm::vec3(0.f),
-		glm::vec3 scale = glm::vec3(1.f))
+		glm::vec3 scale = glm::vec3(1.f),
+		bool optimize = false,
+		MeshUploader* uploader = nullptr)
 	{
 
 		this->position = position;
@@ -103,21 +337,51 @@ public:
 		this->rotation = rotation;
 		this->scale = scale;
 
-		this->nrOfVertices = nrOfVertices;
-		this->nrOfIndices = nrOfIndices;
-
-		this->vertexArray = new Vertex[this->nrOfVertices];
-		for (size_t i = 0; i < nrOfVertices; i++)
+		//Unindexed triangle lists are welded so shared corners are only transformed once
+		std::vector<GLuint> indices;
+		if (indexArray == NULL || nrOfIndices == 0)
 		{
-			this->vertexArray[i] = vertexArray[i];
+			std::vector<Vertex> welded;
+			MeshIndexer::weld(vertexArray.data(), nrOfVertices, NULL, 0, welded, indices);
+			vertexArray.swap(welded);
+		}
+		else
+		{
+			vertexArray.resize(nrOfVertices);
+			indices.assign(indexArray, indexArray + nrOfIndices);
 		}
 
-		this->indexArray = new GLuint[this->nrOfIndices];
-		for (size_t i = 0; i < nrOfIndices; i++)
+		//Triangle order for the vertex cache and overdraw, vertex order for fetch
+		if (optimize)
 		{
-			this->indexArray[i] = indexArray[i];
+			MeshOptimizer::optimize(vertexArray, indices, true);
 		}
 
+		this->nrOfVertices = (unsigned)vertexArray.size();
+		this->nrOfIndices = (unsigned)indices.size();
+
+		//The working vectors become the mesh's storage. Callers done with their vector can std::move it in,
+		//so the vertices are never copied at all.
+		this->ownedVertices = std::move(vertexArray);
+		this->vertexArray = this->ownedVertices.data();
+		this->ownedIndices = std::move(indices);
+		this->indexArray = this->ownedIndices.data();
+		this->lods.assign(1, { 0, this->nrOfIndices, 0.f });
+		this->currentLod = 0;
+		this->drawCulled = false;
+		this->cookedIndices = nullptr;
+		this->uploader = uploader;
+		this->uploadTicket = 0;
+		this->EBO = 0;
+		this->tangentVBO = 0;
+		this->positionVAO = 0;
+		this->positionVBO = 0;
+		this->instanceIdBuffer = 0;
+		this->sceneGraph = nullptr;
+		this->sceneNode = SCENE_ROOT;
+		this->indexRevision = nextIndexRevision();
+
+		this->computeBounds();
 		this->initVAO();
 		this->updateModelMatrix();
 	}
@@ -131,17 +395,136 @@ public:
 
 		this->nrOfVertices = obj.nrOfVertices;
 		this->nrOfIndices = obj.nrOfIndices;
+		this->indexType = obj.indexType;
 
-		this->vertexArray = new Vertex[this->nrOfVertices];
-		for (size_t i = 0; i < this->nrOfVertices; i++)
+		//Cooked data is read only, so copies share the mapping
+		this->cookedFile = obj.cookedFile;
+		this->cookedIndices = obj.cookedIndices;
+		this->ownedVertices = obj.ownedVertices;
+		this->vertexArray = this->cookedFile ? obj.vertexArray : this->ownedVertices.data();
+
+		this->indexArray = NULL;
+		if (!this->cookedIndices)
 		{
-			this->vertexArray[i] = obj.vertexArray[i];
+			this->ownedIndices = obj.ownedIndices;
+			this->indexArray = this->ownedIndices.data();
 		}
+		this->lods = obj.lods;
+		this->currentLod = obj.currentLod;
+		//Same index order, so the clusters can be shared
+		this->meshlets = obj.meshlets;
+		this->drawCulled = false;
+
+		this->bounds = obj.bounds;
+		this->uvDensity = -1.f;
+		//The source arrays are complete on the CPU, so copies upload right away
+		this->uploader = nullptr;
+		this->uploadTicket = 0;
+		this->EBO = 0;
+		this->tangentVBO = 0;
+		this->positionVAO = 0;
+		this->positionVBO = 0;
+		this->instanceIdBuffer = 0;
+		this->sceneGraph = obj.sceneGraph;
+		this->sceneNode = obj.sceneNode;
+		this->indexRevision = nextIndexRevision();
+		this->initVAO();
+		if (obj.tangentVBO != 0)
+			this->generateTangents();
+		this->updateModelMatrix();
+	}
 
-		this->indexArray = new GLuint[this->nrOfIndices];
-		for (size_t i = 0; i < this->nrOfIndices; i++)
+	//Loads a cooked mesh: the GL buffers are filled straight from the mapped file, so nothing is
+	//parsed or copied on the heap. Compressed meshes (see MeshCodec.h) are decoded instead.
+	//An unreadable or incompatible file gives an empty mesh.
+	//With an uploader the pages are streamed in over the next frames instead of read all at once.
+	explicit Mesh(
+		const char* fileName,
+		glm::vec3 position = glm::vec3(0.f),
+		glm::vec3 origin = glm::vec3(0.f),
+		glm::vec3 rotation = glm::vec3(0.f),
+		glm::vec3 scale = glm::vec3(1.f),
+		MeshUploader* uploader = nullptr)
+	{
+		this->position = position;
+		this->origin = origin;
+		this->rotation = rotation;
+		this->scale = scale;
+
+		this->vertexArray = NULL;
+		this->indexArray = NULL;
+		this->cookedIndices = nullptr;
+		this->nrOfVertices = 0;
+		this->nrOfIndices = 0;
+		this->indexType = GL_UNSIGNED_INT;
+		this->lods.assign(1, { 0, 0, 0.f });
+		this->currentLod = 0;
+		this->drawCulled = false;
+		this->uvDensity = -1.f;
+		this->uploader = uploader;
+		this->uploadTicket = 0;
+		this->EBO = 0;
+		this->tangentVBO = 0;
+		this->positionVAO = 0;
+		this->positionVBO = 0;
+		this->instanceIdBuffer = 0;
+		this->sceneGraph = nullptr;
+		this->sceneNode = SCENE_ROOT;
+		this->indexRevision = nextIndexRevision();
+
+		this->cookedFile = std::make_shared<MappedFile>(fileName);
+		const MeshFileHeader* header = MeshFile::validate(*this->cookedFile);
+		std::vector<Vertex> vertices;
+		std::vector<GLuint> indices;
+		std::vector<MeshLod> lods;
+		std::vector<Meshlet> clusters;
+		if (header == nullptr && this->cookedFile->isOpen() &&
+			MeshCodec::decode(this->cookedFile->getData(), this->cookedFile->getSize(), vertices, indices, lods, clusters))
 		{
-			this->indexArray[i] = obj.indexArray[i];
+			//Decoded data is owned like that of any other mesh, the mapping isn't needed past here
+			this->cookedFile.reset();
+			this->nrOfVertices = (unsigned)vertices.size();
+			this->nrOfIndices = (unsigned)indices.size();
+			this->ownedVertices = std::move(vertices);
+			this->vertexArray = this->ownedVertices.data();
+			this->ownedIndices = std::move(indices);
+			this->indexArray = this->ownedIndices.data();
+
+			if (!lods.empty())
+				this->lods = lods;
+			else
+				this->lods.assign(1, { 0, this->nrOfIndices, 0.f });
+			if (!clusters.empty())
+			{
+				this->meshlets = std::make_shared<MeshletSet>();
+				this->meshlets->assign(clusters.data(), clusters.size());
+			}
+			this->computeBounds();
+		}
+		else if (header == nullptr)
+		{
+			std::cout << "Failed to load cooked mesh: " << fileName << std::endl;
+			this->cookedFile.reset();
+		}
+		else
+		{
+			this->vertexArray = const_cast<Vertex*>(MeshFile::vertices(*this->cookedFile, *header));
+			this->nrOfVertices = header->vertexCount;
+			this->nrOfIndices = header->indexCount;
+			this->indexType = header->indexType;
+			if (this->nrOfIndices > 0)
+				this->cookedIndices = MeshFile::indices(*this->cookedFile, *header);
+
+			const MeshLod* lods = MeshFile::lods(*this->cookedFile, *header);
+			this->lods.assign(lods, lods + header->lodCount);
+			if (header->meshletCount > 0)
+			{
+				this->meshlets = std::make_shared<MeshletSet>();
+				this->meshlets->assign(MeshFile::meshlets(*this->cookedFile, *header), header->meshletCount);
+			}
+			this->bounds = AABB();
+			this->bounds.expand(glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]));
+			this->bounds.expand(glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]));
 		}
 
 		this->initVAO();
@@ -150,16 +533,260 @@ public:
 
 	~Mesh()
 	{
+		if (this->uploader)
+		{
+			this->uploader->cancel(this->VBO);
+			this->uploader->cancel(this->EBO);
+		}
 		glDeleteVertexArrays(1, &this->VAO);
 		glDeleteBuffers(1, &this->VBO);
 
-		if (this->nrOfIndices > 0)
+		if (this->EBO != 0)
 		{
 			glDeleteBuffers(1, &this->EBO);
 		}
+		if (this->tangentVBO != 0)
+		{
+			glDeleteBuffers(1, &this->tangentVBO);
+		}
+		if (this->positionVAO != 0)
+		{
+			glDeleteVertexArrays(1, &this->positionVAO);
+			glDeleteBuffers(1, &this->positionVBO);
+		}
+
+	}
+
+	//Exports the mesh as a cooked file (see MeshFile.h) with its LODs and meshlets
+	bool exportCooked(const char* fileName) const
+	{
+		std::vector<Meshlet> clusters;
+		if (this->meshlets)
+			clusters = this->meshlets->getMeshlets();
+
+		if (this->cookedIndices || this->indexType == GL_UNSIGNED_INT || this->nrOfIndices == 0)
+		{
+			const void* indices = this->cookedIndices ? this->cookedIndices : (const void*)this->indexArray;
+			return MeshFile::write(fileName, this->vertexArray, this->nrOfVertices, indices, this->nrOfIndices, this->indexType, this->bounds, this->lods, clusters);
+		}
+		std::vector<GLushort> shortIndices(this->indexArray, this->indexArray + this->nrOfIndices);
+		return MeshFile::write(fileName, this->vertexArray, this->nrOfVertices, shortIndices.data(), this->nrOfIndices, this->indexType, this->bounds, this->lods, clusters);
+	}
+
+	//Exports the mesh compressed for distribution (see MeshCodec.h), loadable with the file constructor
+	bool exportCompressed(const char* fileName) const
+	{
+		std::vector<Meshlet> clusters;
+		if (this->meshlets)
+			clusters = this->meshlets->getMeshlets();
+		std::vector<GLuint> indices = this->copyIndices(0, this->nrOfIndices);
+		return MeshCodec::write(fileName, this->vertexArray, this->nrOfVertices, indices.data(), indices.size(), this->lods, clusters);
+	}
+
+	inline bool isCooked() const { return this->cookedFile != nullptr; }
+	//False while a streamed mesh is still uploading; render skips it until then
+	inline bool isUploaded() const { return !this->uploader || this->uploader->isComplete(this->uploadTicket); }
+	inline unsigned getVertexCount() const { return this->nrOfVertices; }
+	inline unsigned getIndexCount() const { return this->nrOfIndices; }
+
+	const AABB& getLocalBounds() const { return this->bounds; }
+
+	AABB getWorldBounds()
+	{
+		this->updateModelMatrix();
+		return this->bounds.transformed(this->ModelMatrix);
+	}
+
+	//Texture coordinate units per world unit across the surface, averaged by area.
+	//Rotation and translation don't change it, so it is only recomputed when the scale changes.
+	float getUVDensity()
+	{
+		if (this->uvDensity >= 0.f && this->uvDensityScale == this->scale)
+			return this->uvDensity;
+
+		float worldArea = 0.f;
+		float uvArea = 0.f;
+		size_t count = this->lods[0].indexCount > 0 ? this->lods[0].indexCount : this->nrOfVertices;
+		for (size_t i = 0; i + 2 < count; i += 3)
+		{
+			const Vertex& a = this->vertexArray[this->triangleIndex(i)];
+			const Vertex& b = this->vertexArray[this->triangleIndex(i + 1)];
+			const Vertex& c = this->vertexArray[this->triangleIndex(i + 2)];
+			worldArea += glm::length(glm::cross((b.position - a.position) * this->scale, (c.position - a.position) * this->scale));
+			glm::vec3 tb = b.texcoord - a.texcoord;
+			glm::vec3 tc = c.texcoord - a.texcoord;
+			uvArea += glm::abs(tb.x * tc.y - tb.y * tc.x);
+		}
+
+		this->uvDensity = worldArea > 0.f ? std::sqrt(uvArea / worldArea) : 0.f;
+		this->uvDensityScale = this->scale;
+		return this->uvDensity;
+	}
+
+	//Builds up to maxLods levels of detail, each with about reduction times the triangles of the one
+	//before, all drawing from the same vertex buffer. Stops early once simplification stalls.
+	void generateLods(int maxLods = 4, float reduction = 0.5f)
+	{
+		std::vector<Vertex> vertices(this->vertexArray, this->vertexArray + this->nrOfVertices);
+		std::vector<GLuint> base;
+		if (this->nrOfIndices > 0)
+			base = this->copyIndices(0, this->lods[0].indexCount);
+		else
+		{
+			//Unindexed meshes simplify as a triangle list; the simplifier welds their duplicate corners
+			base.resize(this->nrOfVertices / 3 * 3);
+			for (size_t i = 0; i < base.size(); i++)
+				base[i] = (GLuint)i;
+		}
+		std::vector<GLuint> all = base;
+		this->lods.assign(1, { 0, (unsigned)base.size(), 0.f });
+
+		float maxError = glm::length(this->bounds.extents()) * 0.5f;
+		size_t previous = base.size();
+		for (int level = 1; level < maxLods; level++)
+		{
+			size_t target = (size_t)(previous * reduction) / 3 * 3;
+			std::vector<GLuint> simplified;
+			float error = MeshSimplifier::simplify(vertices, base, target, maxError, simplified);
+			if (simplified.empty() || simplified.size() > previous * 9 / 10)
+				break;
+
+			MeshOptimizer::optimizeVertexCache(simplified, vertices.size());
+			this->lods.push_back({ (unsigned)all.size(), (unsigned)simplified.size(), error });
+			all.insert(all.end(), simplified.begin(), simplified.end());
+			previous = simplified.size();
+		}
+
+		this->setIndices(std::move(all));
+		this->currentLod = 0;
+	}
+
+	//Computes MikkTSpace style tangents from the normals and texture coordinates and binds them as
+	//attribute 3 (vec4, w is the bitangent sign) for normal mapped shading
+	void generateTangents()
+	{
+		std::vector<GLuint> indices;
+		if (this->nrOfIndices > 0)
+			indices = this->copyIndices(0, this->lods[0].indexCount);
+		else
+		{
+			indices.resize(this->nrOfVertices / 3 * 3);
+			for (size_t i = 0; i < indices.size(); i++)
+				indices[i] = (GLuint)i;
+		}
+		std::vector<glm::vec4> tangents;
+		MeshNormals::generateTangents(this->vertexArray, this->nrOfVertices, indices.data(), indices.size(), tangents);
+
+		glBindVertexArray(this->VAO);
+		if (this->tangentVBO == 0)
+			glGenBuffers(1, &this->tangentVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->tangentVBO);
+		glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec4), tangents.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (GLvoid*)0);
+		glEnableVertexAttribArray(3);
+		glBindVertexArray(0);
+	}
+
+	inline bool hasTangents() const { return this->tangentVBO != 0; }
+
+	//Attribute 4 (uint, one per instance) from buffer, which holds 0, 1, 2...; an indirect draw's base instance
+	//then reaches the shader as the instance's index (see HiZCuller)
+	void setInstanceIds(GLuint buffer)
+	{
+		if (buffer == this->instanceIdBuffer)
+			return;
+		this->instanceIdBuffer = buffer;
+		glBindVertexArray(this->VAO);
+		this->attachInstanceIds();
+		if (this->positionVAO != 0)
+		{
+			glBindVertexArray(this->positionVAO);
+			this->attachInstanceIds();
+		}
+		glBindVertexArray(0);
+	}
+
+	//Picks this instance's LOD: the coarsest one whose error projects to at most pixelError pixels
+	void updateLod(Camera& camera, float pixelError = 1.f)
+	{
+		if (this->lods.size() <= 1)
+			return;
+
+		float distance = this->getWorldBounds().distanceTo(camera.Position);
+		float maxScale = std::max(this->scale.x, std::max(this->scale.y, this->scale.z));
+		float pixelsPerUnit = distance > 0.f ? camera.getPixelsPerUnit() * maxScale / distance : FLT_MAX;
+		this->currentLod = this->pickLod(this->currentLod, pixelsPerUnit, pixelError);
+	}
+
+	//LOD to use after current when one object space unit covers pixelsPerUnit pixels
+	int pickLod(int current, float pixelsPerUnit, float pixelError) const
+	{
+		current = std::min(std::max(current, 0), (int)this->lods.size() - 1);
+		while (current > 0 && this->lods[current].error * pixelsPerUnit > pixelError)
+			current--;
+		while (current + 1 < (int)this->lods.size() && this->lods[current + 1].error * pixelsPerUnit <= pixelError * LOD_HYSTERESIS)
+			current++;
+		return current;
+	}
+
+	//Reorders the full detail LOD into meshlets for per cluster culling. Call after generateLods.
+	void buildMeshlets()
+	{
+		if (this->nrOfIndices == 0)
+			return;
+
+		std::vector<Vertex> vertices(this->vertexArray, this->vertexArray + this->nrOfVertices);
+		std::vector<GLuint> all = this->copyIndices(0, this->nrOfIndices);
+		std::vector<GLuint> indices(all.begin(), all.begin() + this->lods[0].indexCount);
+		this->meshlets = std::make_shared<MeshletSet>();
+		this->meshlets->build(vertices, indices);
+		std::copy(indices.begin(), indices.end(), all.begin());
+		this->setIndices(std::move(all));
+	}
+
+	//Culls meshlets against the camera for the next render. Only applies while the full detail LOD is drawn.
+	void cullMeshlets(Camera& camera)
+	{
+		this->drawCulled = false;
+		if (!this->meshlets || this->currentLod != 0)
+			return;
+
+		this->updateModelMatrix();
+		Frustum frustum(camera.Projection * camera.GetViewMatrix());
+		this->meshlets->cull(frustum, this->ModelMatrix, camera.Position, MeshIndexer::indexSize(this->indexType), this->drawCounts, this->drawOffsets);
+		this->drawCulled = true;
+	}
+
+	inline size_t getMeshletCount() const { return this->meshlets ? this->meshlets->size() : 0; }
+
+	//CPU copy of the geometry, for things like occluder rasterization; null for meshes that don't keep one
+	inline const Vertex* getVertices() const { return this->vertexArray; }
+
+	std::vector<GLuint> getLodIndices(int lod) const
+	{
+		if (this->nrOfIndices == 0)
+			return std::vector<GLuint>();
+		const MeshLod& range = this->lods[std::min(std::max(lod, 0), (int)this->lods.size() - 1)];
+		return this->copyIndices(range.indexOffset, range.indexOffset + range.indexCount);
+	}
+
+	inline int getLodCount() const { return (int)this->lods.size(); }
+	inline uint64_t getIndexRevision() const { return this->indexRevision; }
+	inline GLenum getIndexType() const { return this->indexType; }
 
-		delete[] this->vertexArray;
-		delete[] this->indexArray;
+	//Index range of a LOD, clamped to the ones that exist
+	const MeshLod& getLodRange(int lod) const
+	{
+		return this->lods[std::min(std::max(lod, 0), (int)this->lods.size() - 1)];
+	}
+	inline int getCurrentLod() const { return this->currentLod; }
+
+	//Follows node's world transform from now on; position, rotation and scale become local to it.
+	//The graph has to outlive the mesh or be detached with attach(nullptr, SCENE_ROOT).
+	void attach(const SceneGraph* graph, SceneNode node)
+	{
+		this->sceneGraph = graph;
+		this->sceneNode = node;
 	}
 
 	void setPosition(const glm::vec3 position)
@@ -221,8 +848,49 @@ public:
 		glBindVertexArray(this->VAO);
 	}
 
+	//Binds the position only VAO, making it on first use; meshes without a CPU copy of their vertices use the full one
+	void bindDepthVAO()
+	{
+		if (this->positionVAO == 0 && this->vertexArray && this->nrOfVertices > 0)
+			this->initPositionStream();
+		glBindVertexArray(this->positionVAO != 0 ? this->positionVAO : this->VAO);
+	}
+
+	//Draws with a transform and LOD from outside, for objects sharing this mesh (see EntityStore).
+	//With a camera the full detail LOD is meshlet culled for that transform.
+	void draw(Shader* shader, const glm::mat4& model, int lod, Camera* camera = nullptr)
+	{
+		if (!this->isUploaded())
+			return;
+
+		shader->use();
+		shader->setMat4("model", model);
+		glBindVertexArray(this->VAO);
+		this->drawLod(model, lod, camera);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
+	//Same triangles as draw, from the position only stream, for a depth pre-pass with a position only shader (Depth.vs).
+	//Meshlet culling matches draw's, so a GL_EQUAL pass after it finds every depth it needs.
+	void drawDepth(Shader* shader, const glm::mat4& model, int lod, Camera* camera = nullptr)
+	{
+		if (!this->isUploaded())
+			return;
+
+		shader->use();
+		shader->setMat4("model", model);
+		this->bindDepthVAO();
+		this->drawLod(model, lod, camera);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+
 	void render(Shader* shader)
 	{
+		if (!this->isUploaded())
+			return;
+
 		shader->use();
 		//Update uniforms
 		this->updateModelMatrix();
@@ -237,8 +905,17 @@ public:
 		//RENDER
 		if (this->nrOfIndices == 0)
 			glDrawArrays(GL_TRIANGLES, 0, this->nrOfVertices);
+		else if (this->drawCulled)
+		{
+			if (!this->drawCounts.empty())
+				glMultiDrawElements(GL_TRIANGLES, this->drawCounts.data(), this->indexType, this->drawOffsets.data(), (GLsizei)this->drawCounts.size());
+			this->drawCulled = false;
+		}
 		else
-			glDrawElements(GL_TRIANGLES, this->nrOfIndices, GL_UNSIGNED_INT, 0);
+		{
+			const MeshLod& lod = this->lods[this->currentLod];
+			glDrawElements(GL_TRIANGLES, lod.indexCount, this->indexType, (GLvoid*)(lod.indexOffset * MeshIndexer::indexSize(this->indexType)));
+		}
 
 		//Cleanup
 		glBindVertexArray(0);
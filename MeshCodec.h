@@ -0,0 +1,377 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+#include "Bounds.h"
+#include "Meshlet.h"
+#include "MeshFile.h"
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Compressed mesh encoding for distribution: quantised attributes and delta coded streams ///////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Vertex attributes are split into planes of 16 bit values, decoded independently
+enum MeshCodecPlane
+{
+	PLANE_POSITION_X,
+	PLANE_POSITION_Y,
+	PLANE_POSITION_Z,
+	PLANE_NORMAL_X,
+	PLANE_NORMAL_Y,
+	PLANE_TEXCOORD_U,
+	PLANE_TEXCOORD_V,
+	PLANE_COUNT
+};
+
+//Layout: header, LOD table, meshlet table, then the vertex planes and the index stream
+struct MeshCodecHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	//value = min + quantised * scale
+	float positionMin[3];
+	float positionScale[3];
+	float texcoordMin[2];
+	float texcoordScale[2];
+	uint64_t lodOffset;
+	uint64_t meshletOffset;
+	//Start of each plane, then of the index stream, then the end of the data
+	uint64_t streamOffset[PLANE_COUNT + 2];
+};
+
+class MeshCodec
+{
+private:
+	static const uint32_t MAGIC = 0x5A48534D; // "MSHZ"
+	static const uint32_t VERSION = 1;
+	static const size_t MIN_VERTICES_PER_WORKER = 16384;
+
+	static inline uint32_t zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+	static inline int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+	static void writeVarint(std::vector<unsigned char>& out, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((unsigned char)value);
+	}
+
+	//False if the value runs past end or is longer than 5 bytes
+	static inline bool readVarint(const unsigned char*& p, const unsigned char* end, uint32_t& value)
+	{
+		//Small deltas dominate, so the one byte case is kept branch light
+		if (p < end && *p < 0x80)
+		{
+			value = *p++;
+			return true;
+		}
+		value = 0;
+		for (int shift = 0; shift < 35 && p < end; shift += 7)
+		{
+			unsigned char byte = *p++;
+			value |= (uint32_t)(byte & 0x7F) << shift;
+			if (byte < 0x80)
+				return true;
+		}
+		return false;
+	}
+
+	static inline uint16_t quantize(float value, float min, float scale)
+	{
+		float q = scale > 0.f ? (value - min) / scale : 0.f;
+		return (uint16_t)std::min(std::max(q + 0.5f, 0.f), 65535.f);
+	}
+
+	//Octahedral mapping of a unit vector to [-1, 1]^2, as signed 16 bit
+	static void encodeOctahedral(const glm::vec3& n, int16_t& x, int16_t& y)
+	{
+		float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		float ox = sum > 0.f ? n.x / sum : 0.f;
+		float oy = sum > 0.f ? n.y / sum : 0.f;
+		if (n.z < 0.f)
+		{
+			float fx = (1.f - std::abs(oy)) * (ox >= 0.f ? 1.f : -1.f);
+			float fy = (1.f - std::abs(ox)) * (oy >= 0.f ? 1.f : -1.f);
+			ox = fx;
+			oy = fy;
+		}
+		x = (int16_t)std::lround(std::min(std::max(ox, -1.f), 1.f) * 32767.f);
+		y = (int16_t)std::lround(std::min(std::max(oy, -1.f), 1.f) * 32767.f);
+	}
+
+	//Wrapping delta against the previous vertex, zigzagged so small steps either way stay small
+	static void encodePlane(const std::vector<uint16_t>& values, std::vector<unsigned char>& out)
+	{
+		uint16_t previous = 0;
+		for (uint16_t value : values)
+		{
+			writeVarint(out, zigzag((int16_t)(uint16_t)(value - previous)));
+			previous = value;
+		}
+	}
+
+	static bool decodePlane(const unsigned char* p, const unsigned char* end, uint16_t* values, size_t count)
+	{
+		uint16_t previous = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t code;
+			if (!readVarint(p, end, code))
+				return false;
+			previous = (uint16_t)(previous + unzigzag(code));
+			values[i] = previous;
+		}
+		return true;
+	}
+
+	static inline __m128 loadUnsigned(const uint16_t* values)
+	{
+		__m128i packed = _mm_loadl_epi64((const __m128i*)values);
+		return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+	}
+
+	static inline __m128 loadSigned(const uint16_t* values)
+	{
+		__m128i packed = _mm_loadl_epi64((const __m128i*)values);
+		return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), packed), 16));
+	}
+
+	//Dequantises vertices [begin, end) from the planes, 4 at a time. Planes are padded to a multiple of 4.
+	static void assemble(const MeshCodecHeader& header, const std::vector<uint16_t>* planes, Vertex* vertices, size_t begin, size_t end)
+	{
+		__m128 pMinX = _mm_set1_ps(header.positionMin[0]), pMinY = _mm_set1_ps(header.positionMin[1]), pMinZ = _mm_set1_ps(header.positionMin[2]);
+		__m128 pScaleX = _mm_set1_ps(header.positionScale[0]), pScaleY = _mm_set1_ps(header.positionScale[1]), pScaleZ = _mm_set1_ps(header.positionScale[2]);
+		__m128 tMinU = _mm_set1_ps(header.texcoordMin[0]), tMinV = _mm_set1_ps(header.texcoordMin[1]);
+		__m128 tScaleU = _mm_set1_ps(header.texcoordScale[0]), tScaleV = _mm_set1_ps(header.texcoordScale[1]);
+		__m128 snorm = _mm_set1_ps(1.f / 32767.f);
+		__m128 one = _mm_set1_ps(1.f);
+		__m128 signBit = _mm_set1_ps(-0.f);
+
+		float px[4], py[4], pz[4], nx[4], ny[4], nz[4], u[4], v[4];
+		for (size_t i = begin; i < end; i += 4)
+		{
+			_mm_storeu_ps(px, _mm_add_ps(pMinX, _mm_mul_ps(loadUnsigned(&planes[PLANE_POSITION_X][i]), pScaleX)));
+			_mm_storeu_ps(py, _mm_add_ps(pMinY, _mm_mul_ps(loadUnsigned(&planes[PLANE_POSITION_Y][i]), pScaleY)));
+			_mm_storeu_ps(pz, _mm_add_ps(pMinZ, _mm_mul_ps(loadUnsigned(&planes[PLANE_POSITION_Z][i]), pScaleZ)));
+			_mm_storeu_ps(u, _mm_add_ps(tMinU, _mm_mul_ps(loadUnsigned(&planes[PLANE_TEXCOORD_U][i]), tScaleU)));
+			_mm_storeu_ps(v, _mm_add_ps(tMinV, _mm_mul_ps(loadUnsigned(&planes[PLANE_TEXCOORD_V][i]), tScaleV)));
+
+			//z = 1 - |x| - |y|; where z < 0 the lower hemisphere was folded over, so unfold by
+			//moving x and y towards zero by -z
+			__m128 ox = _mm_mul_ps(loadSigned(&planes[PLANE_NORMAL_X][i]), snorm);
+			__m128 oy = _mm_mul_ps(loadSigned(&planes[PLANE_NORMAL_Y][i]), snorm);
+			__m128 oz = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, ox)), _mm_andnot_ps(signBit, oy));
+			__m128 fold = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), oz), _mm_setzero_ps());
+			ox = _mm_sub_ps(ox, _mm_or_ps(fold, _mm_and_ps(ox, signBit)));
+			oy = _mm_sub_ps(oy, _mm_or_ps(fold, _mm_and_ps(oy, signBit)));
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz)));
+			__m128 inverse = _mm_div_ps(one, length);
+			_mm_storeu_ps(nx, _mm_mul_ps(ox, inverse));
+			_mm_storeu_ps(ny, _mm_mul_ps(oy, inverse));
+			_mm_storeu_ps(nz, _mm_mul_ps(oz, inverse));
+
+			size_t count = std::min<size_t>(4, end - i);
+			for (size_t k = 0; k < count; k++)
+			{
+				Vertex& out = vertices[i + k];
+				out.position = glm::vec3(px[k], py[k], pz[k]);
+				out.normal = glm::vec3(nx[k], ny[k], nz[k]);
+				out.texcoord = glm::vec3(u[k], v[k], 0.f);
+			}
+		}
+	}
+
+public:
+	inline static const char* extension() { return ".meshz"; }
+
+	static bool isEncoded(const char* data, size_t size)
+	{
+		return size >= sizeof(MeshCodecHeader) && ((const MeshCodecHeader*)data)->magic == MAGIC;
+	}
+
+	//Positions and texture coordinates are quantised to 16 bits over their range, normals to 16 bit
+	//octahedral. Vertex order and index order are kept exactly, so LOD ranges and meshlets stay valid;
+	//run the mesh through MeshOptimizer first, since fetch and cache ordered data delta codes best.
+	static void encode(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+		const std::vector<MeshLod>& lods, const std::vector<Meshlet>& meshlets, std::vector<unsigned char>& out)
+	{
+		MeshCodecHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.vertexCount = (uint32_t)vertexCount;
+		header.indexCount = (uint32_t)indexCount;
+		header.lodCount = (uint32_t)lods.size();
+		header.meshletCount = (uint32_t)meshlets.size();
+
+		AABB bounds;
+		glm::vec2 uvMin(0.f), uvMax(0.f);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			bounds.expand(vertices[i].position);
+			glm::vec2 uv(vertices[i].texcoord.x, vertices[i].texcoord.y);
+			uvMin = i == 0 ? uv : glm::min(uvMin, uv);
+			uvMax = i == 0 ? uv : glm::max(uvMax, uv);
+		}
+		for (int a = 0; a < 3; a++)
+		{
+			header.positionMin[a] = vertexCount > 0 ? bounds.min[a] : 0.f;
+			header.positionScale[a] = vertexCount > 0 ? (bounds.max[a] - bounds.min[a]) / 65535.f : 0.f;
+		}
+		for (int a = 0; a < 2; a++)
+		{
+			header.texcoordMin[a] = uvMin[a];
+			header.texcoordScale[a] = (uvMax[a] - uvMin[a]) / 65535.f;
+		}
+
+		std::vector<uint16_t> planes[PLANE_COUNT];
+		for (int p = 0; p < PLANE_COUNT; p++)
+			planes[p].resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			const Vertex& v = vertices[i];
+			for (int a = 0; a < 3; a++)
+				planes[PLANE_POSITION_X + a][i] = quantize(v.position[a], header.positionMin[a], header.positionScale[a]);
+			int16_t ox, oy;
+			encodeOctahedral(v.normal, ox, oy);
+			planes[PLANE_NORMAL_X][i] = (uint16_t)ox;
+			planes[PLANE_NORMAL_Y][i] = (uint16_t)oy;
+			planes[PLANE_TEXCOORD_U][i] = quantize(v.texcoord.x, header.texcoordMin[0], header.texcoordScale[0]);
+			planes[PLANE_TEXCOORD_V][i] = quantize(v.texcoord.y, header.texcoordMin[1], header.texcoordScale[1]);
+		}
+
+		out.assign(sizeof(MeshCodecHeader), 0);
+		header.lodOffset = out.size();
+		out.insert(out.end(), (const unsigned char*)lods.data(), (const unsigned char*)(lods.data() + lods.size()));
+		header.meshletOffset = out.size();
+		out.insert(out.end(), (const unsigned char*)meshlets.data(), (const unsigned char*)(meshlets.data() + meshlets.size()));
+		for (int p = 0; p < PLANE_COUNT; p++)
+		{
+			header.streamOffset[p] = out.size();
+			encodePlane(planes[p], out);
+		}
+
+		//Each index against the one before it; cache ordered triangles reuse recent vertices,
+		//so most deltas fit in a byte
+		header.streamOffset[PLANE_COUNT] = out.size();
+		GLuint previous = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			writeVarint(out, zigzag((int32_t)(indices[i] - previous)));
+			previous = indices[i];
+		}
+		header.streamOffset[PLANE_COUNT + 1] = out.size();
+		std::memcpy(out.data(), &header, sizeof(header));
+	}
+
+	//Decodes planes and indices in parallel, then dequantises with SSE.
+	//Returns false for truncated or inconsistent data.
+	static bool decode(const char* data, size_t size, std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+		std::vector<MeshLod>& lods, std::vector<Meshlet>& meshlets)
+	{
+		if (!isEncoded(data, size))
+			return false;
+		MeshCodecHeader header;
+		std::memcpy(&header, data, sizeof(header));
+		if (header.version != VERSION ||
+			header.lodOffset + (uint64_t)header.lodCount * sizeof(MeshLod) > size ||
+			header.meshletOffset + (uint64_t)header.meshletCount * sizeof(Meshlet) > size ||
+			header.streamOffset[PLANE_COUNT + 1] > size)
+			return false;
+		for (int s = 0; s < PLANE_COUNT + 1; s++)
+		{
+			if (header.streamOffset[s] > header.streamOffset[s + 1])
+				return false;
+		}
+
+		const unsigned char* bytes = (const unsigned char*)data;
+		lods.resize(header.lodCount);
+		std::memcpy(lods.data(), bytes + header.lodOffset, header.lodCount * sizeof(MeshLod));
+		meshlets.resize(header.meshletCount);
+		std::memcpy(meshlets.data(), bytes + header.meshletOffset, header.meshletCount * sizeof(Meshlet));
+
+		size_t vertexCount = header.vertexCount;
+		size_t padded = (vertexCount + 3) & ~(size_t)3;
+		std::vector<uint16_t> planes[PLANE_COUNT];
+		for (int p = 0; p < PLANE_COUNT; p++)
+			planes[p].assign(padded, 0);
+		indices.resize(header.indexCount);
+
+		//One stream per task: the seven planes and the indices
+		bool valid[PLANE_COUNT + 1];
+		Parallel::parallelFor(PLANE_COUNT + 1, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t s = begin; s < end; s++)
+			{
+				const unsigned char* p = bytes + header.streamOffset[s];
+				const unsigned char* streamEnd = bytes + header.streamOffset[s + 1];
+				if (s < PLANE_COUNT)
+				{
+					valid[s] = decodePlane(p, streamEnd, planes[s].data(), vertexCount);
+					continue;
+				}
+				valid[s] = true;
+				GLuint previous = 0;
+				for (size_t i = 0; i < indices.size() && valid[s]; i++)
+				{
+					uint32_t code;
+					valid[s] = readVarint(p, streamEnd, code);
+					previous = (GLuint)(previous + unzigzag(code));
+					indices[i] = previous;
+					valid[s] = valid[s] && previous < vertexCount;
+				}
+			}
+		});
+		for (int s = 0; s < PLANE_COUNT + 1; s++)
+		{
+			if (!valid[s])
+				return false;
+		}
+		for (const MeshLod& lod : lods)
+		{
+			if ((uint64_t)lod.indexOffset + lod.indexCount > header.indexCount)
+				return false;
+		}
+
+		vertices.resize(vertexCount);
+		Parallel::parallelFor(padded / 4, MIN_VERTICES_PER_WORKER / 4, [&](size_t, size_t begin, size_t end)
+		{
+			assemble(header, planes, vertices.data(), begin * 4, std::min(end * 4, vertexCount));
+		});
+		return true;
+	}
+
+	static bool write(const char* fileName, const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+		const std::vector<MeshLod>& lods, const std::vector<Meshlet>& meshlets)
+	{
+		std::vector<unsigned char> encoded;
+		encode(vertices, vertexCount, indices, indexCount, lods, meshlets, encoded);
+		std::ofstream file(fileName, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Failed to write compressed mesh: " << fileName << std::endl;
+			return false;
+		}
+		file.write((const char*)encoded.data(), (std::streamsize)encoded.size());
+		return (bool)file;
+	}
+};
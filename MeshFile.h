@@ -0,0 +1,177 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "glad/glad.h"
+
+#include "Vertex.h"
+#include "Bounds.h"
+#include "MappedFile.h"
+#include "Meshlet.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Cooked mesh files: vertex and index data in the layout Mesh uploads, page aligned for mapping /////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//A range of the index buffer drawing the mesh at one level of detail
+struct MeshLod
+{
+	unsigned indexOffset;
+	unsigned indexCount;
+	//Largest distance the surface moved from full detail, in object space units
+	float error;
+};
+
+struct MeshFileAttribute
+{
+	uint32_t location;
+	uint32_t components;
+	uint32_t type;
+	uint32_t offset;
+};
+
+//Layout: header, LOD table, meshlet table, then vertices and indices each starting on a page
+struct MeshFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexStride;
+	uint32_t attributeCount;
+	MeshFileAttribute attributes[4];
+	//GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as uploaded
+	uint32_t indexType;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	uint32_t lodStride;
+	uint32_t meshletStride;
+	uint32_t reserved;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint64_t lodOffset;
+	uint64_t meshletOffset;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+class MeshFile
+{
+private:
+	static const uint32_t MAGIC = 0x3148534D; // "MSH1"
+	static const uint32_t VERSION = 1;
+	static const uint64_t PAGE = 4096;
+
+	static uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	static void writePadding(std::ofstream& file, uint64_t from, uint64_t to)
+	{
+		static const char zeros[PAGE] = {};
+		if (to > from)
+			file.write(zeros, (std::streamsize)(to - from));
+	}
+
+public:
+	//What Mesh::initVAO sets up, recorded so files from a different vertex layout are rejected
+	static void vertexFormat(MeshFileHeader& header)
+	{
+		header.vertexStride = sizeof(Vertex);
+		header.attributeCount = 3;
+		header.attributes[0] = { 0, 3, GL_FLOAT, (uint32_t)offsetof(Vertex, position) };
+		header.attributes[1] = { 1, 3, GL_FLOAT, (uint32_t)offsetof(Vertex, normal) };
+		header.attributes[2] = { 2, 2, GL_FLOAT, (uint32_t)offsetof(Vertex, texcoord) };
+		header.attributes[3] = { 0, 0, 0, 0 };
+	}
+
+	inline static const char* extension() { return ".mesh"; }
+
+	//indices are vertexCount sized in indexType already, so they are written as they are uploaded
+	static bool write(const char* fileName, const Vertex* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount, GLenum indexType,
+		const AABB& bounds, const std::vector<MeshLod>& lods, const std::vector<Meshlet>& meshlets)
+	{
+		std::ofstream file(fileName, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Failed to write cooked mesh: " << fileName << std::endl;
+			return false;
+		}
+
+		MeshFileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.magic = MAGIC;
+		header.version = VERSION;
+		vertexFormat(header);
+		header.indexType = indexType;
+		header.vertexCount = vertexCount;
+		header.indexCount = indexCount;
+		header.lodCount = (uint32_t)lods.size();
+		header.meshletCount = (uint32_t)meshlets.size();
+		header.lodStride = sizeof(MeshLod);
+		header.meshletStride = sizeof(Meshlet);
+		header.boundsMin[0] = bounds.min.x; header.boundsMin[1] = bounds.min.y; header.boundsMin[2] = bounds.min.z;
+		header.boundsMax[0] = bounds.max.x; header.boundsMax[1] = bounds.max.y; header.boundsMax[2] = bounds.max.z;
+
+		size_t indexBytes = (size_t)indexCount * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		header.lodOffset = alignUp(sizeof(MeshFileHeader), 16);
+		header.meshletOffset = alignUp(header.lodOffset + sizeof(MeshLod) * lods.size(), 16);
+		header.vertexOffset = alignUp(header.meshletOffset + sizeof(Meshlet) * meshlets.size(), PAGE);
+		header.indexOffset = alignUp(header.vertexOffset + sizeof(Vertex) * (uint64_t)vertexCount, PAGE);
+
+		file.write((const char*)&header, sizeof(header));
+		writePadding(file, sizeof(header), header.lodOffset);
+		file.write((const char*)lods.data(), sizeof(MeshLod) * lods.size());
+		writePadding(file, header.lodOffset + sizeof(MeshLod) * lods.size(), header.meshletOffset);
+		file.write((const char*)meshlets.data(), sizeof(Meshlet) * meshlets.size());
+		writePadding(file, header.meshletOffset + sizeof(Meshlet) * meshlets.size(), header.vertexOffset);
+		file.write((const char*)vertices, sizeof(Vertex) * (size_t)vertexCount);
+		writePadding(file, header.vertexOffset + sizeof(Vertex) * (uint64_t)vertexCount, header.indexOffset);
+		file.write((const char*)indices, indexBytes);
+		return (bool)file;
+	}
+
+	//Header of a mapped cooked file, or nullptr if it is not one this build can use as it is
+	static const MeshFileHeader* validate(const MappedFile& file)
+	{
+		if (!file.isOpen() || file.getSize() < sizeof(MeshFileHeader))
+			return nullptr;
+		const MeshFileHeader* header = (const MeshFileHeader*)file.getData();
+		MeshFileHeader expected;
+		std::memset(&expected, 0, sizeof(expected));
+		vertexFormat(expected);
+		if (header->magic != MAGIC || header->version != VERSION || header->vertexStride != expected.vertexStride ||
+			header->attributeCount != expected.attributeCount ||
+			std::memcmp(header->attributes, expected.attributes, sizeof(expected.attributes)) != 0 ||
+			header->lodStride != sizeof(MeshLod) || header->meshletStride != sizeof(Meshlet) ||
+			(header->indexType != GL_UNSIGNED_SHORT && header->indexType != GL_UNSIGNED_INT) || header->lodCount == 0)
+			return nullptr;
+
+		size_t indexSize = header->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		if (header->lodOffset + (uint64_t)header->lodCount * sizeof(MeshLod) > file.getSize() ||
+			header->meshletOffset + (uint64_t)header->meshletCount * sizeof(Meshlet) > file.getSize() ||
+			header->vertexOffset + (uint64_t)header->vertexCount * sizeof(Vertex) > file.getSize() ||
+			header->indexOffset + (uint64_t)header->indexCount * indexSize > file.getSize())
+			return nullptr;
+
+		const MeshLod* lods = (const MeshLod*)(file.getData() + header->lodOffset);
+		for (uint32_t i = 0; i < header->lodCount; i++)
+		{
+			if ((uint64_t)lods[i].indexOffset + lods[i].indexCount > header->indexCount)
+				return nullptr;
+		}
+		return header;
+	}
+
+	//Views into a validated file, valid while it stays mapped
+	static const MeshLod* lods(const MappedFile& file, const MeshFileHeader& header) { return (const MeshLod*)(file.getData() + header.lodOffset); }
+	static const Meshlet* meshlets(const MappedFile& file, const MeshFileHeader& header) { return (const Meshlet*)(file.getData() + header.meshletOffset); }
+	static const Vertex* vertices(const MappedFile& file, const MeshFileHeader& header) { return (const Vertex*)(file.getData() + header.vertexOffset); }
+	static const void* indices(const MappedFile& file, const MeshFileHeader& header) { return file.getData() + header.indexOffset; }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "glad/glad.h"
+#include "Vertex.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Welds identical vertices of a triangle list and builds the index buffer that draws it ////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class MeshIndexer
+{
+private:
+	//Only the attributes Mesh uploads take part: position, normal and the two used texcoord components
+	static const int KEY_FLOATS = 8;
+
+	static void packKey(const Vertex& v, float key[KEY_FLOATS])
+	{
+		key[0] = v.position.x; key[1] = v.position.y; key[2] = v.position.z;
+		key[3] = v.normal.x; key[4] = v.normal.y; key[5] = v.normal.z;
+		key[6] = v.texcoord.x; key[7] = v.texcoord.y;
+	}
+
+	//FNV-1a over the packed attribute bits
+	static uint32_t hashKey(const float key[KEY_FLOATS])
+	{
+		uint32_t bits[KEY_FLOATS];
+		std::memcpy(bits, key, sizeof(bits));
+		uint32_t hash = 2166136261u;
+		for (int i = 0; i < KEY_FLOATS; i++)
+		{
+			hash ^= bits[i];
+			hash *= 16777619u;
+		}
+		return hash ^ (hash >> 15);
+	}
+
+public:
+	//Smallest index type that can address vertexCount vertices
+	static GLenum indexType(size_t vertexCount)
+	{
+		return vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	}
+
+	static size_t indexSize(GLenum type)
+	{
+		return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	}
+
+	//Welds vertices whose uploaded attributes are bit-identical. With indices NULL the input is
+	//read as a plain triangle list; otherwise the given index buffer is remapped.
+	static void weld(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+		std::vector<Vertex>& outVertices, std::vector<GLuint>& outIndices)
+	{
+		size_t count = indices ? indexCount : vertexCount;
+		outVertices.clear();
+		outVertices.reserve(vertexCount);
+		outIndices.resize(count);
+
+		//Open addressing table of indices into outVertices, kept at most half full
+		size_t capacity = 16;
+		while (capacity < vertexCount * 2)
+			capacity *= 2;
+		std::vector<GLuint> table(capacity, UINT32_MAX);
+		std::vector<GLuint> remap(vertexCount, UINT32_MAX);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			GLuint src = indices ? indices[i] : (GLuint)i;
+			if (remap[src] == UINT32_MAX)
+			{
+				float key[KEY_FLOATS];
+				packKey(vertices[src], key);
+				size_t slot = hashKey(key) & (capacity - 1);
+				while (true)
+				{
+					GLuint existing = table[slot];
+					if (existing == UINT32_MAX)
+					{
+						table[slot] = (GLuint)outVertices.size();
+						remap[src] = (GLuint)outVertices.size();
+						outVertices.push_back(vertices[src]);
+						break;
+					}
+					float other[KEY_FLOATS];
+					packKey(outVertices[existing], other);
+					if (std::memcmp(key, other, sizeof(key)) == 0)
+					{
+						remap[src] = existing;
+						break;
+					}
+					slot = (slot + 1) & (capacity - 1);
+				}
+			}
+			outIndices[i] = remap[src];
+		}
+	}
+
+	static void weld(const std::vector<Vertex>& vertices, std::vector<Vertex>& outVertices, std::vector<GLuint>& outIndices)
+	{
+		weld(vertices.data(), vertices.size(), NULL, 0, outVertices, outIndices);
+	}
+};
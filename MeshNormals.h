@@ -0,0 +1,297 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Smooth vertex normals and MikkTSpace style tangents for indexed triangle lists ////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class MeshNormals
+{
+private:
+	static const size_t MIN_TRIANGLES_PER_WORKER = 16384;
+
+	//Four triangles at a time in structure of arrays form
+	struct Batch
+	{
+		//Unnormalised face normals, length twice the area
+		float nx[4], ny[4], nz[4];
+		//Cosine of the angle at corners a, b and c
+		float cosA[4], cosB[4], cosC[4];
+		//Texture space directions, valid where uv[k] is set
+		float sx[4], sy[4], sz[4];
+		float tx[4], ty[4], tz[4];
+		bool uv[4];
+	};
+
+	static inline __m128 gather(const Vertex* vertices, const GLuint* corner, const size_t* triangles, int axis, bool texcoord)
+	{
+		float v[4];
+		for (int k = 0; k < 4; k++)
+		{
+			const Vertex& vertex = vertices[corner[triangles[k] * 3]];
+			v[k] = texcoord ? vertex.texcoord[axis] : vertex.position[axis];
+		}
+		return _mm_loadu_ps(v);
+	}
+
+	static inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+
+	//cos of the angle between two edges, 1 (no weight) for degenerate ones
+	static inline __m128 cosine(__m128 d, __m128 lengthSqA, __m128 lengthSqB)
+	{
+		__m128 product = _mm_mul_ps(lengthSqA, lengthSqB);
+		__m128 valid = _mm_cmpgt_ps(product, _mm_set1_ps(1e-30f));
+		__m128 c = _mm_div_ps(d, _mm_sqrt_ps(_mm_max_ps(product, _mm_set1_ps(1e-30f))));
+		return _mm_or_ps(_mm_and_ps(valid, c), _mm_andnot_ps(valid, _mm_set1_ps(1.f)));
+	}
+
+	//Cross products, corner angles and (optionally) uv derivatives of up to 4 triangles.
+	//Short batches repeat the last triangle; callers only use the first count lanes.
+	static void computeBatch(const Vertex* vertices, const GLuint* indices, size_t first, size_t count, bool tangents, Batch& b)
+	{
+		size_t triangles[4];
+		for (int k = 0; k < 4; k++)
+			triangles[k] = first + std::min<size_t>(k, count - 1);
+
+		__m128 ax = gather(vertices, indices, triangles, 0, false), ay = gather(vertices, indices, triangles, 1, false), az = gather(vertices, indices, triangles, 2, false);
+		__m128 bx = gather(vertices, indices + 1, triangles, 0, false), by = gather(vertices, indices + 1, triangles, 1, false), bz = gather(vertices, indices + 1, triangles, 2, false);
+		__m128 cx = gather(vertices, indices + 2, triangles, 0, false), cy = gather(vertices, indices + 2, triangles, 1, false), cz = gather(vertices, indices + 2, triangles, 2, false);
+
+		//e1 = b - a, e2 = c - a, e3 = c - b
+		__m128 e1x = _mm_sub_ps(bx, ax), e1y = _mm_sub_ps(by, ay), e1z = _mm_sub_ps(bz, az);
+		__m128 e2x = _mm_sub_ps(cx, ax), e2y = _mm_sub_ps(cy, ay), e2z = _mm_sub_ps(cz, az);
+		__m128 e3x = _mm_sub_ps(cx, bx), e3y = _mm_sub_ps(cy, by), e3z = _mm_sub_ps(cz, bz);
+
+		_mm_storeu_ps(b.nx, _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y)));
+		_mm_storeu_ps(b.ny, _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z)));
+		_mm_storeu_ps(b.nz, _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x)));
+
+		__m128 l1 = dot(e1x, e1y, e1z, e1x, e1y, e1z);
+		__m128 l2 = dot(e2x, e2y, e2z, e2x, e2y, e2z);
+		__m128 l3 = dot(e3x, e3y, e3z, e3x, e3y, e3z);
+		__m128 d12 = dot(e1x, e1y, e1z, e2x, e2y, e2z);
+		__m128 d13 = dot(e1x, e1y, e1z, e3x, e3y, e3z);
+		__m128 d23 = dot(e2x, e2y, e2z, e3x, e3y, e3z);
+		//At a between b - a and c - a; at b between a - b and c - b; at c between a - c and b - c
+		_mm_storeu_ps(b.cosA, cosine(d12, l1, l2));
+		_mm_storeu_ps(b.cosB, cosine(_mm_sub_ps(_mm_setzero_ps(), d13), l1, l3));
+		_mm_storeu_ps(b.cosC, cosine(d23, l2, l3));
+
+		if (!tangents)
+			return;
+
+		__m128 au = gather(vertices, indices, triangles, 0, true), av = gather(vertices, indices, triangles, 1, true);
+		__m128 du1 = _mm_sub_ps(gather(vertices, indices + 1, triangles, 0, true), au);
+		__m128 dv1 = _mm_sub_ps(gather(vertices, indices + 1, triangles, 1, true), av);
+		__m128 du2 = _mm_sub_ps(gather(vertices, indices + 2, triangles, 0, true), au);
+		__m128 dv2 = _mm_sub_ps(gather(vertices, indices + 2, triangles, 1, true), av);
+
+		//s = (e1 dv2 - e2 dv1) / det, t = (e2 du1 - e1 du2) / det. Only the directions are used
+		//later, but the sign of det decides the handedness so it is kept.
+		__m128 det = _mm_sub_ps(_mm_mul_ps(du1, dv2), _mm_mul_ps(du2, dv1));
+		__m128 sign = _mm_or_ps(_mm_and_ps(det, _mm_set1_ps(-0.f)), _mm_set1_ps(1.f));
+		int valid = _mm_movemask_ps(_mm_cmpgt_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), det), _mm_set1_ps(1e-20f)));
+		_mm_storeu_ps(b.sx, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e1x, dv2), _mm_mul_ps(e2x, dv1))));
+		_mm_storeu_ps(b.sy, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e1y, dv2), _mm_mul_ps(e2y, dv1))));
+		_mm_storeu_ps(b.sz, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e1z, dv2), _mm_mul_ps(e2z, dv1))));
+		_mm_storeu_ps(b.tx, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e2x, du1), _mm_mul_ps(e1x, du2))));
+		_mm_storeu_ps(b.ty, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e2y, du1), _mm_mul_ps(e1y, du2))));
+		_mm_storeu_ps(b.tz, _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(e2z, du1), _mm_mul_ps(e1z, du2))));
+		for (int k = 0; k < 4; k++)
+			b.uv[k] = (valid & (1 << k)) != 0;
+	}
+
+	static inline float angle(float cosine)
+	{
+		return std::acos(std::min(std::max(cosine, -1.f), 1.f));
+	}
+
+	//Runs fn(triangleBegin, triangleEnd, partial, firstVertex) over worker ranges, each adding into its own
+	//partial array covering only the vertices its triangles use, then sums the partials in worker order
+	//so results don't depend on timing. No atomics: workers never write to shared memory.
+	template <typename T, typename Fn>
+	static void accumulate(size_t vertexCount, const GLuint* indices, size_t triangleCount, std::vector<T>& result, Fn fn)
+	{
+		size_t workers = Parallel::workerCount(triangleCount, MIN_TRIANGLES_PER_WORKER);
+		std::vector<std::vector<T>> partials(workers);
+		std::vector<size_t> first(workers, 0);
+
+		Parallel::parallelFor(triangleCount, MIN_TRIANGLES_PER_WORKER, [&](size_t worker, size_t begin, size_t end)
+		{
+			if (begin >= end)
+				return;
+			GLuint low = indices[begin * 3], high = low;
+			for (size_t i = begin * 3; i < end * 3; i++)
+			{
+				low = std::min(low, indices[i]);
+				high = std::max(high, indices[i]);
+			}
+			first[worker] = low;
+			partials[worker].assign(high - low + 1, T());
+			fn(begin, end, partials[worker].data(), (size_t)low);
+		});
+
+		result.assign(vertexCount, T());
+		Parallel::parallelFor(vertexCount, MIN_TRIANGLES_PER_WORKER, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t w = 0; w < workers; w++)
+			{
+				size_t from = std::max(begin, first[w]);
+				size_t to = std::min(end, first[w] + partials[w].size());
+				for (size_t v = from; v < to; v++)
+					result[v] += partials[w][v - first[w]];
+			}
+		});
+	}
+
+	struct TangentSum
+	{
+		glm::vec3 s;
+		glm::vec3 t;
+
+		TangentSum() : s(0.f), t(0.f) {}
+		TangentSum& operator+=(const TangentSum& other)
+		{
+			this->s += other.s;
+			this->t += other.t;
+			return *this;
+		}
+	};
+
+	//Any unit vector perpendicular to n, for vertices without usable texture coordinates
+	static glm::vec3 perpendicular(const glm::vec3& n)
+	{
+		if (glm::dot(n, n) == 0.f)
+			return glm::vec3(1.f, 0.f, 0.f);
+		glm::vec3 axis = std::abs(n.x) < 0.9f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+		return glm::normalize(axis - n * glm::dot(n, axis));
+	}
+
+public:
+	//Smooth normals: every triangle adds its face normal to its corners, weighted by its area and,
+	//with angleWeighted, the corner angle as well, so long thin triangles don't skew the result.
+	//Vertices only share a normal if they are the same vertex, so weld first for smooth shading
+	//across faces and keep seams split where hard edges are wanted.
+	static void generateNormals(Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, bool angleWeighted = true)
+	{
+		size_t triangleCount = indexCount / 3;
+		std::vector<glm::vec3> normals;
+		accumulate(vertexCount, indices, triangleCount, normals, [&](size_t begin, size_t end, glm::vec3* partial, size_t firstVertex)
+		{
+			Batch b;
+			for (size_t t = begin; t < end; t += 4)
+			{
+				size_t count = std::min<size_t>(4, end - t);
+				computeBatch(vertices, indices + t * 3, 0, count, false, b);
+				for (size_t k = 0; k < count; k++)
+				{
+					const GLuint* tri = indices + (t + k) * 3;
+					glm::vec3 n(b.nx[k], b.ny[k], b.nz[k]);
+					if (angleWeighted)
+					{
+						partial[tri[0] - firstVertex] += n * angle(b.cosA[k]);
+						partial[tri[1] - firstVertex] += n * angle(b.cosB[k]);
+						partial[tri[2] - firstVertex] += n * angle(b.cosC[k]);
+					}
+					else
+					{
+						partial[tri[0] - firstVertex] += n;
+						partial[tri[1] - firstVertex] += n;
+						partial[tri[2] - firstVertex] += n;
+					}
+				}
+			}
+		});
+
+		Parallel::parallelFor(vertexCount, MIN_TRIANGLES_PER_WORKER, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t v = begin; v < end; v++)
+			{
+				float length = glm::length(normals[v]);
+				//Unreferenced or only on degenerate triangles: keep what the vertex had
+				if (length > 0.f)
+					vertices[v].normal = normals[v] / length;
+			}
+		});
+	}
+
+	static void generateNormals(std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, bool angleWeighted = true)
+	{
+		generateNormals(vertices.data(), vertices.size(), indices.data(), indices.size(), angleWeighted);
+	}
+
+	//Per vertex tangents in the MikkTSpace convention: xyz is the tangent along +u, orthogonal to the
+	//vertex normal, and w the sign for bitangent = w * cross(normal, tangent). Each triangle's texture
+	//space directions are projected into the tangent plane of every corner, normalised and weighted
+	//by the corner angle before summing. Unlike the reference implementation vertices are not split
+	//where the sums disagree, which only matters on meshes that share vertices across a mirrored uv seam.
+	//Needs normals, so generate those first if the mesh has none.
+	static void generateTangents(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<glm::vec4>& tangents)
+	{
+		size_t triangleCount = indexCount / 3;
+		std::vector<TangentSum> sums;
+		accumulate(vertexCount, indices, triangleCount, sums, [&](size_t begin, size_t end, TangentSum* partial, size_t firstVertex)
+		{
+			Batch b;
+			for (size_t t = begin; t < end; t += 4)
+			{
+				size_t count = std::min<size_t>(4, end - t);
+				computeBatch(vertices, indices + t * 3, 0, count, true, b);
+				for (size_t k = 0; k < count; k++)
+				{
+					if (!b.uv[k])
+						continue;
+					const GLuint* tri = indices + (t + k) * 3;
+					glm::vec3 s(b.sx[k], b.sy[k], b.sz[k]);
+					glm::vec3 bt(b.tx[k], b.ty[k], b.tz[k]);
+					float corners[3] = { b.cosA[k], b.cosB[k], b.cosC[k] };
+					for (int c = 0; c < 3; c++)
+					{
+						const glm::vec3& n = vertices[tri[c]].normal;
+						glm::vec3 ps = s - n * glm::dot(n, s);
+						glm::vec3 pt = bt - n * glm::dot(n, bt);
+						float ls = glm::length(ps), lt = glm::length(pt);
+						float weight = angle(corners[c]);
+						TangentSum& sum = partial[tri[c] - firstVertex];
+						if (ls > 0.f)
+							sum.s += ps * (weight / ls);
+						if (lt > 0.f)
+							sum.t += pt * (weight / lt);
+					}
+				}
+			}
+		});
+
+		tangents.resize(vertexCount);
+		Parallel::parallelFor(vertexCount, MIN_TRIANGLES_PER_WORKER, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t v = begin; v < end; v++)
+			{
+				const glm::vec3& n = vertices[v].normal;
+				//Gram-Schmidt against the normal, which may have changed since the sums were taken
+				glm::vec3 s = sums[v].s - n * glm::dot(n, sums[v].s);
+				float length = glm::length(s);
+				glm::vec3 tangent = length > 1e-12f ? s / length : perpendicular(n);
+				float w = glm::dot(glm::cross(n, tangent), sums[v].t) < 0.f ? -1.f : 1.f;
+				tangents[v] = glm::vec4(tangent, w);
+			}
+		});
+	}
+
+	static void generateTangents(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, std::vector<glm::vec4>& tangents)
+	{
+		generateTangents(vertices.data(), vertices.size(), indices.data(), indices.size(), tangents);
+	}
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Reorders triangles for the post-transform vertex cache and overdraw, then vertices for fetch locality ////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//ACMR: vertices transformed per triangle (0.5 is ideal on a regular grid, 3 is no reuse at all)
+//ATVR: vertices transformed per unique vertex (1 is ideal)
+struct VertexCacheStats
+{
+	float acmr;
+	float atvr;
+};
+
+class MeshOptimizer
+{
+private:
+	//Cache size the triangle order is tuned for; the simulation in analyze uses a smaller FIFO
+	static const int CACHE_SIZE = 32;
+
+	//Forsyth's vertex score: recently used vertices and vertices with few triangles left score high
+	static float vertexScore(int cachePosition, int remaining)
+	{
+		if (remaining == 0)
+			return -1.f;
+
+		float score = 0.f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.f - (cachePosition - 3) / float(CACHE_SIZE - 3), 1.5f);
+		}
+		return score + 2.f / std::sqrt((float)remaining);
+	}
+
+public:
+	//Simulates a FIFO post-transform cache over the index buffer
+	static VertexCacheStats analyze(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize = 16)
+	{
+		std::vector<unsigned> stamp(vertexCount, 0);
+		unsigned time = cacheSize + 1;
+		size_t misses = 0;
+		size_t used = 0;
+		std::vector<bool> seen(vertexCount, false);
+
+		for (GLuint index : indices)
+		{
+			if (time - stamp[index] > (unsigned)cacheSize)
+			{
+				stamp[index] = time++;
+				misses++;
+			}
+			if (!seen[index])
+			{
+				seen[index] = true;
+				used++;
+			}
+		}
+
+		size_t triangles = indices.size() / 3;
+		VertexCacheStats stats;
+		stats.acmr = triangles ? misses / (float)triangles : 0.f;
+		stats.atvr = used ? misses / (float)used : 0.f;
+		return stats;
+	}
+
+	//Linear-speed vertex cache optimisation (Tom Forsyth)
+	static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		//Triangles using each vertex
+		std::vector<unsigned> offsets(vertexCount + 1, 0);
+		for (GLuint index : indices)
+			offsets[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		std::vector<unsigned> adjacency(indices.size());
+		std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = (unsigned)(i / 3);
+
+		std::vector<int> remaining(vertexCount);
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> score(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			remaining[v] = (int)(offsets[v + 1] - offsets[v]);
+			score[v] = vertexScore(-1, remaining[v]);
+		}
+
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; t++)
+			triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		std::vector<GLuint> cache, nextCache;
+		size_t cursor = 0;
+
+		int best = 0;
+		for (size_t t = 1; t < triangleCount; t++)
+		{
+			if (triangleScore[t] > triangleScore[best])
+				best = (int)t;
+		}
+
+		while (best >= 0)
+		{
+			emitted[best] = true;
+			nextCache.clear();
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint v = indices[best * 3 + k];
+				result.push_back(v);
+				nextCache.push_back(v);
+				remaining[v]--;
+				//Take the emitted triangle out of the vertex's adjacency
+				for (unsigned a = offsets[v]; a < offsets[v] + remaining[v] + 1; a++)
+				{
+					if (adjacency[a] == (unsigned)best)
+					{
+						std::swap(adjacency[a], adjacency[offsets[v] + remaining[v]]);
+						break;
+					}
+				}
+			}
+			for (GLuint v : cache)
+			{
+				if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+					nextCache.push_back(v);
+			}
+
+			//Vertices pushed out of the cache lose their cache bonus
+			for (size_t i = CACHE_SIZE; i < nextCache.size(); i++)
+				cachePosition[nextCache[i]] = -1;
+
+			for (size_t i = 0; i < nextCache.size(); i++)
+			{
+				GLuint v = nextCache[i];
+				if (i < (size_t)CACHE_SIZE)
+					cachePosition[v] = (int)i;
+				float newScore = vertexScore(cachePosition[v], remaining[v]);
+				float delta = newScore - score[v];
+				score[v] = newScore;
+				for (unsigned a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+					triangleScore[adjacency[a]] += delta;
+			}
+
+			//Next triangle is the best scoring one touching the cache
+			best = -1;
+			float bestScore = -1.f;
+			for (size_t i = 0; i < nextCache.size() && i < (size_t)CACHE_SIZE; i++)
+			{
+				GLuint v = nextCache[i];
+				for (unsigned a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+				{
+					unsigned t = adjacency[a];
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						best = (int)t;
+					}
+				}
+			}
+			if (nextCache.size() > (size_t)CACHE_SIZE)
+				nextCache.resize(CACHE_SIZE);
+			std::swap(cache, nextCache);
+
+			//Nothing in the cache has triangles left, carry on with the next unemitted triangle
+			if (best < 0)
+			{
+				while (cursor < triangleCount && emitted[cursor])
+					cursor++;
+				if (cursor < triangleCount)
+					best = (int)cursor;
+			}
+		}
+
+		indices.swap(result);
+	}
+
+	//View independent overdraw reduction: splits the cache ordered triangles into clusters where the
+	//cache order restarts anyway, then draws clusters facing away from the mesh centre first, since
+	//those tend to occlude the rest from any direction. Keeps most of the vertex cache order.
+	static void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, int minClusterTriangles = 32)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		//Cluster boundaries where a triangle brings in three new vertices
+		std::vector<size_t> starts(1, 0);
+		std::vector<unsigned> stamp(vertices.size(), 0);
+		unsigned time = 17;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint v = indices[t * 3 + k];
+				if (time - stamp[v] > 16)
+				{
+					stamp[v] = time++;
+					misses++;
+				}
+			}
+			if (misses == 3 && t - starts.back() >= (size_t)minClusterTriangles)
+				starts.push_back(t);
+		}
+		starts.push_back(triangleCount);
+
+		glm::vec3 meshCenter(0.f);
+		for (const Vertex& v : vertices)
+			meshCenter += v.position;
+		meshCenter /= (float)std::max<size_t>(vertices.size(), 1);
+
+		struct Cluster { size_t begin; size_t end; float sortKey; };
+		std::vector<Cluster> clusters;
+		for (size_t c = 0; c + 1 < starts.size(); c++)
+		{
+			glm::vec3 center(0.f), normal(0.f);
+			float area = 0.f;
+			for (size_t t = starts[c]; t < starts[c + 1]; t++)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3& d = vertices[indices[t * 3 + 2]].position;
+				glm::vec3 n = glm::cross(b - a, d - a);
+				float triArea = glm::length(n);
+				center += (a + b + d) * (triArea / 3.f);
+				normal += n;
+				area += triArea;
+			}
+			center = area > 0.f ? center / area : vertices[indices[starts[c] * 3]].position;
+			float normalLength = glm::length(normal);
+			float key = normalLength > 0.f ? glm::dot(center - meshCenter, normal / normalLength) : 0.f;
+			clusters.push_back({ starts[c], starts[c + 1], key });
+		}
+
+		std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		for (const Cluster& c : clusters)
+			result.insert(result.end(), indices.begin() + c.begin * 3, indices.begin() + c.end * 3);
+		indices.swap(result);
+	}
+
+	//Renumbers vertices in the order the index buffer first uses them, so fetches walk memory forwards.
+	//Vertices no triangle uses are dropped.
+	static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		std::vector<GLuint> remap(vertices.size(), UINT32_MAX);
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (GLuint& index : indices)
+		{
+			if (remap[index] == UINT32_MAX)
+			{
+				remap[index] = (GLuint)result.size();
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(result);
+	}
+
+	//Runs the whole pipeline and optionally prints ACMR/ATVR before and after
+	static VertexCacheStats optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, bool report = false)
+	{
+		VertexCacheStats before = analyze(indices, vertices.size());
+
+		optimizeVertexCache(indices, vertices.size());
+		optimizeOverdraw(indices, vertices);
+		optimizeVertexFetch(vertices, indices);
+
+		VertexCacheStats after = analyze(indices, vertices.size());
+		if (report)
+		{
+			std::cout << "Mesh optimized: ACMR " << before.acmr << " -> " << after.acmr
+				<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+		}
+		return after;
+	}
+};
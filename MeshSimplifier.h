@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Edge collapse simplification with quadric error metrics, used to build mesh LOD chains /////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Symmetric 4x4 plane quadric, stored as its upper triangle
+struct Quadric
+{
+	double a[10];
+	double weight;
+
+	Quadric() { std::fill(a, a + 10, 0.0); weight = 0.0; }
+
+	static Quadric fromPlane(const glm::vec3& n, double d, double weight)
+	{
+		Quadric q;
+		q.a[0] = n.x * n.x * weight; q.a[1] = n.x * n.y * weight; q.a[2] = n.x * n.z * weight; q.a[3] = n.x * d * weight;
+		q.a[4] = n.y * n.y * weight; q.a[5] = n.y * n.z * weight; q.a[6] = n.y * d * weight;
+		q.a[7] = n.z * n.z * weight; q.a[8] = n.z * d * weight;
+		q.a[9] = d * d * weight;
+		q.weight = weight;
+		return q;
+	}
+
+	Quadric& operator+=(const Quadric& q)
+	{
+		for (int i = 0; i < 10; i++)
+			a[i] += q.a[i];
+		weight += q.weight;
+		return *this;
+	}
+
+	//Area weighted mean of squared distances to the accumulated planes
+	double error(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double sum = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+			+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+			+ a[7] * z * z + 2 * a[8] * z
+			+ a[9];
+		return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+	}
+};
+
+class MeshSimplifier
+{
+private:
+	struct Collapse
+	{
+		GLuint from;
+		GLuint to;
+		double cost;
+	};
+
+	//Triangle normal after moving one of its corners, used to reject collapses that flip faces
+	static bool flips(const std::vector<Vertex>& vertices, GLuint a, GLuint b, GLuint c, GLuint from, GLuint to)
+	{
+		glm::vec3 pa = vertices[a].position, pb = vertices[b].position, pc = vertices[c].position;
+		glm::vec3 before = glm::cross(pb - pa, pc - pa);
+		if (a == from) pa = vertices[to].position;
+		if (b == from) pb = vertices[to].position;
+		if (c == from) pc = vertices[to].position;
+		glm::vec3 after = glm::cross(pb - pa, pc - pa);
+		return glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+	}
+
+public:
+	//Collapses edges onto existing vertices until the index buffer has at most targetIndexCount
+	//indices or the next collapse would move the surface more than maxError (object space units).
+	//The vertex buffer is shared with the input, so every LOD can draw from the same VBO.
+	//Vertices on open borders and on attribute seams (same position, different normal or uv) stay put;
+	//other collapses also pay for the normal and uv difference, scaled by attributeWeight.
+	//Returns the error of the result, in object space units.
+	static float simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+		size_t targetIndexCount, float maxError, std::vector<GLuint>& result, float attributeWeight = 0.1f)
+	{
+		result = indices;
+		size_t vertexCount = vertices.size();
+		if (indices.size() <= targetIndexCount || vertexCount == 0)
+			return 0.f;
+
+		//Vertices sharing a position. Exact duplicates (unindexed meshes, or exporters splitting for nothing)
+		//are welded so the surface is connected; where the normal or uv differs the position is an attribute
+		//seam, and every vertex on it gets locked.
+		std::vector<bool> locked(vertexCount, false);
+		{
+			struct PositionHash
+			{
+				size_t operator()(const glm::vec3& p) const
+				{
+					return std::hash<float>()(p.x) ^ (std::hash<float>()(p.y) * 31) ^ (std::hash<float>()(p.z) * 131);
+				}
+			};
+			struct PositionEqual
+			{
+				bool operator()(const glm::vec3& a, const glm::vec3& b) const { return a == b; }
+			};
+			std::unordered_map<glm::vec3, std::vector<GLuint>, PositionHash, PositionEqual> distinctAt;
+			std::vector<GLuint> weld(vertexCount);
+			for (GLuint v = 0; v < vertexCount; v++)
+			{
+				std::vector<GLuint>& distinct = distinctAt[vertices[v].position];
+				weld[v] = v;
+				for (GLuint other : distinct)
+				{
+					if (vertices[other].normal == vertices[v].normal && vertices[other].texcoord == vertices[v].texcoord)
+					{
+						weld[v] = other;
+						break;
+					}
+				}
+				if (weld[v] != v)
+					continue;
+				distinct.push_back(v);
+				if (distinct.size() > 1)
+				{
+					for (GLuint other : distinct)
+						locked[other] = true;
+				}
+			}
+			//Welded vertices are identical, so the result still draws from the same vertex buffer
+			for (GLuint& index : result)
+				index = weld[index];
+		}
+
+		//Open border edges are used by one triangle only
+		{
+			std::unordered_map<uint64_t, int> edgeUse;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					GLuint a = result[i + k], b = result[i + (k + 1) % 3];
+					edgeUse[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+				}
+			}
+			for (auto& e : edgeUse)
+			{
+				if (e.second == 1)
+				{
+					locked[(GLuint)(e.first >> 32)] = true;
+					locked[(GLuint)(e.first & 0xffffffff)] = true;
+				}
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			const glm::vec3& p0 = vertices[result[i]].position;
+			glm::vec3 n = glm::cross(vertices[result[i + 1]].position - p0, vertices[result[i + 2]].position - p0);
+			float area = glm::length(n);
+			if (area <= 0.f)
+				continue;
+			n /= area;
+			Quadric q = Quadric::fromPlane(n, -glm::dot(n, p0), area * 0.5);
+			quadrics[result[i]] += q;
+			quadrics[result[i + 1]] += q;
+			quadrics[result[i + 2]] += q;
+		}
+
+		double maxCost = (double)maxError * maxError;
+		double resultCost = 0.0;
+		std::vector<GLuint> collapsed(vertexCount);
+		for (GLuint v = 0; v < vertexCount; v++)
+			collapsed[v] = v;
+
+		//Each pass collapses a non-overlapping set of the cheapest edges, then rebuilds
+		for (int pass = 0; pass < 32 && result.size() > targetIndexCount; pass++)
+		{
+			std::vector<unsigned> offsets(vertexCount + 1, 0);
+			for (GLuint index : result)
+				offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				offsets[v + 1] += offsets[v];
+			std::vector<unsigned> adjacency(result.size());
+			std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+				adjacency[fill[result[i]]++] = (unsigned)(i / 3);
+
+			std::vector<Collapse> candidates;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					GLuint a = result[i + k], b = result[i + (k + 1) % 3];
+					for (int dir = 0; dir < 2; dir++)
+					{
+						GLuint from = dir ? b : a, to = dir ? a : b;
+						if (locked[from])
+							continue;
+						double cost = quadrics[from].error(vertices[to].position);
+						glm::vec3 dn = vertices[from].normal - vertices[to].normal;
+						glm::vec2 duv(vertices[from].texcoord.x - vertices[to].texcoord.x, vertices[from].texcoord.y - vertices[to].texcoord.y);
+						cost += attributeWeight * (glm::dot(dn, dn) + glm::dot(duv, duv)) * glm::dot(vertices[from].position - vertices[to].position, vertices[from].position - vertices[to].position);
+						if (cost <= maxCost)
+							candidates.push_back({ from, to, cost });
+					}
+				}
+			}
+			if (candidates.empty())
+				break;
+			std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			std::vector<bool> touched(vertexCount, false);
+			size_t triangles = result.size() / 3;
+			size_t targetTriangles = targetIndexCount / 3;
+			bool changed = false;
+			for (const Collapse& c : candidates)
+			{
+				if (triangles <= targetTriangles)
+					break;
+				if (touched[c.from] || touched[c.to])
+					continue;
+
+				bool valid = true;
+				size_t removed = 0;
+				for (unsigned a = offsets[c.from]; a < offsets[c.from + 1] && valid; a++)
+				{
+					size_t t = adjacency[a] * 3;
+					GLuint i0 = result[t], i1 = result[t + 1], i2 = result[t + 2];
+					if (i0 == c.to || i1 == c.to || i2 == c.to)
+						removed++;
+					else if (flips(vertices, i0, i1, i2, c.from, c.to))
+						valid = false;
+				}
+				if (!valid || removed == 0)
+					continue;
+
+				collapsed[c.from] = c.to;
+				quadrics[c.to] += quadrics[c.from];
+				resultCost = std::max(resultCost, c.cost);
+				triangles -= removed;
+				changed = true;
+
+				//Keep this pass's collapses apart so their flip checks stay valid
+				for (unsigned a = offsets[c.from]; a < offsets[c.from + 1]; a++)
+				{
+					size_t t = adjacency[a] * 3;
+					touched[result[t]] = touched[result[t + 1]] = touched[result[t + 2]] = true;
+				}
+			}
+			if (!changed)
+				break;
+
+			std::vector<GLuint> next;
+			next.reserve(result.size());
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				GLuint a = collapsed[result[i]], b = collapsed[result[i + 1]], c = collapsed[result[i + 2]];
+				if (a != b && b != c && a != c)
+				{
+					next.push_back(a);
+					next.push_back(b);
+					next.push_back(c);
+				}
+			}
+			result.swap(next);
+		}
+
+		return (float)std::sqrt(resultCost);
+	}
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "glad/glad.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Streams buffer contents to the GPU in slices through a persistently mapped staging ring, within a budget /
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class MeshUploader
+{
+private:
+	struct Job
+	{
+		GLuint buffer;
+		const char* data;
+		size_t size;
+		size_t uploaded;
+		//Set when the data is only alive for the upload, e.g. indices narrowed to 16 bits
+		std::shared_ptr<void> keepAlive;
+	};
+
+	GLuint ring;
+	char* ringData;
+	size_t sliceSize;
+	size_t uploadBudget;
+	//Each slice is reused once the GPU has finished copying out of it
+	std::vector<GLsync> fences;
+	size_t nextSlice;
+
+	std::deque<Job> jobs;
+	uint64_t submitted;
+	uint64_t completed;
+
+	//Makes nextSlice writable. Without wait, gives up instead of stalling on a copy still in flight.
+	bool acquireSlice(bool wait)
+	{
+		GLsync& fence = this->fences[this->nextSlice];
+		if (fence == 0)
+			return true;
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (wait && result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		if (result == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(fence);
+		fence = 0;
+		return true;
+	}
+
+	//Uploads slices until the budget is used or the ring is busy, and retires finished jobs.
+	//With a ticket, keeps going (stalling if needed) until that job has completed instead.
+	void pump(size_t budget, uint64_t untilTicket)
+	{
+		size_t uploaded = 0;
+		while (!this->jobs.empty())
+		{
+			Job& job = this->jobs.front();
+			if (job.data == nullptr || job.uploaded >= job.size)
+			{
+				this->jobs.pop_front();
+				this->completed++;
+				continue;
+			}
+			bool forced = this->completed < untilTicket;
+			if ((!forced && uploaded >= budget) || !this->acquireSlice(forced))
+				break;
+
+			size_t bytes = std::min(this->sliceSize, job.size - job.uploaded);
+			size_t ringOffset = this->nextSlice * this->sliceSize;
+			std::memcpy(this->ringData + ringOffset, job.data + job.uploaded, bytes);
+
+			glBindBuffer(GL_COPY_READ_BUFFER, this->ring);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, job.buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, ringOffset, job.uploaded, bytes);
+			this->fences[this->nextSlice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			this->nextSlice = (this->nextSlice + 1) % this->fences.size();
+
+			job.uploaded += bytes;
+			uploaded += bytes;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+public:
+	//The ring holds sliceCount slices; a few frames worth keeps the GPU copies from ever stalling the CPU
+	MeshUploader(size_t uploadBytesPerFrame = 16 * 1024 * 1024, size_t sliceBytes = 1024 * 1024, size_t sliceCount = 48)
+	{
+		this->sliceSize = sliceBytes;
+		this->uploadBudget = uploadBytesPerFrame;
+		this->fences.assign(std::max<size_t>(sliceCount, 1), 0);
+		this->nextSlice = 0;
+		this->submitted = 0;
+		this->completed = 0;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		size_t ringSize = this->sliceSize * this->fences.size();
+		glGenBuffers(1, &this->ring);
+		glBindBuffer(GL_COPY_READ_BUFFER, this->ring);
+		glBufferStorage(GL_COPY_READ_BUFFER, ringSize, nullptr, flags);
+		this->ringData = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, ringSize, flags);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	~MeshUploader()
+	{
+		for (GLsync fence : this->fences)
+		{
+			if (fence != 0)
+				glDeleteSync(fence);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, this->ring);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &this->ring);
+	}
+
+	MeshUploader(const MeshUploader&) = delete;
+	MeshUploader& operator=(const MeshUploader&) = delete;
+
+	//Queues size bytes of data for buffer, which needs storage of at least that size already.
+	//data has to stay alive until the upload completes (or pass keepAlive to own it).
+	//Jobs complete in order; the returned ticket is complete once isComplete(ticket) says so.
+	uint64_t upload(GLuint buffer, const void* data, size_t size, std::shared_ptr<void> keepAlive = nullptr)
+	{
+		this->jobs.push_back({ buffer, (const char*)data, size, 0, keepAlive });
+		return ++this->submitted;
+	}
+
+	//Drops the queued uploads into buffer, e.g. before deleting it or replacing its data
+	void cancel(GLuint buffer)
+	{
+		for (Job& job : this->jobs)
+		{
+			if (job.buffer == buffer)
+			{
+				job.data = nullptr;
+				job.keepAlive.reset();
+			}
+		}
+	}
+
+	//Completes every job up to ticket now, stalling if the ring is busy
+	void finish(uint64_t ticket)
+	{
+		this->pump(0, ticket);
+	}
+
+	//Call once per frame: uploads up to the per frame budget
+	void update()
+	{
+		this->pump(this->uploadBudget, 0);
+	}
+
+	inline bool isComplete(uint64_t ticket) const { return this->completed >= ticket; }
+	inline bool isIdle() const { return this->jobs.empty(); }
+
+	size_t getPendingBytes() const
+	{
+		size_t pending = 0;
+		for (const Job& job : this->jobs)
+		{
+			if (job.data != nullptr)
+				pending += job.size - job.uploaded;
+		}
+		return pending;
+	}
+
+	void setUploadBudget(size_t bytesPerFrame) { this->uploadBudget = bytesPerFrame; }
+	inline size_t getUploadBudget() const { return this->uploadBudget; }
+};
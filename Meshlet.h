@@ -0,0 +1,333 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <emmintrin.h>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+#include "Bounds.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Splits a mesh into small triangle clusters with their own bounds, so parts out of view are not drawn ///////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const int MESHLET_MAX_VERTICES = 64;
+const int MESHLET_MAX_TRIANGLES = 124;
+
+//A contiguous range of the reordered index buffer
+struct Meshlet
+{
+	unsigned indexOffset;
+	unsigned indexCount;
+	unsigned vertexCount;
+
+	//Bounding sphere, object space
+	glm::vec3 center;
+	float radius;
+
+	//Every triangle normal is within the cone around coneAxis; coneCutoff is the sine of its half angle
+	//widened by the sphere, or 1 (never culled) when the normals spread too far to cull by facing
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+class MeshletSet
+{
+private:
+	std::vector<Meshlet> meshlets;
+
+	//Culling data kept as structure of arrays, padded to a multiple of 4 so SSE can test 4 clusters at once
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> axisX, axisY, axisZ, cutoff;
+
+	//Ritter's bounding sphere: start from an extreme pair, then grow to fit the remaining points
+	static void boundingSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius)
+	{
+		glm::vec3 a = points[0], b = points[0];
+		for (const glm::vec3& p : points)
+		{
+			if (glm::dot(p - points[0], p - points[0]) > glm::dot(a - points[0], a - points[0]))
+				a = p;
+		}
+		for (const glm::vec3& p : points)
+		{
+			if (glm::dot(p - a, p - a) > glm::dot(b - a, b - a))
+				b = p;
+		}
+		center = (a + b) * 0.5f;
+		radius = glm::length(b - a) * 0.5f;
+		for (const glm::vec3& p : points)
+		{
+			float d = glm::length(p - center);
+			if (d > radius)
+			{
+				float grown = (radius + d) * 0.5f;
+				center += (p - center) * ((grown - radius) / d);
+				radius = grown;
+			}
+		}
+	}
+
+	static void computeBounds(Meshlet& m, const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+	{
+		std::vector<glm::vec3> points;
+		points.reserve(m.indexCount);
+		glm::vec3 normalSum(0.f);
+		std::vector<glm::vec3> normals;
+		for (unsigned i = m.indexOffset; i < m.indexOffset + m.indexCount; i += 3)
+		{
+			const glm::vec3& a = vertices[indices[i]].position;
+			const glm::vec3& b = vertices[indices[i + 1]].position;
+			const glm::vec3& c = vertices[indices[i + 2]].position;
+			points.push_back(a);
+			points.push_back(b);
+			points.push_back(c);
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float length = glm::length(n);
+			if (length > 0.f)
+			{
+				normals.push_back(n / length);
+				normalSum += n / length;
+			}
+		}
+		boundingSphere(points, m.center, m.radius);
+
+		m.coneAxis = glm::vec3(0.f, 0.f, 1.f);
+		m.coneCutoff = 1.f;
+		float axisLength = glm::length(normalSum);
+		if (normals.empty() || axisLength <= 0.f)
+			return;
+
+		m.coneAxis = normalSum / axisLength;
+		float minDot = 1.f;
+		for (const glm::vec3& n : normals)
+			minDot = std::min(minDot, glm::dot(n, m.coneAxis));
+		//Wider than a hemisphere: some triangle faces the camera from every direction
+		if (minDot <= 0.1f)
+			return;
+		m.coneCutoff = std::sqrt(1.f - minDot * minDot);
+	}
+
+	void buildCullData()
+	{
+		size_t padded = (this->meshlets.size() + 3) & ~(size_t)3;
+		this->centerX.assign(padded, 0.f); this->centerY.assign(padded, 0.f); this->centerZ.assign(padded, 0.f);
+		this->radius.assign(padded, -1.f);
+		this->axisX.assign(padded, 0.f); this->axisY.assign(padded, 0.f); this->axisZ.assign(padded, 0.f);
+		this->cutoff.assign(padded, 1.f);
+		for (size_t i = 0; i < this->meshlets.size(); i++)
+		{
+			const Meshlet& m = this->meshlets[i];
+			this->centerX[i] = m.center.x; this->centerY[i] = m.center.y; this->centerZ[i] = m.center.z;
+			this->radius[i] = m.radius;
+			this->axisX[i] = m.coneAxis.x; this->axisY[i] = m.coneAxis.y; this->axisZ[i] = m.coneAxis.z;
+			this->cutoff[i] = m.coneCutoff;
+		}
+	}
+
+public:
+	MeshletSet() {}
+	~MeshletSet() {}
+
+	//Reorders indices into clusters of at most maxVertices unique vertices and maxTriangles triangles.
+	//Clusters grow through shared vertices, preferring triangles that add the fewest new ones,
+	//and fall back to the existing triangle order, so a cache optimised buffer mostly keeps its order.
+	void build(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+		int maxVertices = MESHLET_MAX_VERTICES, int maxTriangles = MESHLET_MAX_TRIANGLES)
+	{
+		this->meshlets.clear();
+		size_t triangleCount = indices.size() / 3;
+		size_t vertexCount = vertices.size();
+
+		std::vector<unsigned> offsets(vertexCount + 1, 0);
+		for (GLuint index : indices)
+			offsets[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		std::vector<unsigned> adjacency(indices.size());
+		std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = (unsigned)(i / 3);
+
+		std::vector<bool> emitted(triangleCount, false);
+		//Which meshlet last used a vertex, so membership checks are O(1)
+		std::vector<int> owner(vertexCount, -1);
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		std::vector<GLuint> members;
+		size_t cursor = 0;
+
+		while (true)
+		{
+			while (cursor < triangleCount && emitted[cursor])
+				cursor++;
+			if (cursor >= triangleCount)
+				break;
+
+			int id = (int)this->meshlets.size();
+			Meshlet m = {};
+			m.indexOffset = (unsigned)result.size();
+			members.clear();
+			size_t next = cursor;
+
+			while (true)
+			{
+				int added = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					if (owner[indices[next * 3 + k]] != id)
+						added++;
+				}
+				if ((int)members.size() + added > maxVertices || (int)(m.indexCount / 3) >= maxTriangles)
+					break;
+
+				emitted[next] = true;
+				for (int k = 0; k < 3; k++)
+				{
+					GLuint v = indices[next * 3 + k];
+					result.push_back(v);
+					if (owner[v] != id)
+					{
+						owner[v] = id;
+						members.push_back(v);
+					}
+				}
+				m.indexCount += 3;
+
+				//Unemitted neighbour adding the fewest new vertices
+				long best = -1;
+				int bestAdded = 4;
+				for (GLuint v : members)
+				{
+					for (unsigned a = offsets[v]; a < offsets[v + 1]; a++)
+					{
+						unsigned t = adjacency[a];
+						if (emitted[t])
+							continue;
+						int tAdded = 0;
+						for (int k = 0; k < 3; k++)
+						{
+							if (owner[indices[t * 3 + k]] != id)
+								tAdded++;
+						}
+						if (tAdded < bestAdded)
+						{
+							bestAdded = tAdded;
+							best = t;
+						}
+					}
+					if (bestAdded == 0)
+						break;
+				}
+				if (best < 0)
+				{
+					while (cursor < triangleCount && emitted[cursor])
+						cursor++;
+					if (cursor >= triangleCount)
+						break;
+					best = (long)cursor;
+				}
+				next = (size_t)best;
+			}
+
+			m.vertexCount = (unsigned)members.size();
+			this->meshlets.push_back(m);
+		}
+
+		indices.swap(result);
+		for (Meshlet& m : this->meshlets)
+			computeBounds(m, vertices, indices);
+		this->buildCullData();
+	}
+
+	//Takes clusters built earlier, e.g. from a cooked mesh file, for an index buffer already in their order
+	void assign(const Meshlet* meshlets, size_t count)
+	{
+		this->meshlets.assign(meshlets, meshlets + count);
+		this->buildCullData();
+	}
+
+	//Tests every cluster against the frustum and for facing away from the camera, 4 at a time.
+	//Work happens in object space: the planes are moved there (keeping world unit distances,
+	//so radii are scaled by maxScale) and so is the camera, which keeps the facing test exact.
+	//Visible clusters next to each other in the index buffer are merged into one draw range,
+	//written as counts and byte offsets for glMultiDrawElements.
+	void cull(const Frustum& worldFrustum, const glm::mat4& model, const glm::vec3& cameraPosition, size_t indexSize,
+		std::vector<GLsizei>& counts, std::vector<const void*>& offsets) const
+	{
+		counts.clear();
+		offsets.clear();
+
+		Frustum frustum = worldFrustum.toObjectSpace(model);
+		glm::vec3 camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.f));
+		float maxScale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+
+		__m128 scale = _mm_set1_ps(maxScale);
+		__m128 camX = _mm_set1_ps(camera.x), camY = _mm_set1_ps(camera.y), camZ = _mm_set1_ps(camera.z);
+		__m128 zero = _mm_setzero_ps();
+
+		long runStart = -1;
+		unsigned runEnd = 0;
+		for (size_t i = 0; i < this->centerX.size(); i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&this->centerX[i]);
+			__m128 cy = _mm_loadu_ps(&this->centerY[i]);
+			__m128 cz = _mm_loadu_ps(&this->centerZ[i]);
+			__m128 r = _mm_loadu_ps(&this->radius[i]);
+
+			//Outside when the centre is further than the scaled radius behind any plane
+			__m128 negRadius = _mm_sub_ps(zero, _mm_mul_ps(r, scale));
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.planes[p];
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negRadius));
+			}
+
+			//Backfacing when dot(center - camera, axis) >= cutoff * |center - camera| + radius
+			__m128 vx = _mm_sub_ps(cx, camX), vy = _mm_sub_ps(cy, camY), vz = _mm_sub_ps(cz, camZ);
+			__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(&this->axisX[i])), _mm_mul_ps(vy, _mm_loadu_ps(&this->axisY[i]))),
+				_mm_mul_ps(vz, _mm_loadu_ps(&this->axisZ[i])));
+			__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+			__m128 c = _mm_loadu_ps(&this->cutoff[i]);
+			__m128 backfacing = _mm_and_ps(_mm_cmplt_ps(c, _mm_set1_ps(1.f)), _mm_cmpge_ps(along, _mm_add_ps(_mm_mul_ps(c, distance), r)));
+
+			int culled = _mm_movemask_ps(_mm_or_ps(outside, backfacing));
+			for (int k = 0; k < 4 && i + k < this->meshlets.size(); k++)
+			{
+				if (culled & (1 << k))
+					continue;
+				const Meshlet& m = this->meshlets[i + k];
+				if (runStart >= 0 && runEnd == m.indexOffset)
+				{
+					runEnd += m.indexCount;
+					continue;
+				}
+				if (runStart >= 0)
+				{
+					counts.push_back((GLsizei)(runEnd - runStart));
+					offsets.push_back((const void*)((size_t)runStart * indexSize));
+				}
+				runStart = m.indexOffset;
+				runEnd = m.indexOffset + m.indexCount;
+			}
+		}
+		if (runStart >= 0)
+		{
+			counts.push_back((GLsizei)(runEnd - runStart));
+			offsets.push_back((const void*)((size_t)runStart * indexSize));
+		}
+	}
+
+	inline size_t size() const { return this->meshlets.size(); }
+	inline const Meshlet& get(size_t i) const { return this->meshlets[i]; }
+	inline const std::vector<Meshlet>& getMeshlets() const { return this->meshlets; }
+};
@@ -0,0 +1,488 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+
+#include <emmintrin.h>
+
+#include "stb_image.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Builds the full mip chain of an image at asset time and stores it in a cooked ".mip" file //////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum MipFilter {
+	MIP_FILTER_BOX,
+	MIP_FILTER_KAISER
+};
+
+//One level of a mip chain, tightly packed rows (no row alignment)
+struct MipLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> data;
+};
+
+//Layout of a cooked texture file:
+//  MipFileHeader
+//  MipFileLevel[levelCount]
+//  level pixel data, largest level first
+struct MipFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t components;
+	uint32_t levelCount;
+	//Size and modification time of the source image it was cooked from, so edits to the image re-cook it
+	uint64_t sourceSize;
+	int64_t sourceTime;
+};
+
+struct MipFileLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+class MipGenerator
+{
+private:
+	//Linear RGBA working image, one __m128 worth of floats per pixel
+	struct FloatImage
+	{
+		int width;
+		int height;
+		std::vector<float> pixels;
+	};
+
+	static const float* srgbToLinearTable()
+	{
+		static const std::vector<float> table = []()
+		{
+			std::vector<float> t(256);
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.f;
+				t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return t;
+		}();
+		return table.data();
+	}
+
+	//Linear -> sRGB byte, sampled finely enough that every output byte is reachable
+	static const unsigned char* linearToSrgbTable()
+	{
+		static const std::vector<unsigned char> table = []()
+		{
+			std::vector<unsigned char> t(4096);
+			for (int i = 0; i < 4096; i++)
+			{
+				float c = i / 4095.f;
+				float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+				t[i] = (unsigned char)(std::min(std::max(s, 0.f), 1.f) * 255.f + 0.5f);
+			}
+			return t;
+		}();
+		return table.data();
+	}
+
+	//Alpha (and single channel data) is never gamma encoded
+	static bool isColorChannel(int channel, int components)
+	{
+		return components >= 3 && channel < 3;
+	}
+
+	static void decode(const unsigned char* src, int width, int height, int components, bool srgb, FloatImage& out)
+	{
+		const float* toLinear = srgbToLinearTable();
+		out.width = width;
+		out.height = height;
+		out.pixels.assign((size_t)width * height * 4, 0.f);
+		for (size_t p = 0; p < (size_t)width * height; p++)
+		{
+			for (int c = 0; c < components; c++)
+			{
+				unsigned char v = src[p * components + c];
+				out.pixels[p * 4 + c] = (srgb && isColorChannel(c, components)) ? toLinear[v] : v / 255.f;
+			}
+		}
+	}
+
+	static void encode(const FloatImage& img, int components, bool srgb, MipLevel& out)
+	{
+		const unsigned char* toSrgb = linearToSrgbTable();
+		out.width = img.width;
+		out.height = img.height;
+		out.data.resize((size_t)img.width * img.height * components);
+		for (size_t p = 0; p < (size_t)img.width * img.height; p++)
+		{
+			for (int c = 0; c < components; c++)
+			{
+				float v = std::min(std::max(img.pixels[p * 4 + c], 0.f), 1.f);
+				out.data[p * components + c] = (srgb && isColorChannel(c, components))
+					? toSrgb[(int)(v * 4095.f + 0.5f)]
+					: (unsigned char)(v * 255.f + 0.5f);
+			}
+		}
+	}
+
+	//Splits [0, count) into one band per thread, up to maxThreads (0 for one per hardware thread)
+	template <typename Fn>
+	static void parallelRows(int count, int maxThreads, Fn fn)
+	{
+		int limit = maxThreads > 0 ? maxThreads : (int)std::thread::hardware_concurrency();
+		int threads = std::max(1, std::min(limit, count / 16));
+		if (threads == 1)
+		{
+			fn(0, count);
+			return;
+		}
+		std::vector<std::thread> workers;
+		int band = (count + threads - 1) / threads;
+		for (int t = 0; t < threads; t++)
+		{
+			int begin = t * band;
+			int end = std::min(count, begin + band);
+			if (begin < end)
+				workers.emplace_back(fn, begin, end);
+		}
+		for (auto& w : workers)
+			w.join();
+	}
+
+	//2x2 box, odd edges clamp so non power of two sizes still cover the whole source
+	static void downsampleBox(const FloatImage& src, FloatImage& dst, int maxThreads)
+	{
+		dst.width = std::max(1, src.width / 2);
+		dst.height = std::max(1, src.height / 2);
+		dst.pixels.resize((size_t)dst.width * dst.height * 4);
+		const __m128 quarter = _mm_set1_ps(0.25f);
+
+		parallelRows(dst.height, maxThreads, [&](int rowBegin, int rowEnd)
+		{
+			for (int y = rowBegin; y < rowEnd; y++)
+			{
+				const float* row0 = &src.pixels[(size_t)std::min(y * 2, src.height - 1) * src.width * 4];
+				const float* row1 = &src.pixels[(size_t)std::min(y * 2 + 1, src.height - 1) * src.width * 4];
+				float* out = &dst.pixels[(size_t)y * dst.width * 4];
+				for (int x = 0; x < dst.width; x++)
+				{
+					int x0 = std::min(x * 2, src.width - 1) * 4;
+					int x1 = std::min(x * 2 + 1, src.width - 1) * 4;
+					__m128 sum = _mm_add_ps(
+						_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+						_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+					_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+				}
+			}
+		});
+	}
+
+	static float besselI0(float x)
+	{
+		float sum = 1.f, term = 1.f;
+		for (int k = 1; k < 16; k++)
+		{
+			term *= (x / (2.f * k)) * (x / (2.f * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	//Kaiser windowed sinc for a 2:1 reduction, 6 taps centred between source texels 2x and 2x+1
+	static void kaiserWeights(float weights[6])
+	{
+		const float alpha = 4.f;
+		const float radius = 3.f;
+		float total = 0.f;
+		for (int k = 0; k < 6; k++)
+		{
+			float t = (k - 2) - 0.5f;
+			float s = t * 0.5f;
+			float sinc = s == 0.f ? 1.f : std::sin(3.14159265f * s) / (3.14159265f * s);
+			float r = t / radius;
+			float window = besselI0(alpha * std::sqrt(std::max(0.f, 1.f - r * r))) / besselI0(alpha);
+			weights[k] = sinc * window;
+			total += weights[k];
+		}
+		for (int k = 0; k < 6; k++)
+			weights[k] /= total;
+	}
+
+	//Separable Kaiser reduction: horizontal pass into tmp, then vertical pass into dst
+	static void downsampleKaiser(const FloatImage& src, FloatImage& dst, int maxThreads)
+	{
+		float weights[6];
+		kaiserWeights(weights);
+		__m128 w[6];
+		for (int k = 0; k < 6; k++)
+			w[k] = _mm_set1_ps(weights[k]);
+
+		FloatImage tmp;
+		tmp.width = std::max(1, src.width / 2);
+		tmp.height = src.height;
+		tmp.pixels.resize((size_t)tmp.width * tmp.height * 4);
+		parallelRows(tmp.height, maxThreads, [&](int rowBegin, int rowEnd)
+		{
+			for (int y = rowBegin; y < rowEnd; y++)
+			{
+				const float* in = &src.pixels[(size_t)y * src.width * 4];
+				float* out = &tmp.pixels[(size_t)y * tmp.width * 4];
+				for (int x = 0; x < tmp.width; x++)
+				{
+					__m128 sum = _mm_setzero_ps();
+					for (int k = 0; k < 6; k++)
+					{
+						int sx = std::min(std::max(x * 2 + k - 2, 0), src.width - 1);
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + sx * 4), w[k]));
+					}
+					_mm_storeu_ps(out + x * 4, sum);
+				}
+			}
+		});
+
+		dst.width = tmp.width;
+		dst.height = std::max(1, src.height / 2);
+		dst.pixels.resize((size_t)dst.width * dst.height * 4);
+		parallelRows(dst.height, maxThreads, [&](int rowBegin, int rowEnd)
+		{
+			for (int y = rowBegin; y < rowEnd; y++)
+			{
+				const float* rows[6];
+				for (int k = 0; k < 6; k++)
+					rows[k] = &tmp.pixels[(size_t)std::min(std::max(y * 2 + k - 2, 0), tmp.height - 1) * tmp.width * 4];
+				float* out = &dst.pixels[(size_t)y * dst.width * 4];
+				for (int x = 0; x < dst.width; x++)
+				{
+					__m128 sum = _mm_setzero_ps();
+					for (int k = 0; k < 6; k++)
+						sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + x * 4), w[k]));
+					_mm_storeu_ps(out + x * 4, sum);
+				}
+			}
+		});
+	}
+
+public:
+	static const uint32_t MAGIC = 0x3150494D; // "MIP1"
+	static const uint32_t VERSION = 2;
+
+	//Name of the cooked file that sits next to a source image
+	static std::string cookedName(const char* fileName)
+	{
+		return std::string(fileName) + ".mip";
+	}
+
+	//Size and modification time of a source image; false if it can't be read
+	static bool sourceStamp(const std::string& srcFile, uint64_t& size, int64_t& time)
+	{
+		std::error_code error;
+		size = (uint64_t)std::filesystem::file_size(srcFile, error);
+		if (error)
+			return false;
+		time = (int64_t)std::filesystem::last_write_time(srcFile, error).time_since_epoch().count();
+		return !error;
+	}
+
+	//A cooked file is stale once its source changed. Without the source (cooked data shipped on its own) it is kept.
+	static bool isStale(const char* cookedFile, const MipFileHeader& header)
+	{
+		std::string name(cookedFile);
+		const std::string suffix = ".mip";
+		if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+			return false;
+		uint64_t size;
+		int64_t time;
+		if (!sourceStamp(name.substr(0, name.size() - suffix.size()), size, time))
+			return false;
+		return size != header.sourceSize || time != header.sourceTime;
+	}
+
+	static int levelCount(int width, int height)
+	{
+		int levels = 1;
+		while (width > 1 || height > 1)
+		{
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+			levels++;
+		}
+		return levels;
+	}
+
+	//Builds every level down to 1x1. Filtering happens in linear space when srgb is set,
+	//so colour textures don't darken towards the small mips. Rows are spread over up to maxThreads threads,
+	//0 for one per hardware thread.
+	static std::vector<MipLevel> generate(const unsigned char* pixels, int width, int height, int components,
+		MipFilter filter = MIP_FILTER_BOX, bool srgb = true, int maxThreads = 0)
+	{
+		std::vector<MipLevel> levels(levelCount(width, height));
+
+		levels[0].width = width;
+		levels[0].height = height;
+		levels[0].data.assign(pixels, pixels + (size_t)width * height * components);
+
+		FloatImage current, next;
+		decode(pixels, width, height, components, srgb, current);
+		for (size_t i = 1; i < levels.size(); i++)
+		{
+			if (filter == MIP_FILTER_KAISER)
+				downsampleKaiser(current, next, maxThreads);
+			else
+				downsampleBox(current, next, maxThreads);
+			encode(next, components, srgb, levels[i]);
+			std::swap(current, next);
+		}
+		return levels;
+	}
+
+	//srcFile is the image the levels came from, stamped into the header; nullptr for generated images
+	static bool writeCooked(const char* fileName, const std::vector<MipLevel>& levels, int components, const char* srcFile = nullptr)
+	{
+		std::ofstream file(fileName, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Failed to write cooked texture: " << fileName << std::endl;
+			return false;
+		}
+
+		MipFileHeader header = { MAGIC, VERSION, (uint32_t)levels[0].width, (uint32_t)levels[0].height, (uint32_t)components, (uint32_t)levels.size(), 0, 0 };
+		if (srcFile)
+			sourceStamp(srcFile, header.sourceSize, header.sourceTime);
+		std::vector<MipFileLevel> table(levels.size());
+		uint64_t offset = sizeof(MipFileHeader) + sizeof(MipFileLevel) * levels.size();
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			table[i] = { (uint32_t)levels[i].width, (uint32_t)levels[i].height, offset, levels[i].data.size() };
+			offset += levels[i].data.size();
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)table.data(), sizeof(MipFileLevel) * table.size());
+		for (const MipLevel& level : levels)
+			file.write((const char*)level.data.data(), level.data.size());
+		return (bool)file;
+	}
+
+	//Reads the header and level table only; false for other versions and for files older than their source
+	static bool readCookedHeader(const char* fileName, std::ifstream& file, MipFileHeader& header, std::vector<MipFileLevel>& table)
+	{
+		if (!file.read((char*)&header, sizeof(header)) || header.magic != MAGIC || header.version != VERSION || isStale(fileName, header))
+			return false;
+		table.resize(header.levelCount);
+		return (bool)file.read((char*)table.data(), sizeof(MipFileLevel) * table.size());
+	}
+
+	//Reads just the header and level table of a cooked file, to pick levels before loading any pixels
+	static bool readCookedInfo(const char* fileName, MipFileHeader& header, std::vector<MipFileLevel>& table)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		return file && readCookedHeader(fileName, file, header, table);
+	}
+
+	//Reads count levels starting at firstLevel (count < 0 reads to the end of the chain)
+	static bool readCooked(const char* fileName, std::vector<MipLevel>& levels, int& components, int firstLevel = 0, int count = -1)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file)
+			return false;
+
+		MipFileHeader header;
+		std::vector<MipFileLevel> table;
+		if (!readCookedHeader(fileName, file, header, table))
+		{
+			std::cout << "Cooked texture is stale or corrupt: " << fileName << std::endl;
+			return false;
+		}
+
+		components = (int)header.components;
+		firstLevel = std::min(firstLevel, (int)header.levelCount - 1);
+		int available = (int)header.levelCount - firstLevel;
+		levels.resize(count < 0 ? available : std::min(count, available));
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			const MipFileLevel& entry = table[firstLevel + i];
+			levels[i].width = (int)entry.width;
+			levels[i].height = (int)entry.height;
+			levels[i].data.resize((size_t)entry.size);
+			file.seekg((std::streamoff)entry.offset);
+			if (!file.read((char*)levels[i].data.data(), (std::streamsize)entry.size))
+				return false;
+		}
+		return true;
+	}
+
+	//Reads one level at an entry of a table from readCookedInfo, without parsing the header again
+	static bool readCookedLevel(const char* fileName, const MipFileLevel& entry, MipLevel& level)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file)
+			return false;
+		level.width = (int)entry.width;
+		level.height = (int)entry.height;
+		level.data.resize((size_t)entry.size);
+		file.seekg((std::streamoff)entry.offset);
+		return (bool)file.read((char*)level.data.data(), (std::streamsize)entry.size);
+	}
+
+	//Decodes a source image and writes its cooked mip chain. Images are flipped the same way Texture
+	//always loaded them, so cooked data uploads as-is.
+	static bool cookFile(const char* srcFile, const char* dstFile, MipFilter filter = MIP_FILTER_BOX, std::vector<MipLevel>* levelsOut = nullptr, int* componentsOut = nullptr,
+		int maxThreads = 0)
+	{
+		int width, height, components;
+		stbi_set_flip_vertically_on_load_thread(true);
+		unsigned char* data = stbi_load(srcFile, &width, &height, &components, 0);
+		if (!data)
+		{
+			std::cout << "Texture failed to load at path: " << srcFile << std::endl;
+			return false;
+		}
+
+		std::vector<MipLevel> levels = generate(data, width, height, components, filter, components >= 3, maxThreads);
+		stbi_image_free(data);
+
+		bool written = writeCooked(dstFile, levels, components, srcFile);
+		if (levelsOut)
+			*levelsOut = std::move(levels);
+		if (componentsOut)
+			*componentsOut = components;
+		return written;
+	}
+
+	//Asset build step: cooks every image next to its source, images spread across hardware threads.
+	//The hardware threads are shared out between the images in flight, so rows only go parallel
+	//when there are fewer images than threads.
+	static void cookFiles(const std::vector<std::string>& srcFiles, MipFilter filter = MIP_FILTER_BOX)
+	{
+		std::atomic<size_t> next(0);
+		std::vector<std::thread> workers;
+		size_t hardware = (size_t)std::max(1u, std::thread::hardware_concurrency());
+		size_t threads = std::min(srcFiles.size(), hardware);
+		int rowThreads = (int)std::max<size_t>(1, hardware / std::max<size_t>(threads, 1));
+		for (size_t t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&]()
+			{
+				for (size_t i = next++; i < srcFiles.size(); i = next++)
+					cookFile(srcFiles[i].c_str(), cookedName(srcFiles[i].c_str()).c_str(), filter, nullptr, nullptr, rowThreads);
+			});
+		}
+		for (auto& w : workers)
+			w.join();
+	}
+};
@@ -0,0 +1,676 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "Vertex.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "MeshNormals.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Wavefront OBJ/MTL importer: parses chunks of a memory mapped file in parallel and welds the result ////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct ObjMaterial
+{
+	std::string name;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float shininess;
+	//Full paths, empty when the material has no such map
+	std::string diffuseMap;
+	std::string specularMap;
+	std::string normalMap;
+};
+
+//Triangles drawn with one material, a range of ObjModel::indices
+struct ObjGroup
+{
+	//Into ObjModel::materials, -1 when the faces have no usemtl or the name isn't in any mtllib
+	int material;
+	unsigned indexOffset;
+	unsigned indexCount;
+};
+
+struct ObjModel
+{
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<ObjGroup> groups;
+	std::vector<ObjMaterial> materials;
+};
+
+class ObjLoader
+{
+private:
+	//Corner of a triangle as v/vt/vn indices, 0 based. -1 when the face leaves the attribute out.
+	struct Corner
+	{
+		int p, t, n;
+	};
+
+	//Negative OBJ indices count back from the current line, so they are kept chunk relative until
+	//the chunk's starting counts are known. Bit 0 position, 1 uv, 2 normal.
+	struct RawCorner
+	{
+		Corner c;
+		uint8_t relative;
+	};
+
+	struct ChunkGroup
+	{
+		//First triangle of the chunk using the material; an empty name continues the previous chunk's
+		unsigned triangle;
+		std::string material;
+		bool inherited;
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<float> positions, uvs, normals;
+		std::vector<RawCorner> raw;
+		std::vector<ChunkGroup> groups;
+		std::vector<std::string> libraries;
+
+		std::vector<Corner> corners;
+		size_t dropped;
+
+		//Welding: unique corners in first use order and each corner's index into them
+		std::vector<Corner> unique;
+		std::vector<GLuint> local;
+		//Per unique corner: the chunk and unique index of its first occurrence in the file
+		std::vector<uint32_t> ownerChunk, ownerIndex;
+		std::vector<GLuint> ownedRank;
+		size_t owned;
+		std::vector<GLuint> global;
+	};
+
+	static inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	static inline void skipSpace(const char*& p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+			p++;
+	}
+
+	static inline void skipLine(const char*& p, const char* end)
+	{
+		const char* newline = (const char*)std::memchr(p, '\n', end - p);
+		p = newline ? newline + 1 : end;
+	}
+
+	static std::string readName(const char*& p, const char* end)
+	{
+		skipSpace(p, end);
+		const char* start = p;
+		while (p < end && *p != '\n')
+			p++;
+		const char* last = p;
+		while (last > start && isSpace(last[-1]))
+			last--;
+		return std::string(start, last);
+	}
+
+	//Decimal float without locale or iostreams: integer mantissa scaled by a power of ten table.
+	//Exact for the up to 7 significant digits exporters write.
+	static float parseFloat(const char*& p, const char* end)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		skipSpace(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		while (p < end && isDigit(*p))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+			}
+			else
+				exponent++;
+			p++;
+		}
+		if (p < end && *p == '.')
+		{
+			p++;
+			while (p < end && isDigit(*p))
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+					if (mantissa)
+						digits++;
+				}
+				p++;
+			}
+		}
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negativeExponent = *p++ == '-';
+			int e = 0;
+			while (p < end && isDigit(*p))
+				e = std::min(e * 10 + (*p++ - '0'), 1000);
+			exponent += negativeExponent ? -e : e;
+		}
+		//nan, inf and other words read as 0
+		while (p < end && !isSpace(*p) && *p != '\n' && *p != '/')
+			p++;
+
+		double value = (double)mantissa;
+		if (exponent < 0)
+			value = exponent >= -22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+		else if (exponent > 0)
+			value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+		return (float)(negative ? -value : value);
+	}
+
+	static inline bool parseInt(const char*& p, const char* end, int& value)
+	{
+		bool negative = false;
+		if (p < end && *p == '-')
+		{
+			negative = true;
+			p++;
+		}
+		if (p >= end || !isDigit(*p))
+			return false;
+		int v = 0;
+		while (p < end && isDigit(*p))
+			v = v * 10 + (*p++ - '0');
+		value = negative ? -v : v;
+		return true;
+	}
+
+	//One index of a face corner; count is how many of that attribute the chunk has read so far
+	static inline int faceIndex(int value, int count, uint8_t bit, uint8_t& relative)
+	{
+		if (value > 0)
+			return value - 1;
+		relative |= bit;
+		return count + value;
+	}
+
+	static void parseChunk(Chunk& chunk)
+	{
+		const char* p = chunk.begin;
+		const char* end = chunk.end;
+		std::vector<RawCorner> face;
+		chunk.groups.push_back({ 0, std::string(), true });
+
+		while (p < end)
+		{
+			skipSpace(p, end);
+			if (p >= end)
+				break;
+			const char* line = p;
+
+			if (line[0] == 'v' && end - line > 1)
+			{
+				if (isSpace(line[1]))
+				{
+					p += 2;
+					for (int i = 0; i < 3; i++)
+						chunk.positions.push_back(parseFloat(p, end));
+				}
+				else if (line[1] == 't')
+				{
+					p += 2;
+					chunk.uvs.push_back(parseFloat(p, end));
+					chunk.uvs.push_back(parseFloat(p, end));
+				}
+				else if (line[1] == 'n')
+				{
+					p += 2;
+					for (int i = 0; i < 3; i++)
+						chunk.normals.push_back(parseFloat(p, end));
+				}
+			}
+			else if (line[0] == 'f' && end - line > 1 && isSpace(line[1]))
+			{
+				p += 2;
+				face.clear();
+				while (true)
+				{
+					skipSpace(p, end);
+					RawCorner corner = { { -1, -1, -1 }, 0 };
+					int value;
+					if (!parseInt(p, end, value) || value == 0)
+						break;
+					corner.c.p = faceIndex(value, (int)(chunk.positions.size() / 3), 1, corner.relative);
+					if (p < end && *p == '/')
+					{
+						p++;
+						if (parseInt(p, end, value) && value != 0)
+							corner.c.t = faceIndex(value, (int)(chunk.uvs.size() / 2), 2, corner.relative);
+						if (p < end && *p == '/')
+						{
+							p++;
+							if (parseInt(p, end, value) && value != 0)
+								corner.c.n = faceIndex(value, (int)(chunk.normals.size() / 3), 4, corner.relative);
+						}
+					}
+					face.push_back(corner);
+				}
+				//Polygons become triangle fans
+				for (size_t i = 2; i < face.size(); i++)
+				{
+					chunk.raw.push_back(face[0]);
+					chunk.raw.push_back(face[i - 1]);
+					chunk.raw.push_back(face[i]);
+				}
+			}
+			else if (end - line > 6 && std::strncmp(line, "usemtl", 6) == 0 && isSpace(line[6]))
+			{
+				p += 6;
+				unsigned triangle = (unsigned)(chunk.raw.size() / 3);
+				if (chunk.groups.back().triangle == triangle)
+					chunk.groups.pop_back();
+				chunk.groups.push_back({ triangle, readName(p, end), false });
+			}
+			else if (end - line > 6 && std::strncmp(line, "mtllib", 6) == 0 && isSpace(line[6]))
+			{
+				p += 6;
+				chunk.libraries.push_back(readName(p, end));
+			}
+			skipLine(p, end);
+		}
+	}
+
+	//Applies the chunk's starting counts to relative indices and drops triangles referencing missing data
+	static void resolveChunk(Chunk& chunk, int positionBase, int uvBase, int normalBase, int positionCount, int uvCount, int normalCount)
+	{
+		chunk.corners.clear();
+		chunk.corners.reserve(chunk.raw.size());
+		chunk.dropped = 0;
+		size_t group = 0;
+		for (size_t i = 0; i < chunk.raw.size(); i += 3)
+		{
+			Corner tri[3];
+			bool valid = true;
+			for (int k = 0; k < 3; k++)
+			{
+				const RawCorner& r = chunk.raw[i + k];
+				tri[k] = r.c;
+				if (r.relative & 1) tri[k].p += positionBase;
+				if (r.relative & 2) tri[k].t += uvBase;
+				if (r.relative & 4) tri[k].n += normalBase;
+				valid = valid && tri[k].p >= 0 && tri[k].p < positionCount
+					&& tri[k].t >= -1 && tri[k].t < uvCount && tri[k].n >= -1 && tri[k].n < normalCount;
+			}
+
+			//Group starts count kept triangles only
+			unsigned triangle = (unsigned)(i / 3);
+			while (group < chunk.groups.size() && chunk.groups[group].triangle == triangle)
+				chunk.groups[group++].triangle = (unsigned)(chunk.corners.size() / 3);
+
+			if (!valid)
+			{
+				chunk.dropped++;
+				continue;
+			}
+			chunk.corners.insert(chunk.corners.end(), tri, tri + 3);
+		}
+		for (; group < chunk.groups.size(); group++)
+			chunk.groups[group].triangle = (unsigned)(chunk.corners.size() / 3);
+		std::vector<RawCorner>().swap(chunk.raw);
+	}
+
+	static inline uint32_t hashCorner(const Corner& c)
+	{
+		uint32_t h = (uint32_t)c.p * 0x9e3779b1u ^ (uint32_t)c.t * 0x85ebca77u ^ (uint32_t)c.n * 0xc2b2ae3du;
+		return h ^ (h >> 16);
+	}
+
+	static inline bool sameCorner(const Corner& a, const Corner& b)
+	{
+		return a.p == b.p && a.t == b.t && a.n == b.n;
+	}
+
+	//Open addressing table over a list of corners, kept at most half full
+	struct CornerTable
+	{
+		std::vector<GLuint> slots;
+		size_t mask;
+
+		explicit CornerTable(size_t count)
+		{
+			size_t capacity = 16;
+			while (capacity < count * 2)
+				capacity *= 2;
+			slots.assign(capacity, UINT32_MAX);
+			mask = capacity - 1;
+		}
+
+		//Index of an equal corner already in list, or UINT32_MAX after claiming a slot for newIndex
+		GLuint findOrInsert(const Corner& c, const std::vector<Corner>& list, GLuint newIndex)
+		{
+			size_t slot = hashCorner(c) & mask;
+			while (slots[slot] != UINT32_MAX)
+			{
+				if (sameCorner(list[slots[slot]], c))
+					return slots[slot];
+				slot = (slot + 1) & mask;
+			}
+			slots[slot] = newIndex;
+			return UINT32_MAX;
+		}
+	};
+
+	static void weldChunk(Chunk& chunk)
+	{
+		chunk.unique.clear();
+		chunk.local.resize(chunk.corners.size());
+		CornerTable table(chunk.corners.size());
+		for (size_t i = 0; i < chunk.corners.size(); i++)
+		{
+			GLuint found = table.findOrInsert(chunk.corners[i], chunk.unique, (GLuint)chunk.unique.size());
+			if (found == UINT32_MAX)
+			{
+				found = (GLuint)chunk.unique.size();
+				chunk.unique.push_back(chunk.corners[i]);
+			}
+			chunk.local[i] = found;
+		}
+		std::vector<Corner>().swap(chunk.corners);
+	}
+
+	static void loadMaterials(const std::string& fileName, const std::string& directory, std::vector<ObjMaterial>& materials)
+	{
+		MappedFile file(fileName.c_str());
+		if (!file.isOpen())
+		{
+			std::cout << "Material library failed to load at path: " << fileName << std::endl;
+			return;
+		}
+
+		const char* p = file.getData();
+		const char* end = p + file.getSize();
+		auto readColor = [&]() { float r = parseFloat(p, end); float g = parseFloat(p, end); float b = parseFloat(p, end); return glm::vec3(r, g, b); };
+		//Map statements may carry options before the file name, which is always last
+		auto readMap = [&]()
+		{
+			std::string name = readName(p, end);
+			size_t space = name.find_last_of(" \t");
+			if (space != std::string::npos)
+				name = name.substr(space + 1);
+			return name.empty() ? name : directory + name;
+		};
+
+		while (p < end)
+		{
+			skipSpace(p, end);
+			const char* token = p;
+			while (p < end && !isSpace(*p) && *p != '\n')
+				p++;
+			std::string key(token, p);
+
+			if (key == "newmtl")
+			{
+				ObjMaterial m;
+				m.name = readName(p, end);
+				m.ambient = glm::vec3(0.f);
+				m.diffuse = glm::vec3(0.8f);
+				m.specular = glm::vec3(0.f);
+				m.shininess = 32.f;
+				materials.push_back(m);
+			}
+			else if (!materials.empty())
+			{
+				ObjMaterial& m = materials.back();
+				if (key == "Ka") m.ambient = readColor();
+				else if (key == "Kd") m.diffuse = readColor();
+				else if (key == "Ks") m.specular = readColor();
+				else if (key == "Ns") m.shininess = parseFloat(p, end);
+				else if (key == "map_Kd") m.diffuseMap = readMap();
+				else if (key == "map_Ks") m.specularMap = readMap();
+				else if (key == "map_Bump" || key == "map_bump" || key == "bump" || key == "norm") m.normalMap = readMap();
+			}
+			skipLine(p, end);
+		}
+	}
+
+public:
+	//Loads an OBJ and the MTL libraries it references into welded vertices and 32 bit indices, grouped by material.
+	//Corners with the same v/vt/vn triple become one vertex; faces with more than 3 corners are fanned.
+	//Missing uvs are left 0; files without any normals get smooth ones generated, corners missing
+	//theirs in a file that has some are left 0. Returns false if the file can't be opened or has no triangles.
+	static bool load(const char* fileName, ObjModel& model)
+	{
+		model = ObjModel();
+		MappedFile file(fileName);
+		if (!file.isOpen())
+		{
+			std::cout << "OBJ failed to load at path: " << fileName << std::endl;
+			return false;
+		}
+
+		//Chunks of at least 1MB, each ending after a newline
+		const char* data = file.getData();
+		size_t size = file.getSize();
+		size_t chunkCount = Parallel::workerCount(size, 1 << 20);
+		std::vector<Chunk> chunks(chunkCount);
+		const char* cursor = data;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			chunks[i].begin = cursor;
+			const char* target = i + 1 == chunkCount ? data + size : std::max(cursor, data + size * (i + 1) / chunkCount);
+			if (target < data + size)
+				skipLine(target, data + size);
+			chunks[i].end = target;
+			cursor = target;
+		}
+
+		Parallel::parallelFor(chunkCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+				parseChunk(chunks[c]);
+		});
+
+		//Attribute arrays are concatenated in file order
+		std::vector<int> positionBase(chunkCount), uvBase(chunkCount), normalBase(chunkCount);
+		std::vector<float> positions, uvs, normals;
+		for (size_t c = 0; c < chunkCount; c++)
+		{
+			positionBase[c] = (int)(positions.size() / 3);
+			uvBase[c] = (int)(uvs.size() / 2);
+			normalBase[c] = (int)(normals.size() / 3);
+			positions.insert(positions.end(), chunks[c].positions.begin(), chunks[c].positions.end());
+			uvs.insert(uvs.end(), chunks[c].uvs.begin(), chunks[c].uvs.end());
+			normals.insert(normals.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+			std::vector<float>().swap(chunks[c].positions);
+			std::vector<float>().swap(chunks[c].uvs);
+			std::vector<float>().swap(chunks[c].normals);
+		}
+		int positionCount = (int)(positions.size() / 3), uvCount = (int)(uvs.size() / 2), normalCount = (int)(normals.size() / 3);
+
+		Parallel::parallelFor(chunkCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				resolveChunk(chunks[c], positionBase[c], uvBase[c], normalBase[c], positionCount, uvCount, normalCount);
+				weldChunk(chunks[c]);
+			}
+		});
+
+		//Corners repeated across chunks are welded in shards by hash. Within a shard the first
+		//occurrence in file order owns the vertex, so the result matches a serial weld.
+		size_t shardCount = chunkCount;
+		std::vector<std::vector<std::vector<GLuint>>> byShard(chunkCount, std::vector<std::vector<GLuint>>(shardCount));
+		Parallel::parallelFor(chunkCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				chunks[c].ownerChunk.resize(chunks[c].unique.size());
+				chunks[c].ownerIndex.resize(chunks[c].unique.size());
+				for (size_t u = 0; u < chunks[c].unique.size(); u++)
+					byShard[c][hashCorner(chunks[c].unique[u]) % shardCount].push_back((GLuint)u);
+			}
+		});
+		Parallel::parallelFor(shardCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t s = begin; s < end; s++)
+			{
+				size_t total = 0;
+				for (size_t c = 0; c < chunkCount; c++)
+					total += byShard[c][s].size();
+				CornerTable table(total);
+				std::vector<Corner> firsts;
+				std::vector<std::pair<uint32_t, uint32_t>> owners;
+				for (size_t c = 0; c < chunkCount; c++)
+				{
+					for (GLuint u : byShard[c][s])
+					{
+						GLuint found = table.findOrInsert(chunks[c].unique[u], firsts, (GLuint)firsts.size());
+						if (found == UINT32_MAX)
+						{
+							found = (GLuint)firsts.size();
+							firsts.push_back(chunks[c].unique[u]);
+							owners.push_back({ (uint32_t)c, (uint32_t)u });
+						}
+						chunks[c].ownerChunk[u] = owners[found].first;
+						chunks[c].ownerIndex[u] = owners[found].second;
+					}
+				}
+			}
+		});
+		byShard.clear();
+
+		Parallel::parallelFor(chunkCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				Chunk& chunk = chunks[c];
+				chunk.ownedRank.assign(chunk.unique.size(), UINT32_MAX);
+				chunk.owned = 0;
+				for (size_t u = 0; u < chunk.unique.size(); u++)
+				{
+					if (chunk.ownerChunk[u] == c && chunk.ownerIndex[u] == u)
+						chunk.ownedRank[u] = (GLuint)chunk.owned++;
+				}
+			}
+		});
+
+		std::vector<size_t> vertexBase(chunkCount), indexBase(chunkCount);
+		size_t vertexCount = 0, indexCount = 0, dropped = 0;
+		for (size_t c = 0; c < chunkCount; c++)
+		{
+			vertexBase[c] = vertexCount;
+			indexBase[c] = indexCount;
+			vertexCount += chunks[c].owned;
+			indexCount += chunks[c].local.size();
+			dropped += chunks[c].dropped;
+		}
+		if (dropped)
+			std::cout << "OBJ " << fileName << ": skipped " << dropped << " faces with out of range indices" << std::endl;
+		if (indexCount == 0)
+		{
+			std::cout << "OBJ has no faces: " << fileName << std::endl;
+			return false;
+		}
+
+		model.vertices.resize(vertexCount);
+		model.indices.resize(indexCount);
+		Parallel::parallelFor(chunkCount, 1, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				Chunk& chunk = chunks[c];
+				chunk.global.resize(chunk.unique.size());
+				for (size_t u = 0; u < chunk.unique.size(); u++)
+				{
+					const Chunk& owner = chunks[chunk.ownerChunk[u]];
+					GLuint id = (GLuint)(vertexBase[chunk.ownerChunk[u]] + owner.ownedRank[chunk.ownerIndex[u]]);
+					chunk.global[u] = id;
+					if (chunk.ownedRank[u] == UINT32_MAX)
+						continue;
+
+					const Corner& corner = chunk.unique[u];
+					Vertex& v = model.vertices[id];
+					v.position = glm::vec3(positions[corner.p * 3], positions[corner.p * 3 + 1], positions[corner.p * 3 + 2]);
+					v.normal = corner.n >= 0 ? glm::vec3(normals[corner.n * 3], normals[corner.n * 3 + 1], normals[corner.n * 3 + 2]) : glm::vec3(0.f);
+					v.texcoord = corner.t >= 0 ? glm::vec3(uvs[corner.t * 2], uvs[corner.t * 2 + 1], 0.f) : glm::vec3(0.f);
+				}
+				GLuint* out = model.indices.data() + indexBase[c];
+				for (size_t i = 0; i < chunk.local.size(); i++)
+					out[i] = chunk.global[chunk.local[i]];
+			}
+		});
+
+		//CAD exports often leave out normals; corners then weld by position and uv, so these come out smooth
+		if (normalCount == 0)
+			MeshNormals::generateNormals(model.vertices, model.indices);
+
+		//Materials from every mtllib, then groups in file order with each chunk continuing the last usemtl before it
+		std::string path(fileName);
+		size_t slash = path.find_last_of("/\\");
+		std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+		std::vector<std::string> libraries;
+		for (const Chunk& chunk : chunks)
+		{
+			for (const std::string& library : chunk.libraries)
+			{
+				if (std::find(libraries.begin(), libraries.end(), library) == libraries.end())
+				{
+					libraries.push_back(library);
+					loadMaterials(directory + library, directory, model.materials);
+				}
+			}
+		}
+		std::unordered_map<std::string, int> materialIndex;
+		for (size_t i = 0; i < model.materials.size(); i++)
+			materialIndex.emplace(model.materials[i].name, (int)i);
+
+		int material = -1;
+		for (size_t c = 0; c < chunkCount; c++)
+		{
+			const Chunk& chunk = chunks[c];
+			for (size_t g = 0; g < chunk.groups.size(); g++)
+			{
+				const ChunkGroup& group = chunk.groups[g];
+				if (!group.inherited)
+				{
+					auto found = materialIndex.find(group.material);
+					material = found == materialIndex.end() ? -1 : found->second;
+				}
+				unsigned next = g + 1 < chunk.groups.size() ? chunk.groups[g + 1].triangle : (unsigned)(chunk.local.size() / 3);
+				unsigned count = (next - group.triangle) * 3;
+				if (count == 0)
+					continue;
+				unsigned offset = (unsigned)indexBase[c] + group.triangle * 3;
+				if (!model.groups.empty() && model.groups.back().material == material)
+					model.groups.back().indexCount += count;
+				else
+					model.groups.push_back({ material, offset, count });
+			}
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+#include <emmintrin.h>
+
+#include <glm.hpp>
+
+#include "Mesh.h"
+#include "Bounds.h"
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// CPU occlusion culling: occluders rasterized into a small depth buffer, objects tested by screen rectangle /
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Depth is stored as 1/w, so nearer is larger and an empty buffer is all zeros. Every 8x8 block also keeps its
+//farthest depth, which rejects most of an object's rectangle without looking at single pixels.
+class OcclusionCuller
+{
+private:
+	//Occluder geometry copied out of a mesh once, so meshes can free or stream theirs
+	struct OccluderMesh
+	{
+		//Mesh::getIndexRevision when copied; a different one means new geometry (or a new mesh at the same address)
+		uint64_t revision;
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	struct Instance
+	{
+		const OccluderMesh* mesh;
+		glm::mat4 model;
+	};
+
+	//A triangle after clipping, in pixels with 1/w
+	struct ScreenTriangle
+	{
+		float x[3], y[3], z[3];
+	};
+
+	static const int BLOCK = 8;
+	static const int TILE_WIDTH = 64;
+	static const int TILE_HEIGHT = 16;
+	//Tiles plus binned triangles a thread has to get before starting it pays off
+	static const size_t MIN_TILE_WORK_PER_WORKER = 512;
+
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+	std::vector<float> depth;
+	std::vector<float> blockDepth;
+	glm::mat4 viewProjection;
+
+	std::unordered_map<const Mesh*, OccluderMesh> occluderMeshes;
+	std::vector<Instance> instances;
+	//Per worker: its clipped triangles, and for every tile the ones it overlaps
+	std::vector<std::vector<ScreenTriangle>> workerTriangles;
+	std::vector<std::vector<std::vector<uint32_t>>> workerBins;
+
+	size_t triangleCount;
+
+	inline glm::vec2 toScreen(const glm::vec4& clip) const
+	{
+		float inverseW = 1.f / clip.w;
+		return glm::vec2((clip.x * inverseW * 0.5f + 0.5f) * this->width, (clip.y * inverseW * 0.5f + 0.5f) * this->height);
+	}
+
+	//Clips against the near plane (z = -w), then adds the triangle's fan to the bins of the tiles it overlaps
+	void binTriangle(const glm::vec4* clip, std::vector<ScreenTriangle>& triangles, std::vector<std::vector<uint32_t>>& bins) const
+	{
+		for (int plane = 0; plane < 4; plane++)
+		{
+			//Trivially outside one of the side planes
+			int axis = plane >> 1;
+			float sign = (plane & 1) ? -1.f : 1.f;
+			if (sign * clip[0][axis] > clip[0].w && sign * clip[1][axis] > clip[1].w && sign * clip[2][axis] > clip[2].w)
+				return;
+		}
+
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4& a = clip[i];
+			const glm::vec4& b = clip[(i + 1) % 3];
+			float da = a.z + a.w;
+			float db = b.z + b.w;
+			if (da >= 0.f)
+				polygon[count++] = a;
+			if ((da >= 0.f) != (db >= 0.f))
+				polygon[count++] = a + (b - a) * (da / (da - db));
+		}
+
+		for (int i = 1; i + 1 < count; i++)
+		{
+			ScreenTriangle triangle;
+			const glm::vec4* corners[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+			for (int v = 0; v < 3; v++)
+			{
+				glm::vec2 screen = this->toScreen(*corners[v]);
+				triangle.x[v] = screen.x;
+				triangle.y[v] = screen.y;
+				triangle.z[v] = 1.f / corners[v]->w;
+			}
+			float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+			if (area == 0.f)
+				continue;
+
+			float minX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+			float maxX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+			float minY = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+			float maxY = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+			if (maxX < 0.f || maxY < 0.f || minX >= this->width || minY >= this->height)
+				continue;
+			int tx0 = std::max(0, (int)minX / TILE_WIDTH);
+			int tx1 = std::min(this->tilesX - 1, (int)std::min(maxX, (float)this->width - 1) / TILE_WIDTH);
+			int ty0 = std::max(0, (int)minY / TILE_HEIGHT);
+			int ty1 = std::min(this->tilesY - 1, (int)std::min(maxY, (float)this->height - 1) / TILE_HEIGHT);
+
+			uint32_t index = (uint32_t)triangles.size();
+			triangles.push_back(triangle);
+			for (int ty = ty0; ty <= ty1; ty++)
+				for (int tx = tx0; tx <= tx1; tx++)
+					bins[ty * this->tilesX + tx].push_back(index);
+		}
+	}
+
+	//Half space rasterization at pixel centers, four pixels of a row per step, keeping the nearest depth
+	void rasterize(const ScreenTriangle& t, int x0, int y0, int x1, int y1)
+	{
+		float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+		//Both windings are drawn, so flip clockwise triangles' edges to face inwards
+		float orient = area > 0.f ? 1.f : -1.f;
+
+		float minX = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+		float maxX = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+		float minY = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+		float maxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+		x0 = std::max(x0, (int)std::floor(minX)) & ~3;
+		x1 = std::min(x1, (int)std::ceil(maxX));
+		y0 = std::max(y0, (int)std::floor(minY));
+		y1 = std::min(y1, (int)std::ceil(maxY));
+		if (x0 >= x1 || y0 >= y1)
+			return;
+
+		//Edge i is the one opposite vertex i, positive inside
+		float a[3], b[3], c[3];
+		for (int i = 0; i < 3; i++)
+		{
+			int j = (i + 1) % 3, k = (i + 2) % 3;
+			a[i] = (t.y[j] - t.y[k]) * orient;
+			b[i] = (t.x[k] - t.x[j]) * orient;
+			c[i] = (t.x[j] * t.y[k] - t.x[k] * t.y[j]) * orient;
+		}
+		//1/w is linear in screen space
+		float inverseArea = 1.f / (area * orient);
+		float dzdx = (a[0] * t.z[0] + a[1] * t.z[1] + a[2] * t.z[2]) * inverseArea;
+		float dzdy = (b[0] * t.z[0] + b[1] * t.z[1] + b[2] * t.z[2]) * inverseArea;
+		float z0 = (c[0] * t.z[0] + c[1] * t.z[1] + c[2] * t.z[2]) * inverseArea;
+
+		__m128 steps = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		__m128 edgeA[3], edgeStep[3];
+		for (int i = 0; i < 3; i++)
+		{
+			edgeA[i] = _mm_mul_ps(_mm_set1_ps(a[i]), steps);
+			edgeStep[i] = _mm_set1_ps(a[i] * 4.f);
+		}
+		__m128 depthA = _mm_mul_ps(_mm_set1_ps(dzdx), steps);
+		__m128 depthStep = _mm_set1_ps(dzdx * 4.f);
+		__m128 zero = _mm_setzero_ps();
+
+		for (int y = y0; y < y1; y++)
+		{
+			float py = y + 0.5f;
+			__m128 e0 = _mm_add_ps(_mm_set1_ps(a[0] * x0 + b[0] * py + c[0]), edgeA[0]);
+			__m128 e1 = _mm_add_ps(_mm_set1_ps(a[1] * x0 + b[1] * py + c[1]), edgeA[1]);
+			__m128 e2 = _mm_add_ps(_mm_set1_ps(a[2] * x0 + b[2] * py + c[2]), edgeA[2]);
+			__m128 z = _mm_add_ps(_mm_set1_ps(dzdx * x0 + dzdy * py + z0), depthA);
+			float* row = &this->depth[(size_t)y * this->width];
+			for (int x = x0; x < x1; x += 4)
+			{
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside))
+				{
+					__m128 current = _mm_loadu_ps(row + x);
+					__m128 nearer = _mm_max_ps(current, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+				}
+				e0 = _mm_add_ps(e0, edgeStep[0]);
+				e1 = _mm_add_ps(e1, edgeStep[1]);
+				e2 = _mm_add_ps(e2, edgeStep[2]);
+				z = _mm_add_ps(z, depthStep);
+			}
+		}
+	}
+
+	void updateBlocks(int tileX, int tileY)
+	{
+		int blocksX = this->width / BLOCK;
+		for (int by = tileY * TILE_HEIGHT / BLOCK; by < (tileY + 1) * TILE_HEIGHT / BLOCK; by++)
+			for (int bx = tileX * TILE_WIDTH / BLOCK; bx < (tileX + 1) * TILE_WIDTH / BLOCK; bx++)
+			{
+				__m128 farthest = _mm_set1_ps(FLT_MAX);
+				for (int y = by * BLOCK; y < (by + 1) * BLOCK; y++)
+				{
+					const float* row = &this->depth[(size_t)y * this->width + bx * BLOCK];
+					farthest = _mm_min_ps(farthest, _mm_min_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4)));
+				}
+				farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+				farthest = _mm_min_ss(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+				this->blockDepth[by * blocksX + bx] = _mm_cvtss_f32(farthest);
+			}
+	}
+
+public:
+	//The buffer is low resolution on purpose; sizes are rounded up to whole tiles
+	OcclusionCuller(int width = 256, int height = 128) : triangleCount(0)
+	{
+		this->tilesX = std::max(1, (width + TILE_WIDTH - 1) / TILE_WIDTH);
+		this->tilesY = std::max(1, (height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+		this->width = this->tilesX * TILE_WIDTH;
+		this->height = this->tilesY * TILE_HEIGHT;
+		this->depth.assign((size_t)this->width * this->height, 0.f);
+		this->blockDepth.assign((size_t)(this->width / BLOCK) * (this->height / BLOCK), 0.f);
+		this->viewProjection = glm::mat4(1.f);
+	}
+
+	OcclusionCuller(const OcclusionCuller&) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+	//Starts a frame: forgets last frame's occluders
+	void begin(const glm::mat4& viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		this->instances.clear();
+	}
+
+	//Queues mesh to be drawn as an occluder. Its full detail triangles are copied the first time it is used,
+	//and again whenever its index revision changes.
+	void addOccluder(const Mesh& mesh, const glm::mat4& model)
+	{
+		OccluderMesh& occluder = this->occluderMeshes[&mesh];
+		if (occluder.positions.empty() || occluder.revision != mesh.getIndexRevision())
+		{
+			occluder.revision = mesh.getIndexRevision();
+			occluder.positions.clear();
+			occluder.indices.clear();
+			const Vertex* vertices = mesh.getVertices();
+			if (vertices)
+			{
+				occluder.positions.resize(mesh.getVertexCount());
+				for (size_t i = 0; i < occluder.positions.size(); i++)
+					occluder.positions[i] = vertices[i].position;
+				std::vector<GLuint> indices = mesh.getLodIndices(0);
+				occluder.indices.assign(indices.begin(), indices.end());
+			}
+		}
+		if (!occluder.indices.empty())
+			this->instances.push_back({ &occluder, model });
+	}
+
+	//Frees the copied geometry, e.g. after unloading a level
+	void clearOccluderMeshes() { this->occluderMeshes.clear(); }
+
+	//Transforms and bins the occluders' triangles on worker threads, then rasterizes each tile on its own thread
+	void render()
+	{
+		size_t triangles = 0;
+		for (const Instance& instance : this->instances)
+			triangles += instance.mesh->indices.size() / 3;
+
+		//Instances are split by triangle count so one big occluder doesn't end up on a single worker
+		std::vector<size_t> firstTriangle(this->instances.size() + 1, 0);
+		for (size_t i = 0; i < this->instances.size(); i++)
+			firstTriangle[i + 1] = firstTriangle[i] + this->instances[i].mesh->indices.size() / 3;
+
+		size_t tiles = (size_t)this->tilesX * this->tilesY;
+		size_t workers = Parallel::workerCount(triangles, 256);
+		this->workerTriangles.resize(std::max(workers, this->workerTriangles.size()));
+		this->workerBins.resize(this->workerTriangles.size());
+		for (size_t w = 0; w < this->workerTriangles.size(); w++)
+		{
+			this->workerTriangles[w].clear();
+			this->workerBins[w].resize(tiles);
+			for (auto& bin : this->workerBins[w])
+				bin.clear();
+		}
+
+		Parallel::parallelFor(triangles, 256, [&](size_t worker, size_t begin, size_t end)
+		{
+			size_t instance = std::upper_bound(firstTriangle.begin(), firstTriangle.end(), begin) - firstTriangle.begin() - 1;
+			for (size_t t = begin; t < end; t++)
+			{
+				while (t >= firstTriangle[instance + 1])
+					instance++;
+				const Instance& occluder = this->instances[instance];
+				glm::mat4 transform = this->viewProjection * occluder.model;
+				const uint32_t* index = &occluder.mesh->indices[(t - firstTriangle[instance]) * 3];
+				glm::vec4 clip[3];
+				for (int v = 0; v < 3; v++)
+					clip[v] = transform * glm::vec4(occluder.mesh->positions[index[v]], 1.f);
+				this->binTriangle(clip, this->workerTriangles[worker], this->workerBins[worker]);
+			}
+		});
+
+		//Every tile is cleared and reduced, and every binned triangle rasterized; small scenes stay on this thread
+		size_t tileWork = tiles;
+		for (size_t w = 0; w < workers; w++)
+		{
+			for (const auto& bin : this->workerBins[w])
+				tileWork += bin.size();
+		}
+		size_t minTilesPerWorker = (tiles * MIN_TILE_WORK_PER_WORKER + tileWork - 1) / tileWork;
+
+		std::fill(this->depth.begin(), this->depth.end(), 0.f);
+		Parallel::parallelFor(tiles, minTilesPerWorker, [&](size_t, size_t begin, size_t end)
+		{
+			for (size_t tile = begin; tile < end; tile++)
+			{
+				int tx = (int)(tile % this->tilesX), ty = (int)(tile / this->tilesX);
+				int x0 = tx * TILE_WIDTH, y0 = ty * TILE_HEIGHT;
+				//Keeping the nearest depth doesn't depend on order, so workers' bins can go in any order
+				for (size_t w = 0; w < workers; w++)
+				{
+					for (uint32_t index : this->workerBins[w][tile])
+						this->rasterize(this->workerTriangles[w][index], x0, y0, x0 + TILE_WIDTH, y0 + TILE_HEIGHT);
+				}
+				this->updateBlocks(tx, ty);
+			}
+		});
+
+		this->triangleCount = triangles;
+	}
+
+	//True when the box is certainly hidden behind the occluders. Boxes crossing the near plane or off screen
+	//return false; leaving those out is the frustum's job. Safe to call from several threads after render.
+	bool isOccluded(const AABB& box) const
+	{
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 0.f;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			glm::vec4 clip = this->viewProjection * glm::vec4(corner, 1.f);
+			if (clip.z < -clip.w)
+				return false;
+			glm::vec2 screen = this->toScreen(clip);
+			minX = std::min(minX, screen.x);
+			maxX = std::max(maxX, screen.x);
+			minY = std::min(minY, screen.y);
+			maxY = std::max(maxY, screen.y);
+			nearest = std::max(nearest, 1.f / clip.w);
+		}
+
+		//Occluders only cover the pixels whose centers they cover, so the pixel centers just outside the
+		//rectangle are tested too; an occluder edge passing through the rectangle then always shows up
+		int x0 = std::max(0, (int)std::floor(minX - 0.5f)), x1 = std::min(this->width, (int)std::ceil(maxX + 0.5f));
+		int y0 = std::max(0, (int)std::floor(minY - 0.5f)), y1 = std::min(this->height, (int)std::ceil(maxY + 0.5f));
+		if (x0 >= x1 || y0 >= y1)
+			return false;
+
+		int blocksX = this->width / BLOCK;
+		__m128 nearest4 = _mm_set1_ps(nearest);
+		for (int by = y0 / BLOCK; by <= (y1 - 1) / BLOCK; by++)
+			for (int bx = x0 / BLOCK; bx <= (x1 - 1) / BLOCK; bx++)
+			{
+				if (nearest < this->blockDepth[by * blocksX + bx])
+					continue;
+				//Some of the block is as far as the box, so look at the pixels the rectangle covers
+				int px0 = std::max(x0, bx * BLOCK), px1 = std::min(x1, (bx + 1) * BLOCK);
+				int py0 = std::max(y0, by * BLOCK), py1 = std::min(y1, (by + 1) * BLOCK);
+				for (int y = py0; y < py1; y++)
+				{
+					const float* row = &this->depth[(size_t)y * this->width];
+					for (int x = px0 & ~3; x < px1; x += 4)
+					{
+						int lanes = _mm_movemask_ps(_mm_cmpge_ps(nearest4, _mm_loadu_ps(row + x)));
+						//Only lanes inside [px0, px1) count
+						int valid = (0xF << std::max(0, px0 - x)) & (0xF >> std::max(0, x + 4 - px1)) & 0xF;
+						if (lanes & valid)
+							return false;
+					}
+				}
+			}
+		return true;
+	}
+
+	inline int getWidth() const { return this->width; }
+	inline int getHeight() const { return this->height; }
+	inline const float* getDepth() const { return this->depth.data(); }
+	inline size_t getTriangleCount() const { return this->triangleCount; }
+	inline size_t getOccluderCount() const { return this->instances.size(); }
+};
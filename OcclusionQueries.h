@@ -0,0 +1,339 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include "glad/glad.h"
+
+#include "Shader.h"
+#include "Camera.h"
+#include "Bounds.h"
+#include "Bvh.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// GPU occlusion culling with hardware queries on BVH nodes, read back a frame late ///////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Coherent hierarchical culling in the style of CHC++. Each node is open (its children are traversed) or closed
+//(hidden as a whole). Closed nodes in the frustum get a bounding box query; when it comes back visible a frame
+//or more later, the node opens. Open leaves are drawn, and every few frames are queried again under conditional
+//rendering, so the GPU skips them the moment they are hidden. An open node whose children all closed closes too.
+class OcclusionQueries
+{
+private:
+	struct NodeState
+	{
+		GLuint query;
+		uint32_t queryFrame;
+		uint32_t nextQueryFrame;
+		//Last frame the node was in the frustum
+		uint32_t visitFrame;
+		//Items drawn under conditional rendering with the pending query, skipped if it comes back hidden
+		uint32_t conditionalItems;
+		bool open;
+		bool pending;
+		double issueTime;
+	};
+
+	std::vector<NodeState> states;
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> pendingNodes;
+	std::vector<GLuint> freeQueries;
+	uint32_t bvhBuild;
+	uint32_t frame;
+	uint32_t visibleInterval;
+
+	GLuint boxVAO;
+	GLuint boxVBO;
+	GLuint boxEBO;
+
+	//Last frame's numbers
+	uint32_t queriesIssued;
+	uint32_t resultsRead;
+	float latencyFrames;
+	float latencyMs;
+	uint32_t itemsInFrustum;
+	uint32_t itemsSkipped;
+
+	static double now()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	GLuint acquireQuery()
+	{
+		if (this->freeQueries.empty())
+		{
+			this->freeQueries.resize(64);
+			glGenQueries((GLsizei)this->freeQueries.size(), this->freeQueries.data());
+		}
+		GLuint query = this->freeQueries.back();
+		this->freeQueries.pop_back();
+		return query;
+	}
+
+	//Visible leaves are queried again after the interval, staggered per node so the queries spread over frames
+	inline uint32_t requeryFrame(uint32_t node) const
+	{
+		return this->frame + this->visibleInterval + (node * 2654435761u >> 16) % this->visibleInterval;
+	}
+
+	void reset(const Bvh& bvh)
+	{
+		for (uint32_t node : this->pendingNodes)
+			this->freeQueries.push_back(this->states[node].query);
+		this->pendingNodes.clear();
+		//Everything starts open, so nothing is hidden until a query says so
+		this->states.assign(bvh.getNodeCount(), { 0, 0, 0, 0, 0, true, false, 0.0 });
+		for (uint32_t node = 0; node < this->states.size(); node++)
+			this->states[node].nextQueryFrame = this->requeryFrame(node);
+		const std::vector<BvhNode>& nodes = bvh.getNodes();
+		this->parents.assign(nodes.size(), 0);
+		for (uint32_t node = 0; node < nodes.size(); node++)
+		{
+			if (nodes[node].count & BVH_INTERIOR)
+				this->parents[nodes[node].first] = this->parents[nodes[node].first + 1] = node;
+		}
+		this->bvhBuild = bvh.getBuildCount();
+	}
+
+	//Closes the ancestors of a node that just closed, up to the first one with a child still open in the frustum.
+	//Children that were outside the frustum last frame don't keep their parent open.
+	void pullUp(const Bvh& bvh, uint32_t node)
+	{
+		const std::vector<BvhNode>& nodes = bvh.getNodes();
+		uint32_t last = this->frame - 1;
+		while (node != 0)
+		{
+			node = this->parents[node];
+			NodeState& state = this->states[node];
+			const NodeState& left = this->states[nodes[node].first];
+			const NodeState& right = this->states[nodes[node].first + 1];
+			if (!state.open || (left.open && left.visitFrame == last) || (right.open && right.visitFrame == last))
+				return;
+			state.open = false;
+		}
+	}
+
+	void open(const Bvh& bvh, uint32_t node)
+	{
+		const BvhNode& n = bvh.getNodes()[node];
+		this->states[node].open = true;
+		this->states[node].nextQueryFrame = this->requeryFrame(node);
+		//Children of a node that just became visible are drawn and queried right away rather than revealed a level per frame
+		if (n.count & BVH_INTERIOR)
+		{
+			for (uint32_t child = n.first; child < n.first + 2; child++)
+			{
+				this->states[child].open = true;
+				this->states[child].nextQueryFrame = this->frame;
+			}
+		}
+	}
+
+	//Reads every query that has finished, never waiting for one that hasn't
+	void collectResults(const Bvh& bvh)
+	{
+		double time = now();
+		float frames = 0.f, ms = 0.f;
+		for (size_t i = 0; i < this->pendingNodes.size();)
+		{
+			uint32_t node = this->pendingNodes[i];
+			NodeState& state = this->states[node];
+			GLuint available = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				i++;
+				continue;
+			}
+			GLuint samples = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samples);
+			frames += (float)(this->frame - state.queryFrame);
+			ms += (float)(time - state.issueTime);
+			this->resultsRead++;
+
+			if (samples)
+				this->open(bvh, node);
+			else
+			{
+				this->itemsSkipped += state.conditionalItems;
+				state.open = false;
+				this->pullUp(bvh, node);
+			}
+			state.conditionalItems = 0;
+			state.pending = false;
+			this->freeQueries.push_back(state.query);
+			this->pendingNodes[i] = this->pendingNodes.back();
+			this->pendingNodes.pop_back();
+		}
+		if (this->resultsRead)
+		{
+			this->latencyFrames = frames / this->resultsRead;
+			this->latencyMs = ms / this->resultsRead;
+		}
+	}
+
+	void issueQuery(const BvhNode& node, uint32_t index, Shader* boxShader)
+	{
+		NodeState& state = this->states[index];
+		state.query = this->acquireQuery();
+		state.queryFrame = this->frame;
+		state.issueTime = now();
+		state.pending = true;
+		state.conditionalItems = 0;
+		this->pendingNodes.push_back(index);
+		this->queriesIssued++;
+
+		glm::mat4 model = glm::translate(glm::mat4(1.f), node.min) * glm::scale(glm::mat4(1.f), node.max - node.min);
+		boxShader->use();
+		boxShader->setMat4("model", model);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, state.query);
+		glBindVertexArray(this->boxVAO);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+		glBindVertexArray(0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+public:
+	//Visible leaves are checked again about every visibleQueryInterval frames
+	OcclusionQueries(uint32_t visibleQueryInterval = 8) : bvhBuild(0), frame(0), visibleInterval(std::max(1u, visibleQueryInterval)),
+		queriesIssued(0), resultsRead(0), latencyFrames(0.f), latencyMs(0.f), itemsInFrustum(0), itemsSkipped(0)
+	{
+		//Unit cube, drawn scaled to each node's box
+		const float corners[] = { 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1 };
+		const GLubyte faces[] = { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4, 3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+		glGenVertexArrays(1, &this->boxVAO);
+		glGenBuffers(1, &this->boxVBO);
+		glGenBuffers(1, &this->boxEBO);
+		glBindVertexArray(this->boxVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->boxVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->boxEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(0);
+	}
+
+	~OcclusionQueries()
+	{
+		for (uint32_t node : this->pendingNodes)
+			this->freeQueries.push_back(this->states[node].query);
+		if (!this->freeQueries.empty())
+			glDeleteQueries((GLsizei)this->freeQueries.size(), this->freeQueries.data());
+		glDeleteBuffers(1, &this->boxVBO);
+		glDeleteBuffers(1, &this->boxEBO);
+		glDeleteVertexArrays(1, &this->boxVAO);
+	}
+
+	OcclusionQueries(const OcclusionQueries&) = delete;
+	OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+	//Draws the BVH's items through drawItems(items, count) front to back, skipping closed nodes and querying as it goes.
+	//boxShader only needs model, view and projection (Light.vs does). Rebuilding the BVH starts over with everything open.
+	template <typename Fn>
+	void render(const Bvh& bvh, Shader* boxShader, Camera& camera, Fn drawItems)
+	{
+		if (bvh.getBuildCount() != this->bvhBuild || this->states.size() != bvh.getNodeCount())
+			this->reset(bvh);
+		this->queriesIssued = 0;
+		this->resultsRead = 0;
+		this->itemsInFrustum = 0;
+		this->itemsSkipped = 0;
+		this->collectResults(bvh);
+		if (bvh.isEmpty())
+		{
+			this->frame++;
+			return;
+		}
+
+		glm::mat4 view = camera.GetViewMatrix();
+		Frustum frustum(camera.Projection * view);
+		glm::vec3 eye = camera.Position;
+		boxShader->use();
+		boxShader->setMat4("view", view);
+		boxShader->setMat4("projection", camera.Projection);
+
+		const std::vector<BvhNode>& nodes = bvh.getNodes();
+		const uint32_t* items = bvh.getItems().data();
+		std::vector<uint32_t> stack(1, 0);
+		while (!stack.empty())
+		{
+			uint32_t index = stack.back();
+			stack.pop_back();
+			const BvhNode& node = nodes[index];
+			AABB box(node.min, node.max);
+			if (!frustum.intersects(box))
+				continue;
+			NodeState& state = this->states[index];
+			state.visitFrame = this->frame;
+			bool leaf = !(node.count & BVH_INTERIOR);
+			uint32_t count = node.count & ~BVH_INTERIOR;
+
+			//The near plane would clip a box around the camera, so such nodes are never left closed
+			if (!state.open && box.distanceTo(eye) <= 0.f)
+				this->open(bvh, index);
+
+			if (!state.open)
+			{
+				this->itemsInFrustum += count;
+				if (!state.pending)
+					this->issueQuery(node, index, boxShader);
+				if (leaf && state.queryFrame == this->frame)
+				{
+					//Drawn anyway, but the GPU drops it if the box turns out hidden, so nothing pops in a frame late
+					glBeginConditionalRender(state.query, GL_QUERY_WAIT);
+					drawItems(items + node.first, (size_t)count);
+					glEndConditionalRender();
+					state.conditionalItems = count;
+				}
+				else
+					this->itemsSkipped += count;
+				continue;
+			}
+
+			if (!leaf)
+			{
+				//Nearer child last, so it is drawn first and occludes the other
+				glm::vec3 left = (nodes[node.first].min + nodes[node.first].max) * 0.5f - eye;
+				glm::vec3 right = (nodes[node.first + 1].min + nodes[node.first + 1].max) * 0.5f - eye;
+				bool leftNearer = glm::dot(left, left) <= glm::dot(right, right);
+				stack.push_back(leftNearer ? node.first + 1 : node.first);
+				stack.push_back(leftNearer ? node.first : node.first + 1);
+				continue;
+			}
+
+			this->itemsInFrustum += count;
+			if (!state.pending && this->frame >= state.nextQueryFrame)
+			{
+				this->issueQuery(node, index, boxShader);
+				state.nextQueryFrame = this->requeryFrame(index);
+				glBeginConditionalRender(state.query, GL_QUERY_WAIT);
+				drawItems(items + node.first, (size_t)count);
+				glEndConditionalRender();
+				state.conditionalItems = count;
+			}
+			else
+				drawItems(items + node.first, (size_t)count);
+		}
+		this->frame++;
+	}
+
+	inline uint32_t getQueriesIssued() const { return this->queriesIssued; }
+	//Frames and milliseconds from issuing a query to finding its result, over the results read last frame
+	inline float getAverageLatencyFrames() const { return this->latencyFrames; }
+	inline float getAverageLatencyMs() const { return this->latencyMs; }
+	//Items in the frustum that weren't drawn: skipped by the CPU at closed nodes, or dropped by the GPU from
+	//conditional draws (known once their queries are read, so those count towards the frame they are read in)
+	inline float getSkippedFraction() const { return this->itemsInFrustum ? std::min(1.f, (float)this->itemsSkipped / this->itemsInFrustum) : 0.f; }
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "glad/glad.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Per frame fragment counts and GPU times of the depth and shading passes, read back without stalling ///////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum OverdrawPass
+{
+	OVERDRAW_DEPTH = 0,
+	OVERDRAW_SHADE = 1,
+	OVERDRAW_PASS_COUNT = 2
+};
+
+//Each begin/end pair counts the samples that passed the depth test and the GPU time in between. A pass can be
+//bracketed several times a frame; the spans are summed. Results show up a frame or two after they were measured.
+//Shaded fragments per pixel is the overdraw the main pass pays for; a depth pre-pass wins when the shading time
+//it saves is more than its own time.
+class OverdrawCounter
+{
+private:
+	struct Span
+	{
+		OverdrawPass pass;
+		GLuint samples;
+		GLuint time;
+	};
+
+	struct Frame
+	{
+		std::vector<Span> spans;
+		uint64_t pixels;
+		bool pending;
+	};
+
+	static const int FRAMES = 3;
+
+	Frame frames[FRAMES];
+	int current;
+	//A query object keeps the target it was first used with, so each target has its own pool
+	std::vector<GLuint> freeSamples;
+	std::vector<GLuint> freeTimers;
+	//Span begun but not yet ended, or -1
+	int open;
+
+	uint64_t fragments[OVERDRAW_PASS_COUNT];
+	double milliseconds[OVERDRAW_PASS_COUNT];
+	uint64_t pixels;
+
+	static GLuint acquireQuery(std::vector<GLuint>& pool)
+	{
+		if (pool.empty())
+		{
+			pool.resize(8);
+			glGenQueries((GLsizei)pool.size(), pool.data());
+		}
+		GLuint query = pool.back();
+		pool.pop_back();
+		return query;
+	}
+
+	void release(Frame& frame)
+	{
+		for (const Span& span : frame.spans)
+		{
+			this->freeSamples.push_back(span.samples);
+			this->freeTimers.push_back(span.time);
+		}
+		frame.spans.clear();
+		frame.pending = false;
+	}
+
+	//Publishes a finished frame's totals and recycles its queries; false if the GPU isn't done with it yet
+	bool collect(Frame& frame)
+	{
+		for (const Span& span : frame.spans)
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(span.time, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return false;
+		}
+
+		for (int pass = 0; pass < OVERDRAW_PASS_COUNT; pass++)
+		{
+			this->fragments[pass] = 0;
+			this->milliseconds[pass] = 0.0;
+		}
+		for (const Span& span : frame.spans)
+		{
+			GLuint64 samples = 0, time = 0;
+			glGetQueryObjectui64v(span.samples, GL_QUERY_RESULT, &samples);
+			glGetQueryObjectui64v(span.time, GL_QUERY_RESULT, &time);
+			this->fragments[span.pass] += samples;
+			this->milliseconds[span.pass] += time / 1e6;
+		}
+		this->pixels = frame.pixels;
+		this->release(frame);
+		return true;
+	}
+
+public:
+	OverdrawCounter() : current(0), open(-1), pixels(0)
+	{
+		for (Frame& frame : this->frames)
+		{
+			frame.pixels = 0;
+			frame.pending = false;
+		}
+		for (int pass = 0; pass < OVERDRAW_PASS_COUNT; pass++)
+		{
+			this->fragments[pass] = 0;
+			this->milliseconds[pass] = 0.0;
+		}
+	}
+
+	~OverdrawCounter()
+	{
+		for (Frame& frame : this->frames)
+			this->release(frame);
+		if (!this->freeSamples.empty())
+			glDeleteQueries((GLsizei)this->freeSamples.size(), this->freeSamples.data());
+		if (!this->freeTimers.empty())
+			glDeleteQueries((GLsizei)this->freeTimers.size(), this->freeTimers.data());
+	}
+
+	OverdrawCounter(const OverdrawCounter&) = delete;
+	OverdrawCounter& operator=(const OverdrawCounter&) = delete;
+
+	//Spans can't nest, and nothing else may run a GL_SAMPLES_PASSED or GL_TIME_ELAPSED query inside one
+	void begin(OverdrawPass pass)
+	{
+		if (this->open >= 0)
+			return;
+		Frame& frame = this->frames[this->current];
+		frame.spans.push_back({ pass, acquireQuery(this->freeSamples), acquireQuery(this->freeTimers) });
+		this->open = (int)frame.spans.size() - 1;
+		glBeginQuery(GL_SAMPLES_PASSED, frame.spans.back().samples);
+		glBeginQuery(GL_TIME_ELAPSED, frame.spans.back().time);
+	}
+
+	void end()
+	{
+		if (this->open < 0)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		glEndQuery(GL_SAMPLES_PASSED);
+		this->open = -1;
+	}
+
+	//Call once a frame after the last pass. Reads back the oldest finished frames, never waiting on the GPU;
+	//if it falls FRAMES behind, the frame about to be reused is dropped.
+	void endFrame()
+	{
+		this->end();
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		Frame& frame = this->frames[this->current];
+		frame.pixels = (uint64_t)viewport[2] * (uint64_t)viewport[3];
+		frame.pending = !frame.spans.empty();
+
+		//Oldest first, which is the one about to be reused
+		this->current = (this->current + 1) % FRAMES;
+		for (int i = 0; i < FRAMES - 1; i++)
+		{
+			Frame& oldest = this->frames[(this->current + i) % FRAMES];
+			if (oldest.pending && !this->collect(oldest))
+				break;
+		}
+
+		//Still in flight after FRAMES frames: give up on it rather than wait
+		if (this->frames[this->current].pending)
+			this->release(this->frames[this->current]);
+	}
+
+	inline uint64_t getFragments(OverdrawPass pass) const { return this->fragments[pass]; }
+	inline double getMilliseconds(OverdrawPass pass) const { return this->milliseconds[pass]; }
+	//Fragments that passed the depth test per pixel on screen; 1 means each pixel was shaded once
+	inline float getPerPixel(OverdrawPass pass) const { return this->pixels ? (float)this->fragments[pass] / this->pixels : 0.f; }
+	inline double getTotalMilliseconds() const { return this->milliseconds[OVERDRAW_DEPTH] + this->milliseconds[OVERDRAW_SHADE]; }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Splits [0, count) into one contiguous range per worker thread ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class Parallel
+{
+public:
+	//Workers parallelFor will use, so callers can size per worker partial results up front
+	static size_t workerCount(size_t count, size_t minPerWorker = 1)
+	{
+		size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+		return std::max<size_t>(1, std::min(hardware, count / std::max<size_t>(minPerWorker, 1)));
+	}
+
+	//Calls fn(worker, begin, end) for each range, worker < workerCount(count, minPerWorker).
+	//The calling thread takes the first range.
+	template <typename Fn>
+	static void parallelFor(size_t count, size_t minPerWorker, Fn fn)
+	{
+		size_t workers = workerCount(count, minPerWorker);
+		if (workers == 1)
+		{
+			fn((size_t)0, (size_t)0, count);
+			return;
+		}
+		size_t band = (count + workers - 1) / workers;
+		std::vector<std::thread> threads;
+		for (size_t w = 1; w < workers; w++)
+		{
+			size_t begin = std::min(count, w * band);
+			size_t end = std::min(count, begin + band);
+			threads.emplace_back(fn, w, begin, end);
+		}
+		fn((size_t)0, (size_t)0, std::min(count, band));
+		for (auto& t : threads)
+			t.join();
+	}
+};
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <xmmintrin.h>
+
+#include <glm.hpp>
+
+#include "Parallel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Parent/child transforms, stored by depth so world matrices can be updated a level at a time ///////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Stable handle to a node; stays valid until the node is destroyed
+typedef uint32_t SceneNode;
+const SceneNode SCENE_ROOT = UINT32_MAX;
+//Parent slot of top level nodes, and slot of destroyed handles
+const uint32_t SCENE_NO_SLOT = UINT32_MAX;
+
+class SceneGraph
+{
+private:
+	static const size_t MIN_NODES_PER_WORKER = 4096;
+
+	//Local transforms as structure of arrays, indexed by slot. Slots are sorted by depth, so every
+	//parent comes before its children and each level is one contiguous range.
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<uint32_t> parentSlot;
+	std::vector<uint8_t> dirty;
+	//Set during update for nodes whose world matrix was recomputed, so their children follow
+	std::vector<uint8_t> changed;
+	std::vector<glm::mat4> world;
+	std::vector<size_t> levelStart;
+
+	//Handles map to slots through these, since sorting moves nodes between slots
+	std::vector<uint32_t> slotOf;
+	std::vector<SceneNode> nodeAt;
+	//Parent handle per handle, the source of truth for the hierarchy while slots are stale
+	std::vector<SceneNode> parentOf;
+	std::vector<SceneNode> freeNodes;
+
+	bool anyDirty;
+	bool needsSort;
+
+	//Column-major 4x4 multiply, a * b, one column of the result per step
+	static inline void multiply(const float* a, const float* b, float* out)
+	{
+		__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+		for (int c = 0; c < 4; c++)
+		{
+			__m128 column = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[c * 4])), _mm_mul_ps(a1, _mm_set1_ps(b[c * 4 + 1]))),
+				_mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[c * 4 + 2])), _mm_mul_ps(a3, _mm_set1_ps(b[c * 4 + 3]))));
+			_mm_storeu_ps(out + c * 4, column);
+		}
+	}
+
+	//Local matrices of 4 consecutive slots from translation, rotation quaternion and scale.
+	//Lanes past the range being updated come out as garbage the caller ignores.
+	void localMatrices(size_t first, float out[4][16]) const
+	{
+		__m128 x = _mm_loadu_ps(&this->rotationX[first]), y = _mm_loadu_ps(&this->rotationY[first]);
+		__m128 z = _mm_loadu_ps(&this->rotationZ[first]), w = _mm_loadu_ps(&this->rotationW[first]);
+		__m128 two = _mm_set1_ps(2.f), one = _mm_set1_ps(1.f);
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+		__m128 sx = _mm_loadu_ps(&this->scaleX[first]), sy = _mm_loadu_ps(&this->scaleY[first]), sz = _mm_loadu_ps(&this->scaleZ[first]);
+
+		float m[12][4];
+		_mm_storeu_ps(m[0], _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)))));
+		_mm_storeu_ps(m[1], _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xy, wz))));
+		_mm_storeu_ps(m[2], _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xz, wy))));
+		_mm_storeu_ps(m[3], _mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(xy, wz))));
+		_mm_storeu_ps(m[4], _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)))));
+		_mm_storeu_ps(m[5], _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(yz, wx))));
+		_mm_storeu_ps(m[6], _mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(xz, wy))));
+		_mm_storeu_ps(m[7], _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(yz, wx))));
+		_mm_storeu_ps(m[8], _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)))));
+		_mm_storeu_ps(m[9], _mm_loadu_ps(&this->positionX[first]));
+		_mm_storeu_ps(m[10], _mm_loadu_ps(&this->positionY[first]));
+		_mm_storeu_ps(m[11], _mm_loadu_ps(&this->positionZ[first]));
+
+		for (int k = 0; k < 4; k++)
+		{
+			float* o = out[k];
+			o[0] = m[0][k]; o[1] = m[1][k]; o[2] = m[2][k]; o[3] = 0.f;
+			o[4] = m[3][k]; o[5] = m[4][k]; o[6] = m[5][k]; o[7] = 0.f;
+			o[8] = m[6][k]; o[9] = m[7][k]; o[10] = m[8][k]; o[11] = 0.f;
+			o[12] = m[9][k]; o[13] = m[10][k]; o[14] = m[11][k]; o[15] = 1.f;
+		}
+	}
+
+	//Recomputes world matrices of the slots in [begin, end) that are dirty or whose parent changed
+	void updateRange(size_t begin, size_t end)
+	{
+		float local[4][16];
+		for (size_t first = begin; first < end; first += 4)
+		{
+			size_t count = std::min<size_t>(4, end - first);
+			bool any = false;
+			for (size_t k = 0; k < count; k++)
+			{
+				size_t slot = first + k;
+				uint32_t parent = this->parentSlot[slot];
+				this->changed[slot] = this->dirty[slot] || (parent != SCENE_NO_SLOT && this->changed[parent]);
+				any = any || this->changed[slot];
+			}
+			if (!any)
+				continue;
+
+			this->localMatrices(first, local);
+			for (size_t k = 0; k < count; k++)
+			{
+				size_t slot = first + k;
+				if (!this->changed[slot])
+					continue;
+				this->dirty[slot] = 0;
+				uint32_t parent = this->parentSlot[slot];
+				if (parent == SCENE_NO_SLOT)
+					std::copy(local[k], local[k] + 16, &this->world[slot][0][0]);
+				else
+					multiply(&this->world[parent][0][0], local[k], &this->world[slot][0][0]);
+			}
+		}
+	}
+
+	//Counting sort of live nodes by depth, keeping the current order within a level so an
+	//unchanged hierarchy keeps its slots. Moves every array along; everything is marked dirty.
+	void sort()
+	{
+		size_t nodeCount = this->slotOf.size();
+		std::vector<int> depth(nodeCount, -1);
+		std::vector<SceneNode> stack;
+		int maxDepth = -1;
+		for (SceneNode node : this->nodeAt)
+		{
+			//Walk up to the first node with a known depth, then fill in on the way back down
+			SceneNode n = node;
+			while (n != SCENE_ROOT && depth[n] < 0)
+			{
+				stack.push_back(n);
+				n = this->parentOf[n];
+			}
+			int d = n == SCENE_ROOT ? -1 : depth[n];
+			while (!stack.empty())
+			{
+				depth[stack.back()] = ++d;
+				stack.pop_back();
+			}
+			maxDepth = std::max(maxDepth, depth[node]);
+		}
+
+		this->levelStart.assign(maxDepth + 2, 0);
+		for (SceneNode node : this->nodeAt)
+			this->levelStart[depth[node] + 1]++;
+		for (int d = 0; d <= maxDepth; d++)
+			this->levelStart[d + 1] += this->levelStart[d];
+
+		std::vector<SceneNode> order(this->nodeAt.size());
+		std::vector<size_t> fill(this->levelStart.begin(), this->levelStart.end() - 1);
+		for (SceneNode node : this->nodeAt)
+			order[fill[depth[node]]++] = node;
+
+		std::vector<uint32_t> oldSlot(order.size());
+		for (size_t s = 0; s < order.size(); s++)
+			oldSlot[s] = this->slotOf[order[s]];
+		auto permute = [&](std::vector<float>& values)
+		{
+			std::vector<float> sorted(values.size());
+			for (size_t s = 0; s < order.size(); s++)
+				sorted[s] = values[oldSlot[s]];
+			values.swap(sorted);
+		};
+		permute(this->positionX); permute(this->positionY); permute(this->positionZ);
+		permute(this->rotationX); permute(this->rotationY); permute(this->rotationZ); permute(this->rotationW);
+		permute(this->scaleX); permute(this->scaleY); permute(this->scaleZ);
+
+		this->nodeAt.swap(order);
+		for (size_t s = 0; s < this->nodeAt.size(); s++)
+			this->slotOf[this->nodeAt[s]] = (uint32_t)s;
+		for (size_t s = 0; s < this->nodeAt.size(); s++)
+		{
+			SceneNode parent = this->parentOf[this->nodeAt[s]];
+			this->parentSlot[s] = parent == SCENE_ROOT ? SCENE_NO_SLOT : this->slotOf[parent];
+		}
+		std::fill(this->dirty.begin(), this->dirty.end(), 1);
+		this->needsSort = false;
+		this->anyDirty = true;
+	}
+
+	//The float arrays have 3 slots of padding so localMatrices can load 4 lanes from any slot
+	void resizeSlots(size_t count)
+	{
+		size_t padded = count + 3;
+		for (std::vector<float>* v : { &this->positionX, &this->positionY, &this->positionZ, &this->rotationX, &this->rotationY,
+			&this->rotationZ, &this->scaleX, &this->scaleY, &this->scaleZ })
+			v->resize(padded, 0.f);
+		this->rotationW.resize(padded, 1.f);
+		this->parentSlot.resize(count, SCENE_NO_SLOT);
+		this->dirty.resize(count, 1);
+		this->changed.resize(count, 0);
+		this->world.resize(count, glm::mat4(1.f));
+	}
+
+	inline bool isLive(SceneNode node) const
+	{
+		return node < this->slotOf.size() && this->slotOf[node] != SCENE_NO_SLOT;
+	}
+
+	void markDirty(SceneNode node)
+	{
+		this->dirty[this->slotOf[node]] = 1;
+		this->anyDirty = true;
+	}
+
+public:
+	SceneGraph()
+	{
+		this->anyDirty = false;
+		this->needsSort = false;
+	}
+	~SceneGraph() {}
+
+	//New node with an identity local transform, under parent or at the top level
+	SceneNode create(SceneNode parent = SCENE_ROOT)
+	{
+		SceneNode node;
+		if (!this->freeNodes.empty())
+		{
+			node = this->freeNodes.back();
+			this->freeNodes.pop_back();
+		}
+		else
+		{
+			node = (SceneNode)this->slotOf.size();
+			this->slotOf.push_back(SCENE_NO_SLOT);
+			this->parentOf.push_back(SCENE_ROOT);
+		}
+		uint32_t slot = (uint32_t)this->nodeAt.size();
+		this->nodeAt.push_back(node);
+		this->resizeSlots(this->nodeAt.size());
+		this->slotOf[node] = slot;
+		this->positionX[slot] = this->positionY[slot] = this->positionZ[slot] = 0.f;
+		this->rotationX[slot] = this->rotationY[slot] = this->rotationZ[slot] = 0.f;
+		this->rotationW[slot] = 1.f;
+		this->scaleX[slot] = this->scaleY[slot] = this->scaleZ[slot] = 1.f;
+		this->parentOf[node] = this->isLive(parent) ? parent : SCENE_ROOT;
+		this->needsSort = true;
+		return node;
+	}
+
+	//Destroys node and everything below it
+	void destroy(SceneNode node)
+	{
+		if (!this->isLive(node))
+			return;
+		std::vector<bool> doomed(this->slotOf.size(), false);
+		doomed[node] = true;
+		//A node is doomed if it or any ancestor is
+		for (SceneNode n : this->nodeAt)
+		{
+			SceneNode a = n;
+			while (a != SCENE_ROOT && !doomed[a])
+				a = this->parentOf[a];
+			if (a != SCENE_ROOT)
+				doomed[n] = true;
+		}
+
+		//Compact the slots, keeping order; sort() will rebuild the levels anyway
+		size_t kept = 0;
+		for (size_t s = 0; s < this->nodeAt.size(); s++)
+		{
+			SceneNode n = this->nodeAt[s];
+			if (doomed[n])
+			{
+				this->slotOf[n] = SCENE_NO_SLOT;
+				this->parentOf[n] = SCENE_ROOT;
+				this->freeNodes.push_back(n);
+				continue;
+			}
+			for (std::vector<float>* v : { &this->positionX, &this->positionY, &this->positionZ, &this->rotationX, &this->rotationY,
+				&this->rotationZ, &this->rotationW, &this->scaleX, &this->scaleY, &this->scaleZ })
+				(*v)[kept] = (*v)[s];
+			this->world[kept] = this->world[s];
+			this->nodeAt[kept] = n;
+			this->slotOf[n] = (uint32_t)kept;
+			kept++;
+		}
+		this->nodeAt.resize(kept);
+		this->resizeSlots(kept);
+		this->needsSort = true;
+	}
+
+	//Moves node (and its subtree) under parent, keeping its local transform
+	void setParent(SceneNode node, SceneNode parent)
+	{
+		if (!this->isLive(node))
+			return;
+		//Refuse cycles: parent may not be inside node's subtree
+		for (SceneNode a = parent; a != SCENE_ROOT; a = this->parentOf[a])
+		{
+			if (a == node || !this->isLive(a))
+				return;
+		}
+		this->parentOf[node] = parent;
+		this->needsSort = true;
+	}
+
+	inline SceneNode getParent(SceneNode node) const { return this->isLive(node) ? this->parentOf[node] : SCENE_ROOT; }
+
+	void setLocalPosition(SceneNode node, const glm::vec3& position)
+	{
+		if (!this->isLive(node))
+			return;
+		uint32_t slot = this->slotOf[node];
+		this->positionX[slot] = position.x;
+		this->positionY[slot] = position.y;
+		this->positionZ[slot] = position.z;
+		this->markDirty(node);
+	}
+
+	//Euler angles in degrees applied like Mesh does them: X, then Y, then Z in the local frame
+	void setLocalRotation(SceneNode node, const glm::vec3& degrees)
+	{
+		if (!this->isLive(node))
+			return;
+		//q = qx * qy * qz
+		float hx = glm::radians(degrees.x) * 0.5f, hy = glm::radians(degrees.y) * 0.5f, hz = glm::radians(degrees.z) * 0.5f;
+		float cx = std::cos(hx), sx = std::sin(hx), cy = std::cos(hy), sy = std::sin(hy), cz = std::cos(hz), sz = std::sin(hz);
+		//qx * qy
+		float w = cx * cy, x = sx * cy, y = cx * sy, z = sx * sy;
+		//(qx * qy) * qz
+		uint32_t slot = this->slotOf[node];
+		this->rotationW[slot] = w * cz - z * sz;
+		this->rotationX[slot] = x * cz + y * sz;
+		this->rotationY[slot] = y * cz - x * sz;
+		this->rotationZ[slot] = z * cz + w * sz;
+		this->markDirty(node);
+	}
+
+	void setLocalScale(SceneNode node, const glm::vec3& scale)
+	{
+		if (!this->isLive(node))
+			return;
+		uint32_t slot = this->slotOf[node];
+		this->scaleX[slot] = scale.x;
+		this->scaleY[slot] = scale.y;
+		this->scaleZ[slot] = scale.z;
+		this->markDirty(node);
+	}
+
+	//Origin for destroyed nodes
+	glm::vec3 getLocalPosition(SceneNode node) const
+	{
+		if (!this->isLive(node))
+			return glm::vec3(0.f);
+		uint32_t slot = this->slotOf[node];
+		return glm::vec3(this->positionX[slot], this->positionY[slot], this->positionZ[slot]);
+	}
+
+	//Call once per frame after changing transforms. Goes down the levels in order; within a level
+	//nodes only read their parent's matrix, so each level is split across worker threads.
+	//Only dirty nodes and their descendants are recomputed.
+	void update()
+	{
+		if (this->needsSort)
+			this->sort();
+		if (!this->anyDirty)
+			return;
+
+		for (size_t level = 0; level + 1 < this->levelStart.size(); level++)
+		{
+			size_t begin = this->levelStart[level];
+			size_t count = this->levelStart[level + 1] - begin;
+			//Work is handed out in groups of 4 nodes, the width of localMatrices
+			size_t groups = (count + 3) / 4;
+			Parallel::parallelFor(groups, MIN_NODES_PER_WORKER / 4, [&](size_t, size_t first, size_t last)
+			{
+				this->updateRange(begin + first * 4, begin + std::min(count, last * 4));
+			});
+		}
+		this->anyDirty = false;
+	}
+
+	//World matrix as of the last update, identity for destroyed nodes
+	const glm::mat4& getWorldMatrix(SceneNode node) const
+	{
+		static const glm::mat4 identity(1.f);
+		return this->isLive(node) ? this->world[this->slotOf[node]] : identity;
+	}
+
+	glm::vec3 getWorldPosition(SceneNode node) const
+	{
+		return glm::vec3(this->getWorldMatrix(node)[3]);
+	}
+
+	inline size_t size() const { return this->nodeAt.size(); }
+	inline size_t getDepth() const { return this->levelStart.empty() ? 0 : this->levelStart.size() - 1; }
+};
@@ -87,6 +87,38 @@ public:
         glDeleteShader(fragment);
     }
 
+    ///////////////////////// Compute Shader Constructor //////////////////////////////////////////
+    explicit Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "Error occurred while attempting to read a Shader File:" << e.what() << std::endl;
+        }
+
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+    }
+
 
     ////////////////////////////////////////// Set this as Active Shader ////////////////////////////////////////////////////////
     void use()
@@ -119,6 +151,11 @@ public:
         glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
         //this->unuse();
     }
+    ///////////////////////////////////////// Set a Specific Unsigned Int ////////////////////////////////////////////////////
+    void setUint(const std::string& name, unsigned int value)
+    {
+        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+    }
     ///////////////////////////////////////// Set a Vec 2 /////////////////////////////////////////
     void setVec2(const std::string& name, const glm::vec2& value)
     {
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "Bounds.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Loose uniform grid in a hash map, for objects that move every frame ///////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Items live in the cell holding their center. Each cell is loosened by the largest half extent it has held,
+//so queries only test cells whose loose box reaches them, and moving within a cell touches nothing but the item.
+class SpatialHash
+{
+private:
+	struct CellCoord
+	{
+		int x, y, z;
+	};
+
+	struct Cell
+	{
+		uint64_t key;
+		CellCoord coord;
+		//Largest item half extent since the cell was last empty
+		float loose;
+		std::vector<uint32_t> items;
+	};
+
+	struct Item
+	{
+		AABB bounds;
+		uint32_t cell;
+		//Position in the cell's item list
+		uint32_t slot;
+	};
+
+	static const uint32_t NONE = UINT32_MAX;
+
+	float cellSize;
+	float inverseCellSize;
+	std::vector<Cell> cells;
+	std::unordered_map<uint64_t, uint32_t> cellOf;
+	//Indexed by id; cell is NONE for ids that aren't in the grid
+	std::vector<Item> items;
+	size_t itemCount;
+	//Largest loose extent of any cell, how far outside their cell items can reach
+	float maxLoose;
+
+	CellCoord coordOf(const AABB& bounds) const
+	{
+		glm::vec3 c = bounds.center() * this->inverseCellSize;
+		return { (int)std::floor(c.x), (int)std::floor(c.y), (int)std::floor(c.z) };
+	}
+
+	//21 bits per axis: the world has to stay within a million cells of the origin each way
+	static uint64_t keyOf(const CellCoord& coord)
+	{
+		return ((uint64_t)(coord.x & 0x1FFFFF)) | ((uint64_t)(coord.y & 0x1FFFFF) << 21) | ((uint64_t)(coord.z & 0x1FFFFF) << 42);
+	}
+
+	AABB looseBox(const Cell& cell) const
+	{
+		glm::vec3 lo = glm::vec3((float)cell.coord.x, (float)cell.coord.y, (float)cell.coord.z) * this->cellSize - glm::vec3(cell.loose);
+		return AABB(lo, lo + glm::vec3(this->cellSize + 2.f * cell.loose));
+	}
+
+	static float halfExtent(const AABB& bounds)
+	{
+		glm::vec3 e = bounds.extents();
+		return std::max(e.x, std::max(e.y, e.z));
+	}
+
+	void link(uint32_t id, const AABB& bounds)
+	{
+		CellCoord coord = this->coordOf(bounds);
+		uint64_t key = keyOf(coord);
+		auto found = this->cellOf.find(key);
+		uint32_t cellIndex;
+		if (found != this->cellOf.end())
+			cellIndex = found->second;
+		else
+		{
+			cellIndex = (uint32_t)this->cells.size();
+			this->cells.push_back({ key, coord, 0.f, {} });
+			this->cellOf[key] = cellIndex;
+		}
+
+		Cell& cell = this->cells[cellIndex];
+		Item& item = this->items[id];
+		item.bounds = bounds;
+		item.cell = cellIndex;
+		item.slot = (uint32_t)cell.items.size();
+		cell.items.push_back(id);
+		cell.loose = std::max(cell.loose, halfExtent(bounds));
+		this->maxLoose = std::max(this->maxLoose, cell.loose);
+	}
+
+	//Swap removes the item from its cell, and the cell from the grid once it is empty
+	void unlink(uint32_t id)
+	{
+		Item& item = this->items[id];
+		Cell& cell = this->cells[item.cell];
+		uint32_t last = cell.items.back();
+		cell.items[item.slot] = last;
+		this->items[last].slot = item.slot;
+		cell.items.pop_back();
+
+		if (cell.items.empty())
+		{
+			uint32_t emptied = item.cell;
+			uint32_t moved = (uint32_t)this->cells.size() - 1;
+			this->cellOf.erase(cell.key);
+			if (emptied != moved)
+			{
+				this->cells[emptied] = std::move(this->cells[moved]);
+				this->cellOf[this->cells[emptied].key] = emptied;
+				for (uint32_t other : this->cells[emptied].items)
+					this->items[other].cell = emptied;
+			}
+			this->cells.pop_back();
+		}
+		item.cell = NONE;
+	}
+
+	template <typename Fn>
+	void forCellsNear(const AABB& region, Fn fn) const
+	{
+		//Loose cells can hold items reaching maxLoose outside them
+		glm::vec3 lo = (region.min - glm::vec3(this->maxLoose)) * this->inverseCellSize;
+		glm::vec3 hi = (region.max + glm::vec3(this->maxLoose)) * this->inverseCellSize;
+		CellCoord from = { (int)std::floor(lo.x), (int)std::floor(lo.y), (int)std::floor(lo.z) };
+		CellCoord to = { (int)std::floor(hi.x), (int)std::floor(hi.y), (int)std::floor(hi.z) };
+		double span = (double)(to.x - from.x + 1) * (to.y - from.y + 1) * (to.z - from.z + 1);
+
+		//Looking up every cell in a big region costs more than walking the ones that exist
+		if (span > (double)this->cells.size())
+		{
+			for (const Cell& cell : this->cells)
+				fn(cell);
+			return;
+		}
+		for (int z = from.z; z <= to.z; z++)
+			for (int y = from.y; y <= to.y; y++)
+				for (int x = from.x; x <= to.x; x++)
+				{
+					auto found = this->cellOf.find(keyOf({ x, y, z }));
+					if (found != this->cellOf.end())
+						fn(this->cells[found->second]);
+				}
+	}
+
+public:
+	//Cells around the size of a typical object keep both the loose margins and the items per cell small
+	explicit SpatialHash(float cellSize = 8.f) : cellSize(cellSize), inverseCellSize(1.f / cellSize), itemCount(0), maxLoose(0.f) {}
+
+	//Adds id, or moves it if it is already in the grid
+	void insert(uint32_t id, const AABB& bounds)
+	{
+		if (id >= this->items.size())
+			this->items.resize((size_t)id + 1, { AABB(), NONE, 0 });
+		if (this->items[id].cell != NONE)
+		{
+			this->move(id, bounds);
+			return;
+		}
+		this->link(id, bounds);
+		this->itemCount++;
+	}
+
+	//Only items that crossed into another cell are relinked; the rest just get their new bounds
+	void move(uint32_t id, const AABB& bounds)
+	{
+		if (id >= this->items.size() || this->items[id].cell == NONE)
+		{
+			this->insert(id, bounds);
+			return;
+		}
+		Item& item = this->items[id];
+		Cell& cell = this->cells[item.cell];
+		if (keyOf(this->coordOf(bounds)) == cell.key)
+		{
+			item.bounds = bounds;
+			cell.loose = std::max(cell.loose, halfExtent(bounds));
+			this->maxLoose = std::max(this->maxLoose, cell.loose);
+			return;
+		}
+		this->unlink(id);
+		this->link(id, bounds);
+	}
+
+	void remove(uint32_t id)
+	{
+		if (id >= this->items.size() || this->items[id].cell == NONE)
+			return;
+		this->unlink(id);
+		this->itemCount--;
+	}
+
+	void clear()
+	{
+		this->cells.clear();
+		this->cellOf.clear();
+		this->items.clear();
+		this->itemCount = 0;
+		this->maxLoose = 0.f;
+	}
+
+	inline bool contains(uint32_t id) const { return id < this->items.size() && this->items[id].cell != NONE; }
+
+	//Queries only read the grid, so any number of threads can run them at once between updates
+
+	//Items whose boxes are in the frustum
+	void cull(const Frustum& frustum, std::vector<uint32_t>& out) const
+	{
+		for (const Cell& cell : this->cells)
+		{
+			if (!frustum.intersects(this->looseBox(cell)))
+				continue;
+			for (uint32_t id : cell.items)
+			{
+				if (frustum.intersects(this->items[id].bounds))
+					out.push_back(id);
+			}
+		}
+	}
+
+	//Items whose boxes are within radius of center
+	void queryRadius(const glm::vec3& center, float radius, std::vector<uint32_t>& out) const
+	{
+		AABB region(center - glm::vec3(radius), center + glm::vec3(radius));
+		this->forCellsNear(region, [&](const Cell& cell)
+		{
+			if (this->looseBox(cell).distanceTo(center) > radius)
+				return;
+			for (uint32_t id : cell.items)
+			{
+				if (this->items[id].bounds.distanceTo(center) <= radius)
+					out.push_back(id);
+			}
+		});
+	}
+
+	inline size_t size() const { return this->itemCount; }
+	inline size_t getCellCount() const { return this->cells.size(); }
+	inline float getCellSize() const { return this->cellSize; }
+};
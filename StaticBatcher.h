@@ -0,0 +1,170 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glm.hpp>
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Bounds.h"
+#include "MeshOptimizer.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Static geometry moved into world space once and merged into one mesh per material and chunk ///////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//A placed mesh that will never move again
+struct StaticSource
+{
+	Mesh* mesh;
+	Material* material;
+	glm::mat4 model;
+	AABB bounds;
+	bool occluder;
+};
+
+//One merged mesh, drawn with an identity transform. Its sources shared a material, an occluder flag and a chunk.
+struct StaticBatch
+{
+	Mesh* mesh;
+	Material* material;
+	bool occluder;
+	size_t sourceCount;
+};
+
+//Sources are binned by the chunk holding their bounds' center, so batches stay small enough to cull one by one.
+//A chunk's sources are split over several batches when they pass maxVertices; at 0x10000 every batch keeps
+//16 bit indices. Meshes above maxSourceVertices are left alone, merging doesn't save them anything.
+//The batches only keep full detail: merged pieces no longer have their own LODs or meshlets.
+class StaticBatcher
+{
+private:
+	float chunkSize;
+	size_t maxVertices;
+	size_t maxSourceVertices;
+
+	std::vector<std::unique_ptr<Mesh>> meshes;
+	std::vector<StaticBatch> batches;
+	size_t sourceCount;
+
+	struct Binned
+	{
+		const StaticSource* source;
+		int cell[3];
+	};
+
+	static bool sameBin(const Binned& a, const Binned& b)
+	{
+		return a.source->material == b.source->material && a.source->occluder == b.source->occluder &&
+			a.cell[0] == b.cell[0] && a.cell[1] == b.cell[1] && a.cell[2] == b.cell[2];
+	}
+
+	//Appends source's full detail triangles in world space
+	static void append(const StaticSource& source, std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		const Vertex* local = source.mesh->getVertices();
+		size_t base = vertices.size();
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(source.model)));
+		for (size_t i = 0; i < source.mesh->getVertexCount(); i++)
+		{
+			Vertex vertex = local[i];
+			vertex.position = glm::vec3(source.model * glm::vec4(vertex.position, 1.f));
+			glm::vec3 normal = normalMatrix * vertex.normal;
+			float length = glm::length(normal);
+			vertex.normal = length > 0.f ? normal / length : normal;
+			vertices.push_back(vertex);
+		}
+
+		//Winding is judged after the transform either way, so mirrored sources keep the facing they had
+		std::vector<GLuint> lod = source.mesh->getLodIndices(0);
+		for (GLuint index : lod)
+			indices.push_back((GLuint)base + index);
+	}
+
+	void flush(const StaticSource& first, size_t count, std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		if (indices.empty())
+			return;
+		//The pieces were each ordered for the cache on their own; order the merged triangles as one mesh
+		MeshOptimizer::optimize(vertices, indices);
+		//The merged vertices are handed over rather than copied; the count is read before they move
+		unsigned vertexCount = (unsigned)vertices.size();
+		this->meshes.push_back(std::unique_ptr<Mesh>(new Mesh(std::move(vertices), vertexCount, indices.data(), (unsigned)indices.size())));
+		this->batches.push_back({ this->meshes.back().get(), first.material, first.occluder, count });
+		vertices.clear();
+		indices.clear();
+	}
+
+public:
+	StaticBatcher(float chunkSize = 32.f, size_t maxVertices = 0x10000, size_t maxSourceVertices = 4096)
+		: chunkSize(chunkSize), maxVertices(maxVertices), maxSourceVertices(maxSourceVertices), sourceCount(0) {}
+
+	StaticBatcher(const StaticBatcher&) = delete;
+	StaticBatcher& operator=(const StaticBatcher&) = delete;
+
+	//Whether build would merge an instance of mesh: it needs its vertices on the CPU and an index buffer
+	bool accepts(const Mesh& mesh) const
+	{
+		return mesh.getVertices() && mesh.isUploaded() && mesh.getIndexCount() > 0 && mesh.getVertexCount() <= this->maxSourceVertices;
+	}
+
+	//Merges the accepted sources into new batches, replacing any from an earlier build. The batch meshes belong to
+	//the batcher, which has to outlive whatever draws them.
+	const std::vector<StaticBatch>& build(const std::vector<StaticSource>& sources)
+	{
+		this->clear();
+		std::vector<Binned> binned;
+		binned.reserve(sources.size());
+		for (const StaticSource& source : sources)
+		{
+			if (!source.mesh || !source.material || !this->accepts(*source.mesh))
+				continue;
+			glm::vec3 c = source.bounds.center() / this->chunkSize;
+			binned.push_back({ &source, { (int)std::floor(c.x), (int)std::floor(c.y), (int)std::floor(c.z) } });
+		}
+		std::sort(binned.begin(), binned.end(), [](const Binned& a, const Binned& b)
+		{
+			if (a.source->material != b.source->material)
+				return a.source->material < b.source->material;
+			if (a.source->occluder != b.source->occluder)
+				return a.source->occluder < b.source->occluder;
+			if (a.cell[0] != b.cell[0])
+				return a.cell[0] < b.cell[0];
+			return a.cell[1] != b.cell[1] ? a.cell[1] < b.cell[1] : a.cell[2] < b.cell[2];
+		});
+
+		std::vector<Vertex> vertices;
+		std::vector<GLuint> indices;
+		size_t first = 0;
+		for (size_t i = 0; i < binned.size(); i++)
+		{
+			const StaticSource& source = *binned[i].source;
+			if (i > first && (!sameBin(binned[first], binned[i]) || vertices.size() + source.mesh->getVertexCount() > this->maxVertices))
+			{
+				this->flush(*binned[first].source, i - first, vertices, indices);
+				first = i;
+			}
+			append(source, vertices, indices);
+		}
+		if (!binned.empty())
+			this->flush(*binned[first].source, binned.size() - first, vertices, indices);
+		this->sourceCount = binned.size();
+		return this->batches;
+	}
+
+	void clear()
+	{
+		this->batches.clear();
+		this->meshes.clear();
+		this->sourceCount = 0;
+	}
+
+	inline const std::vector<StaticBatch>& getBatches() const { return this->batches; }
+	inline size_t getBatchCount() const { return this->batches.size(); }
+	//Sources merged by the last build
+	inline size_t getSourceCount() const { return this->sourceCount; }
+};
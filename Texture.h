@@ -1,10 +1,13 @@
 #pragma once
 
 #include<iostream>
+#include<string>
+#include<vector>
+#include<algorithm>
 
 #include "glad/glad.h"
 #include<GLFW/glfw3.h>
-#include "stb_image.h"
+#include "MipGenerator.h"
 
 class Texture
 {
@@ -12,57 +15,234 @@ private:
     GLuint id;
     int width;
     int height;
+    int levels;
+    int nrComponents;
     GLenum type;
-public:
-    Texture(const char* fileName, GLenum type)
-    {
-        this->type = type;
-
+    std::string fileName;
 
-        glGenTextures(1, &this->id);
-        glBindTexture(GL_TEXTURE_2D, this->id);
-        int nrComponents;
+    //Residency, as levels of the full chain. storageBase is the largest level the texture has room
+    //for, residentBase the largest level with valid data (they differ while streaming in).
+    int storageBase;
+    int residentBase;
+    //Level table of the cooked file, read once so streaming seeks straight to each level
+    std::string cookedFile;
+    std::vector<MipFileLevel> cookedLevels;
 
+    static GLenum formatFor(int nrComponents)
+    {
+        if (nrComponents == 1)
+            return GL_RED;
+        else if (nrComponents == 2)
+            return GL_RG;
+        else if (nrComponents == 3)
+            return GL_RGB;
+        return GL_RGBA;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    static GLenum internalFormatFor(int nrComponents)
+    {
+        if (nrComponents == 1)
+            return GL_R8;
+        else if (nrComponents == 2)
+            return GL_RG8;
+        else if (nrComponents == 3)
+            return GL_RGB8;
+        return GL_RGBA8;
+    }
 
-        stbi_set_flip_vertically_on_load(true);
-        unsigned char* data = stbi_load(fileName, &this->width, &this->height, &nrComponents, 0);
+    int levelWidth(int level) const { return std::max(1, this->width >> level); }
+    int levelHeight(int level) const { return std::max(1, this->height >> level); }
 
+    //Binds this texture on whatever unit is active and returns what was bound there, so updates
+    //never disturb the bindings materials rely on
+    GLuint bindForUpdate() const
+    {
+        GLint previous = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        glBindTexture(GL_TEXTURE_2D, this->id);
+        return (GLuint)previous;
+    }
 
-        if (data)
-        {
-            GLenum format;
-            if (nrComponents == 1)
-                format = GL_RED;
-            else if (nrComponents == 3)
-                format = GL_RGB;
-            else if (nrComponents == 4)
-                format = GL_RGBA;
+    //Storage is mutable and specified level by level, so levels can be released and refilled while the
+    //id, and the units materials refer to it by, stay the same for the texture's whole life.
+    //Levels below GL_TEXTURE_BASE_LEVEL don't count for completeness, so they are left at 0x0.
+    void specifyLevel(int level, const MipLevel* mip)
+    {
+        //Cooked rows are tightly packed, RGB rows are not 4 byte aligned for odd widths
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormatFor(this->nrComponents),
+            mip ? mip->width : 0, mip ? mip->height : 0, 0, formatFor(this->nrComponents), GL_UNSIGNED_BYTE, mip ? mip->data.data() : nullptr);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
 
+    //Loads the cooked mip chain next to fileName. If it hasn't been cooked yet the chain is
+    //built once here and written out, so later launches only read and upload.
+    //A maxInitialSize above 0 loads only the levels that fit in it and leaves the rest to streaming.
+    void load(const char* fileName, int maxInitialSize = 0)
+    {
+        std::vector<MipLevel> mips;
+        int components = 0;
+        int first = 0;
+        this->fileName = fileName;
+        this->cookedFile = MipGenerator::cookedName(fileName);
+        this->cookedLevels.clear();
 
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
+        MipFileHeader header;
+        std::vector<MipFileLevel> table;
+        if (MipGenerator::readCookedInfo(this->cookedFile.c_str(), header, table) && header.levelCount > 0)
+        {
+            while (maxInitialSize > 0 && first < (int)header.levelCount - 1 &&
+                (int)std::max(table[first].width, table[first].height) > maxInitialSize)
+                first++;
+            if (MipGenerator::readCooked(this->cookedFile.c_str(), mips, components, first))
+            {
+                this->width = (int)header.width;
+                this->height = (int)header.height;
+                this->levels = (int)header.levelCount;
+                this->cookedLevels = table;
+            }
+            else
+            {
+                mips.clear();
+            }
+        }
 
+        if (mips.empty())
+        {
+            first = 0;
+            MipGenerator::cookFile(fileName, this->cookedFile.c_str(), MIP_FILTER_BOX, &mips, &components);
+            if (!mips.empty())
+            {
+                this->width = mips[0].width;
+                this->height = mips[0].height;
+                this->levels = (int)mips.size();
+                if (MipGenerator::readCookedInfo(this->cookedFile.c_str(), header, table))
+                    this->cookedLevels = table;
+            }
+            //Same start as a cooked load; only when the file was written, since the dropped levels stream from it
+            if (!this->cookedLevels.empty())
+            {
+                while (maxInitialSize > 0 && first < (int)mips.size() - 1 &&
+                    std::max(mips[first].width, mips[first].height) > maxInitialSize)
+                    first++;
+                mips.erase(mips.begin(), mips.begin() + first);
+            }
+        }
 
+        if (!mips.empty())
+        {
+            this->nrComponents = components;
+            this->storageBase = first;
+            this->residentBase = first;
 
-            stbi_image_free(data);
+            glGenTextures(1, &this->id);
+            GLuint previous = this->bindForUpdate();
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+            for (size_t i = 0; i < mips.size(); i++)
+            {
+                this->specifyLevel(first + (int)i, &mips[i]);
+            }
+            glBindTexture(GL_TEXTURE_2D, previous);
         }
         else
         {
             std::cout << "Texture failed to load at path: " << fileName << std::endl;
-            stbi_image_free(data);
         }
     }
+
+public:
+    Texture(const char* fileName, GLenum type, int maxInitialSize = 0)
+    {
+        this->id = 0;
+        this->width = 0;
+        this->height = 0;
+        this->levels = 0;
+        this->nrComponents = 0;
+        this->storageBase = 0;
+        this->residentBase = 0;
+        this->type = type;
+
+        this->load(fileName, maxInitialSize);
+    }
     ~Texture()
     {
         glDeleteTextures(1, &this->id);
     }
 
     inline GLuint getID() const { return this->id; }
+    inline int getWidth() const { return this->width; }
+    inline int getHeight() const { return this->height; }
+    inline int getLevels() const { return this->levels; }
+    inline int getStorageBase() const { return this->storageBase; }
+    inline int getResidentBase() const { return this->residentBase; }
+    inline const std::string& getFileName() const { return this->fileName; }
+
+    //Approximate video memory used by levels [base, levels). Drivers store RGB8 padded to four bytes.
+    size_t bytesFrom(int base) const
+    {
+        size_t texel = this->nrComponents == 3 ? 4 : (size_t)this->nrComponents;
+        size_t bytes = 0;
+        for (int level = base; level < this->levels; level++)
+        {
+            bytes += (size_t)this->levelWidth(level) * this->levelHeight(level) * texel;
+        }
+        return bytes;
+    }
+
+    size_t getResidentBytes() const { return this->bytesFrom(this->storageBase); }
+
+    //Releases the largest levels so that newBase becomes the top of the chain
+    void dropLevels(int newBase)
+    {
+        newBase = std::min(newBase, this->levels - 1);
+        if (!this->id || newBase <= this->storageBase)
+            return;
+
+        GLuint previous = this->bindForUpdate();
+        this->residentBase = std::max(this->residentBase, newBase);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, this->residentBase);
+        for (int level = this->storageBase; level < newBase; level++)
+        {
+            this->specifyLevel(level, nullptr);
+        }
+        glBindTexture(GL_TEXTURE_2D, previous);
+        this->storageBase = newBase;
+    }
+
+    //Reserves room back up to targetBase. The levels above the resident ones are specified as
+    //streamNextLevel reads them; GL_TEXTURE_BASE_LEVEL keeps sampling on the levels that are valid.
+    void beginStream(int targetBase)
+    {
+        targetBase = std::max(targetBase, 0);
+        if (this->id && targetBase < this->storageBase)
+            this->storageBase = targetBase;
+    }
+
+    //Uploads the next larger missing level from the cooked file, returns the bytes uploaded
+    size_t streamNextLevel()
+    {
+        int level = this->residentBase - 1;
+        if (this->residentBase <= this->storageBase || level >= (int)this->cookedLevels.size())
+            return 0;
+
+        MipLevel mip;
+        if (!MipGenerator::readCookedLevel(this->cookedFile.c_str(), this->cookedLevels[level], mip))
+            return 0;
+
+        GLuint previous = this->bindForUpdate();
+        this->specifyLevel(level, &mip);
+        this->residentBase = level;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, this->residentBase);
+        glBindTexture(GL_TEXTURE_2D, previous);
+        return mip.data.size();
+    }
+
+    inline bool isStreaming() const { return this->residentBase > this->storageBase; }
 
     void bind(const GLint texture_unit)
     {
@@ -81,43 +261,12 @@ public:
         if (this->id)
         {
             glDeleteTextures(1, &this->id);
+            this->id = 0;
         }
 
-        int nrComponents;
-        unsigned char* data = stbi_load(fileName, &this->width, &this->height, &nrComponents, 0);
-
-        glGenTextures(1, &this->id);
-        glBindTexture(type, this->id);
-
-        if (data)
-        {
-            GLenum format;
-            if (nrComponents == 1)
-                format = GL_RED;
-            else if (nrComponents == 3)
-                format = GL_RGB;
-            else if (nrComponents == 4)
-                format = GL_RGBA;
-
-
-            glTexImage2D(type, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(type);
-
-            glTexParameteri(type, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(type, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(type, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Texture failed to load at path: " << fileName << std::endl;
-            stbi_image_free(data);
-        }
+        this->load(fileName);
     }
 
-
     bool operator==(const Texture& tex)
     {
         if (this->id == tex.id)
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <cstdint>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+#include "Texture.h"
+#include "TextureManager.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Interns textures by path and by file contents so each image is decoded and uploaded once ////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class TextureCache
+{
+private:
+	//Entries don't keep textures alive: a texture is released once the last material handle goes
+	std::unordered_map<std::string, std::weak_ptr<Texture>> byPath;
+	//Loaded files by size. A file is only hashed once another of the same size shows up, and a matching
+	//hash is confirmed byte by byte before the texture is shared.
+	struct ContentEntry
+	{
+		std::string path;
+		bool hashed;
+		uint64_t hash;
+		std::weak_ptr<Texture> texture;
+	};
+	std::unordered_map<uint64_t, std::vector<ContentEntry>> bySize;
+	TextureManager* manager;
+
+	unsigned pathHits;
+	unsigned hashHits;
+	unsigned misses;
+
+	static std::string canonicalPath(const char* fileName)
+	{
+		std::error_code error;
+		std::filesystem::path path = std::filesystem::weakly_canonical(fileName, error);
+		std::string key = error ? std::string(fileName) : path.generic_string();
+#ifdef _WIN32
+		//Windows paths are case insensitive, "checkered.png" and "Checkered.png" are the same file
+		for (char& c : key)
+			c = (char)std::tolower((unsigned char)c);
+#endif
+		return key;
+	}
+
+	//FNV-1a over the file bytes, 0 if the file can't be read
+	static uint64_t hashFile(const std::string& fileName)
+	{
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file)
+			return 0;
+
+		uint64_t hash = 14695981039346656037ull;
+		char buffer[64 * 1024];
+		while (file)
+		{
+			file.read(buffer, sizeof(buffer));
+			std::streamsize count = file.gcount();
+			for (std::streamsize i = 0; i < count; i++)
+			{
+				hash ^= (unsigned char)buffer[i];
+				hash *= 1099511628211ull;
+			}
+		}
+		return hash;
+	}
+
+	static bool sameContents(const std::string& a, const std::string& b)
+	{
+		std::ifstream fileA(a, std::ios::binary), fileB(b, std::ios::binary);
+		if (!fileA || !fileB)
+			return false;
+
+		char bufferA[64 * 1024], bufferB[64 * 1024];
+		while (fileA && fileB)
+		{
+			fileA.read(bufferA, sizeof(bufferA));
+			fileB.read(bufferB, sizeof(bufferB));
+			std::streamsize count = fileA.gcount();
+			if (count != fileB.gcount() || std::memcmp(bufferA, bufferB, (size_t)count) != 0)
+				return false;
+		}
+		return !fileA == !fileB;
+	}
+
+	//A live texture loaded from a file with the same contents as path, which is size bytes long
+	std::shared_ptr<Texture> findContents(const std::string& path, uint64_t size, bool& hashed, uint64_t& hash)
+	{
+		auto sizeIt = this->bySize.find(size);
+		if (sizeIt == this->bySize.end())
+			return nullptr;
+
+		for (ContentEntry& entry : sizeIt->second)
+		{
+			std::shared_ptr<Texture> tex = entry.texture.lock();
+			if (!tex)
+				continue;
+			if (!entry.hashed)
+			{
+				entry.hash = hashFile(entry.path);
+				entry.hashed = true;
+			}
+			if (!hashed)
+			{
+				hash = hashFile(path);
+				hashed = true;
+			}
+			if (entry.hash == hash && sameContents(path, entry.path))
+				return tex;
+		}
+		return nullptr;
+	}
+
+public:
+	TextureCache(TextureManager* manager = nullptr)
+	{
+		this->manager = manager;
+		this->pathHits = 0;
+		this->hashHits = 0;
+		this->misses = 0;
+	}
+	~TextureCache() {}
+
+	//Returns the shared texture for fileName, loading it only if neither the same path
+	//nor a file with identical contents is already loaded
+	std::shared_ptr<Texture> load(const char* fileName, GLenum type = GL_TEXTURE_2D, int maxInitialSize = 0)
+	{
+		std::string key = canonicalPath(fileName);
+		auto pathIt = this->byPath.find(key);
+		if (pathIt != this->byPath.end())
+		{
+			if (std::shared_ptr<Texture> tex = pathIt->second.lock())
+			{
+				this->pathHits++;
+				return tex;
+			}
+		}
+
+		std::error_code error;
+		uint64_t size = (uint64_t)std::filesystem::file_size(key, error);
+		bool hashed = false;
+		uint64_t hash = 0;
+		if (!error)
+		{
+			if (std::shared_ptr<Texture> tex = this->findContents(key, size, hashed, hash))
+			{
+				this->hashHits++;
+				this->byPath[key] = tex;
+				return tex;
+			}
+		}
+
+		this->misses++;
+		TextureManager* manager = this->manager;
+		std::shared_ptr<Texture> tex(new Texture(fileName, type, maxInitialSize), [manager](Texture* t)
+		{
+			if (manager)
+				manager->remove(t);
+			delete t;
+		});
+		if (manager)
+			manager->add(tex.get());
+
+		this->byPath[key] = tex;
+		if (!error)
+			this->bySize[size].push_back({ key, hashed, hash, tex });
+		return tex;
+	}
+
+	//Forgets entries whose textures have been released
+	void prune()
+	{
+		for (auto it = this->byPath.begin(); it != this->byPath.end();)
+			it = it->second.expired() ? this->byPath.erase(it) : std::next(it);
+		for (auto it = this->bySize.begin(); it != this->bySize.end();)
+		{
+			std::vector<ContentEntry>& entries = it->second;
+			entries.erase(std::remove_if(entries.begin(), entries.end(), [](const ContentEntry& entry) { return entry.texture.expired(); }), entries.end());
+			it = entries.empty() ? this->bySize.erase(it) : std::next(it);
+		}
+	}
+
+	inline unsigned getPathHits() const { return this->pathHits; }
+	inline unsigned getHashHits() const { return this->hashHits; }
+	inline unsigned getMisses() const { return this->misses; }
+
+	void printStats() const
+	{
+		std::cout << "Texture cache: " << this->pathHits << " path hits, " << this->hashHits << " content hits, "
+			<< this->misses << " loads" << std::endl;
+	}
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+
+#include "Texture.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Keeps texture memory under a VRAM budget by dropping the top mip levels of least recently used textures ////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class TextureManager
+{
+private:
+	struct Entry
+	{
+		Texture* texture;
+		uint64_t lastUsed;
+		//Largest level anything drawn this frame asked for, INT_MAX when nothing did
+		int requestedBase;
+	};
+
+	std::vector<Entry> entries;
+	size_t budget;
+	size_t uploadBudget;
+	uint64_t frame;
+	size_t residentBytes;
+	//Levels this size or smaller are never evicted, so every texture can always be sampled
+	int minResidentSize;
+
+	Entry* find(const Texture* texture)
+	{
+		for (Entry& e : this->entries)
+		{
+			if (e.texture == texture)
+				return &e;
+		}
+		return nullptr;
+	}
+
+	bool canDrop(const Entry& e) const
+	{
+		const Texture* tex = e.texture;
+		int base = tex->getStorageBase();
+		return base < tex->getLevels() - 1 &&
+			std::max(tex->getWidth() >> base, tex->getHeight() >> base) > this->minResidentSize;
+	}
+
+	size_t countBytes() const
+	{
+		size_t bytes = 0;
+		for (const Entry& e : this->entries)
+			bytes += e.texture->getResidentBytes();
+		return bytes;
+	}
+
+	//Drops one top level at a time from the least recently used textures last used before
+	//olderThan, until extra more bytes fit in the budget. Returns whether they fit.
+	bool makeRoom(size_t extra, uint64_t olderThan)
+	{
+		if (this->residentBytes + extra <= this->budget)
+			return true;
+
+		std::vector<Entry*> lru;
+		for (Entry& e : this->entries)
+		{
+			if (e.lastUsed < olderThan)
+				lru.push_back(&e);
+		}
+		std::sort(lru.begin(), lru.end(), [](const Entry* a, const Entry* b) { return a->lastUsed < b->lastUsed; });
+
+		for (Entry* e : lru)
+		{
+			while (this->canDrop(*e) && this->residentBytes + extra > this->budget)
+			{
+				size_t before = e->texture->getResidentBytes();
+				e->texture->dropLevels(e->texture->getStorageBase() + 1);
+				this->residentBytes -= before - e->texture->getResidentBytes();
+			}
+			if (this->residentBytes + extra <= this->budget)
+				return true;
+		}
+		return false;
+	}
+
+public:
+	TextureManager(size_t budgetBytes, size_t uploadBytesPerFrame = 8 * 1024 * 1024)
+	{
+		this->budget = budgetBytes;
+		this->uploadBudget = uploadBytesPerFrame;
+		this->frame = 1;
+		this->residentBytes = 0;
+		this->minResidentSize = 64;
+	}
+	~TextureManager() {}
+
+	void add(Texture* texture)
+	{
+		if (this->find(texture))
+			return;
+		this->entries.push_back({ texture, 0, INT_MAX });
+		this->residentBytes += texture->getResidentBytes();
+	}
+
+	void remove(Texture* texture)
+	{
+		for (size_t i = 0; i < this->entries.size(); i++)
+		{
+			if (this->entries[i].texture == texture)
+			{
+				this->residentBytes -= texture->getResidentBytes();
+				this->entries.erase(this->entries.begin() + i);
+				return;
+			}
+		}
+	}
+
+	//Record that a texture was sampled this frame and needs levels from base down.
+	//Without any request a drawn texture wants its full resolution.
+	void requestLevel(const Texture* texture, int base)
+	{
+		Entry* e = this->find(texture);
+		if (e)
+		{
+			e->lastUsed = this->frame;
+			e->requestedBase = std::min(e->requestedBase, std::max(base, 0));
+		}
+	}
+
+	//Call once per frame after drawing: evicts down to the budget, grows textures drawn this frame
+	//by one level when it fits, and streams missing levels within the upload budget.
+	void update()
+	{
+		this->residentBytes = this->countBytes();
+		this->makeRoom(0, UINT64_MAX);
+
+		for (Entry& e : this->entries)
+		{
+			Texture* tex = e.texture;
+			if (e.lastUsed != this->frame)
+				continue;
+
+			int wantedBase = e.requestedBase == INT_MAX ? 0 : e.requestedBase;
+			e.requestedBase = INT_MAX;
+
+			//Release levels two or more steps finer than needed; one step of slack stops
+			//textures near a boundary from being dropped and streamed back every frame
+			if (wantedBase >= tex->getStorageBase() + 2)
+			{
+				size_t before = tex->getResidentBytes();
+				tex->dropLevels(wantedBase - 1);
+				this->residentBytes -= before - tex->getResidentBytes();
+				continue;
+			}
+
+			if (tex->isStreaming() || tex->getStorageBase() <= wantedBase)
+				continue;
+
+			int next = tex->getStorageBase() - 1;
+			size_t extra = tex->bytesFrom(next) - tex->getResidentBytes();
+			if (this->makeRoom(extra, this->frame))
+			{
+				tex->beginStream(next);
+				this->residentBytes += extra;
+			}
+		}
+
+		size_t uploaded = 0;
+		for (Entry& e : this->entries)
+		{
+			while (uploaded < this->uploadBudget && e.texture->isStreaming())
+			{
+				size_t bytes = e.texture->streamNextLevel();
+				if (bytes == 0)
+					break;
+				uploaded += bytes;
+			}
+		}
+
+		this->frame++;
+	}
+
+	void setBudget(size_t budgetBytes) { this->budget = budgetBytes; }
+	void setUploadBudget(size_t bytesPerFrame) { this->uploadBudget = bytesPerFrame; }
+	inline size_t getBudget() const { return this->budget; }
+	inline size_t getResidentBytes() const { return this->residentBytes; }
+	inline uint64_t getFrame() const { return this->frame; }
+};
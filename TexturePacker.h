@@ -0,0 +1,237 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+
+#include "glad/glad.h"
+#include <glm.hpp>
+
+#include "MipGenerator.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Packs textures into GL_TEXTURE_2D_ARRAY layers, and small ones into padded atlas pages, to cut binds ////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//Where a packed texture ended up: which array, which layer, and the rect inside the layer
+struct PackedTexture
+{
+	int array;
+	int layer;
+	//xy scale, zw offset of the texture inside its layer, (1, 1, 0, 0) for a whole layer
+	glm::vec4 rect;
+};
+
+class TextureArray
+{
+private:
+	GLuint id;
+	int width;
+	int height;
+	int layers;
+	int levels;
+
+public:
+	//levelsByLayer[layer][level], every layer must have the same size and level count
+	TextureArray(const std::vector<std::vector<MipLevel>>& levelsByLayer, int nrComponents)
+	{
+		this->width = levelsByLayer[0][0].width;
+		this->height = levelsByLayer[0][0].height;
+		this->layers = (int)levelsByLayer.size();
+		this->levels = (int)levelsByLayer[0].size();
+
+		GLenum internalFormat = nrComponents == 1 ? GL_R8 : nrComponents == 2 ? GL_RG8 : nrComponents == 3 ? GL_RGB8 : GL_RGBA8;
+		GLenum format = nrComponents == 1 ? GL_RED : nrComponents == 2 ? GL_RG : nrComponents == 3 ? GL_RGB : GL_RGBA;
+
+		glGenTextures(1, &this->id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, this->id);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, this->levels, internalFormat, this->width, this->height, this->layers);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int layer = 0; layer < this->layers; layer++)
+		{
+			for (int level = 0; level < this->levels; level++)
+			{
+				const MipLevel& mip = levelsByLayer[layer][level];
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mip.width, mip.height, 1, format, GL_UNSIGNED_BYTE, mip.data.data());
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+	}
+	~TextureArray()
+	{
+		glDeleteTextures(1, &this->id);
+	}
+
+	inline GLuint getID() const { return this->id; }
+	inline int getLayers() const { return this->layers; }
+
+	void bind(const GLint texture_unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + texture_unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, this->id);
+	}
+};
+
+class TexturePacker
+{
+private:
+	struct Source
+	{
+		std::string fileName;
+		std::vector<MipLevel> mips;
+		int components;
+	};
+
+	std::vector<Source> sources;
+	std::vector<PackedTexture> packed;
+	std::vector<std::unique_ptr<TextureArray>> arrays;
+	int atlasSize;
+	int smallSize;
+	int padding;
+
+	//Copies an image into a page with its edge texels repeated into the padding around it,
+	//so filtering and the first few mips don't bleed in neighbours
+	void blit(const MipLevel& src, int components, std::vector<unsigned char>& page, int x, int y)
+	{
+		for (int py = -this->padding; py < src.height + this->padding; py++)
+		{
+			int sy = std::min(std::max(py, 0), src.height - 1);
+			for (int px = -this->padding; px < src.width + this->padding; px++)
+			{
+				int sx = std::min(std::max(px, 0), src.width - 1);
+				const unsigned char* in = &src.data[((size_t)sy * src.width + sx) * components];
+				unsigned char* out = &page[((size_t)(y + py) * this->atlasSize + (x + px)) * components];
+				std::copy(in, in + components, out);
+			}
+		}
+	}
+
+	//Shelf packs small images, tallest first, into as many atlas pages as needed
+	void packAtlas(const std::vector<int>& indices, int components)
+	{
+		std::vector<int> order = indices;
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return this->sources[a].mips[0].height > this->sources[b].mips[0].height; });
+
+		std::vector<std::vector<unsigned char>> pages;
+		int x = this->atlasSize, y = 0, shelf = 0;
+		for (int i : order)
+		{
+			const MipLevel& img = this->sources[i].mips[0];
+			int w = img.width + this->padding * 2;
+			int h = img.height + this->padding * 2;
+			if (x + w > this->atlasSize)
+			{
+				x = 0;
+				y += shelf;
+				shelf = 0;
+			}
+			if (pages.empty() || y + h > this->atlasSize)
+			{
+				pages.emplace_back((size_t)this->atlasSize * this->atlasSize * components, 0);
+				x = 0;
+				y = 0;
+				shelf = 0;
+			}
+
+			this->blit(img, components, pages.back(), x + this->padding, y + this->padding);
+			float size = (float)this->atlasSize;
+			this->packed[i] = { (int)this->arrays.size(), (int)pages.size() - 1,
+				glm::vec4(img.width / size, img.height / size, (x + this->padding) / size, (y + this->padding) / size) };
+			x += w;
+			shelf = std::max(shelf, h);
+		}
+
+		//Past log2(padding) levels the border is under a texel wide and images blend into their neighbours,
+		//so the chain stops there; minified draws sample the last kept level instead
+		int atlasLevels = 1;
+		for (int border = this->padding; border > 1; border >>= 1)
+			atlasLevels++;
+
+		std::vector<std::vector<MipLevel>> layers;
+		for (const std::vector<unsigned char>& page : pages)
+		{
+			layers.push_back(MipGenerator::generate(page.data(), this->atlasSize, this->atlasSize, components, MIP_FILTER_BOX, components >= 3));
+			layers.back().resize(std::min((int)layers.back().size(), atlasLevels));
+		}
+		this->arrays.emplace_back(new TextureArray(layers, components));
+	}
+
+public:
+	//Images no larger than smallSize on either side go into atlas pages of atlasSize
+	TexturePacker(int atlasSize = 2048, int smallSize = 256, int padding = 4)
+	{
+		this->atlasSize = atlasSize;
+		this->smallSize = std::min(smallSize, atlasSize - padding * 2);
+		this->padding = padding;
+	}
+	~TexturePacker() {}
+
+	//Queues an image and returns its handle, valid for get() after build()
+	int add(const char* fileName)
+	{
+		Source src;
+		src.fileName = fileName;
+		src.components = 0;
+		std::string cooked = MipGenerator::cookedName(fileName);
+		if (!MipGenerator::readCooked(cooked.c_str(), src.mips, src.components))
+			MipGenerator::cookFile(fileName, cooked.c_str(), MIP_FILTER_BOX, &src.mips, &src.components);
+		if (src.mips.empty())
+		{
+			std::cout << "Texture failed to load at path: " << fileName << std::endl;
+			return -1;
+		}
+
+		this->sources.push_back(std::move(src));
+		return (int)this->sources.size() - 1;
+	}
+
+	//Groups queued images with the same size and format into arrays, one layer each,
+	//and packs small ones into atlas pages. Source pixels are released afterwards.
+	void build()
+	{
+		this->packed.assign(this->sources.size(), { -1, 0, glm::vec4(1.f, 1.f, 0.f, 0.f) });
+
+		std::map<std::tuple<int, int, int>, std::vector<int>> groups;
+		std::map<int, std::vector<int>> small;
+		for (size_t i = 0; i < this->sources.size(); i++)
+		{
+			const MipLevel& top = this->sources[i].mips[0];
+			if (std::max(top.width, top.height) <= this->smallSize)
+				small[this->sources[i].components].push_back((int)i);
+			else
+				groups[std::make_tuple(top.width, top.height, this->sources[i].components)].push_back((int)i);
+		}
+
+		for (auto& group : groups)
+		{
+			std::vector<std::vector<MipLevel>> layers;
+			for (int i : group.second)
+			{
+				this->packed[i] = { (int)this->arrays.size(), (int)layers.size(), glm::vec4(1.f, 1.f, 0.f, 0.f) };
+				layers.push_back(this->sources[i].mips);
+			}
+			this->arrays.emplace_back(new TextureArray(layers, std::get<2>(group.first)));
+		}
+
+		for (auto& group : small)
+			this->packAtlas(group.second, group.first);
+
+		for (Source& src : this->sources)
+			src.mips.clear();
+	}
+
+	inline const PackedTexture& get(int handle) const { return this->packed[handle]; }
+	inline TextureArray& getArray(int index) { return *this->arrays[index]; }
+	inline size_t getArrayCount() const { return this->arrays.size(); }
+};
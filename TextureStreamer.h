@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "Camera.h"
+#include "Mesh.h"
+#include "Material.h"
+#include "TextureManager.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////// Works out which mip level a drawn mesh actually samples and asks the TextureManager for it only ////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class TextureStreamer
+{
+private:
+	TextureManager* manager;
+	//Negative values request sharper levels than the estimate
+	float lodBias;
+
+public:
+	TextureStreamer(TextureManager* manager, float lodBias = 0.f)
+	{
+		this->manager = manager;
+		this->lodBias = lodBias;
+	}
+	~TextureStreamer() {}
+
+	//Largest level the texture needs on this mesh, from how many texels span its bounds against how many
+	//pixels they cover. The distance is to the bounds' center, never less than their radius, and the
+	//span is capped by the viewport: a large mesh the camera stands on (a floor) covers the screen at
+	//most, and asks for the level that fills it rather than for the texels under the camera.
+	//Screen size comes from the Camera projection and viewport height.
+	static int requiredLevel(Camera& camera, Mesh& mesh, const Texture& texture, float lodBias = 0.f)
+	{
+		return requiredLevel(camera, mesh.getWorldBounds(), mesh.getUVDensity(), texture, lodBias);
+	}
+
+	//Same from world bounds and uv density (texture coordinate units per world unit) directly
+	static int requiredLevel(Camera& camera, const AABB& worldBounds, float uvDensity, const Texture& texture, float lodBias = 0.f)
+	{
+		float radius = glm::length(worldBounds.extents());
+		float distance = std::max(glm::length(worldBounds.center() - camera.Position), radius);
+		if (distance <= 0.f)
+			return 0;
+
+		float texelsPerUnit = uvDensity * std::max(texture.getWidth(), texture.getHeight());
+		float pixelsPerUnit = camera.getPixelsPerUnit() / distance;
+		if (radius > 0.f)
+			pixelsPerUnit = std::min(pixelsPerUnit, (float)camera.getHeight() / (2.f * radius));
+		if (pixelsPerUnit <= 0.f || texelsPerUnit <= 0.f)
+			return 0;
+
+		float lod = std::log2(texelsPerUnit / pixelsPerUnit) + lodBias;
+		return std::min(std::max((int)std::floor(lod), 0), texture.getLevels() - 1);
+	}
+
+	//Call for every mesh drawn this frame with the material it is drawn with
+	void request(Camera& camera, Mesh& mesh, const Material& material)
+	{
+		for (int i = 0; i < Material::TEXTURE_COUNT; i++)
+		{
+			const Texture* tex = material.getTexture(i);
+			if (tex)
+				this->manager->requestLevel(tex, requiredLevel(camera, mesh, *tex, this->lodBias));
+		}
+	}
+
+	void request(Camera& camera, const AABB& worldBounds, float uvDensity, const Material& material)
+	{
+		for (int i = 0; i < Material::TEXTURE_COUNT; i++)
+		{
+			const Texture* tex = material.getTexture(i);
+			if (tex)
+				this->manager->requestLevel(tex, requiredLevel(camera, worldBounds, uvDensity, *tex, this->lodBias));
+		}
+	}
+};
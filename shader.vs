@@ -10,11 +10,15 @@ out vec2 TexCoord;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool flipTexcoordY;
+
+//Depth.vs computes it the same way for the depth pre-pass
+invariant gl_Position;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal; 
 	gl_Position = projection * view * model * vec4(aPos, 1.0f);
-	TexCoord = aTexCoord;
+	TexCoord = flipTexcoordY ? vec2(aTexCoord.x, 1.0 - aTexCoord.y) : aTexCoord;
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#version 330 core
+out vec4 FragColor;
+
+// Same lighting as shader.fs, but every material texture is a layer (or an atlas rect inside a layer)
+// of a texture array, so materials packed into one array can share bindings.
+struct Material {
+    sampler2DArray diffuse1;
+    sampler2DArray diffuse2;
+    sampler2DArray specular;
+    vec3 layer;     // layer of diffuse1, diffuse2 and specular
+    vec4 rect[3];   // xy scale, zw offset inside the layer
+    float shininess;
+}; 
+
+struct Light {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoord;
+
+uniform vec3 viewPos;
+uniform Material material;
+uniform Light light;
+
+// Wraps inside the atlas rect; gradients come from the unwrapped coordinate so the seam keeps its mip level
+vec4 samplePacked(sampler2DArray tex, float layer, vec4 rect)
+{
+    vec2 uv = rect.zw + fract(TexCoord) * rect.xy;
+    return textureGrad(tex, vec3(uv, layer), dFdx(TexCoord) * rect.xy, dFdy(TexCoord) * rect.xy);
+}
+
+void main()
+{
+    vec3 albedo = mix(samplePacked(material.diffuse1, material.layer.x, material.rect[0]),
+                      samplePacked(material.diffuse2, material.layer.y, material.rect[1]), 0.2).rgb;
+
+    vec3 ambient = light.ambient * albedo;
+  	
+    // diffuse 
+    vec3 norm = normalize(Normal);
+    vec3 lightDir = normalize(light.position - FragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diff * albedo;  
+    
+    // specular
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);  
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    vec3 specular = light.specular * spec * samplePacked(material.specular, material.layer.z, material.rect[2]).rgb;  
+        
+    vec3 result = ambient + diffuse + specular;
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+//Instance index, picked per indirect draw by its base instance
+layout (location = 4) in uint aInstance;
+
+struct Instance
+{
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform bool flipTexcoordY;
+
+//DepthIndirect.vs computes it the same way for the depth pre-pass
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = instances[aInstance].model;
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    TexCoord = flipTexcoordY ? vec2(aTexCoord.x, 1.0 - aTexCoord.y) : aTexCoord;
+}
\ No newline at end of file